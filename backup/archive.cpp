@@ -0,0 +1,468 @@
+#include "archive.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <openssl/sha.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// Packs are rolled at this size so no single file grows without bound.
+static const uint64_t kPackBytes = 256ULL << 20;
+static const char kSnapshotMagic[] = "dfs-backup-snapshot 1";
+
+struct IndexRecord
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    uint32_t pack;
+    uint64_t offset;
+    uint32_t stored;
+    uint32_t raw;
+} __attribute__((packed));
+
+static bool PwriteAll(int fd, const char *data, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = pwrite(fd, data + done, size - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+static bool PreadAll(int fd, char *buf, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = pread(fd, buf + done, size - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+static std::string Hex(const std::string &digest)
+{
+    static const char kDigits[] = "0123456789abcdef";
+    std::string hex;
+    for (unsigned char c : digest)
+    {
+        hex += kDigits[c >> 4];
+        hex += kDigits[c & 15];
+    }
+    return hex;
+}
+
+static bool Unhex(const std::string &hex, std::string *digest)
+{
+    if (hex.size() != 2 * SHA256_DIGEST_LENGTH)
+        return false;
+    digest->clear();
+    for (size_t i = 0; i < hex.size(); i += 2)
+    {
+        unsigned int byte;
+        if (sscanf(hex.c_str() + i, "%2x", &byte) != 1)
+            return false;
+        *digest += (char)byte;
+    }
+    return true;
+}
+
+// Paths are one per line and tab-separated from their fields.
+static std::string EscapePath(const std::string &path)
+{
+    std::string escaped;
+    for (char c : path)
+    {
+        if (c == '%')
+            escaped += "%25";
+        else if (c == '\t')
+            escaped += "%09";
+        else if (c == '\n')
+            escaped += "%0A";
+        else
+            escaped += c;
+    }
+    return escaped;
+}
+
+static std::string UnescapePath(const std::string &escaped)
+{
+    std::string path;
+    for (size_t i = 0; i < escaped.size(); i++)
+    {
+        unsigned int c;
+        if (escaped[i] == '%' && i + 2 < escaped.size() && sscanf(escaped.c_str() + i + 1, "%2x", &c) == 1)
+        {
+            path += (char)c;
+            i += 2;
+        }
+        else
+        {
+            path += escaped[i];
+        }
+    }
+    return path;
+}
+
+// Reads one line of any length; false at end of file.
+static bool ReadLine(gzFile file, std::string *line)
+{
+    char buf[65536];
+    line->clear();
+    while (gzgets(file, buf, sizeof(buf)) != nullptr)
+    {
+        *line += buf;
+        if (!line->empty() && line->back() == '\n')
+        {
+            line->pop_back();
+            return true;
+        }
+    }
+    return !line->empty();
+}
+
+static bool SyncPath(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+std::unique_ptr<Archive> Archive::Open(const std::string &dir, int compression_level, std::string *error)
+{
+    std::unique_ptr<Archive> archive(new Archive(dir, compression_level));
+    if (!archive->Load(error))
+        return nullptr;
+    return archive;
+}
+
+Archive::~Archive()
+{
+    for (auto &entry : pack_fds_)
+        close(entry.second);
+    if (index_fd_ >= 0)
+        close(index_fd_);
+}
+
+std::string Archive::PackName(uint32_t pack) const
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "/packs/pack-%08u", pack);
+    return dir_ + buf;
+}
+
+int Archive::PackFd(uint32_t pack, bool create)
+{
+    auto it = pack_fds_.find(pack);
+    if (it != pack_fds_.end())
+        return it->second;
+    int fd = open(PackName(pack).c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0644);
+    if (fd < 0)
+        return -errno;
+    pack_fds_[pack] = fd;
+    return fd;
+}
+
+bool Archive::Load(std::string *error)
+{
+    for (const std::string &sub : {std::string(), std::string("/packs"), std::string("/snapshots")})
+    {
+        if (mkdir((dir_ + sub).c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            *error = "cannot create " + dir_ + sub + ": " + strerror(errno);
+            return false;
+        }
+    }
+
+    std::string index_path = dir_ + "/chunks.idx";
+    index_fd_ = open(index_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    if (index_fd_ < 0 || fstat(index_fd_, &st) != 0)
+    {
+        *error = "cannot open " + index_path + ": " + strerror(errno);
+        return false;
+    }
+    // A partial last record is from a crash mid-append; drop it.
+    uint64_t records = st.st_size / sizeof(IndexRecord);
+    std::vector<IndexRecord> all(records);
+    if (records > 0 && !PreadAll(index_fd_, (char *)all.data(), records * sizeof(IndexRecord), 0))
+    {
+        *error = "cannot read " + index_path + ": " + strerror(errno);
+        return false;
+    }
+    if ((uint64_t)st.st_size != records * sizeof(IndexRecord) && ftruncate(index_fd_, records * sizeof(IndexRecord)) != 0)
+    {
+        *error = "cannot truncate " + index_path + ": " + strerror(errno);
+        return false;
+    }
+    for (const IndexRecord &record : all)
+    {
+        index_[std::string((const char *)record.digest, sizeof(record.digest))] = {record.pack, record.offset,
+                                                                                 record.stored, record.raw};
+        pack_ = std::max(pack_, record.pack);
+    }
+
+    // Append after whatever the newest pack holds, referenced or not.
+    DIR *d = opendir((dir_ + "/packs").c_str());
+    while (struct dirent *entry = d ? readdir(d) : nullptr)
+    {
+        unsigned int pack;
+        if (sscanf(entry->d_name, "pack-%u", &pack) == 1)
+            pack_ = std::max(pack_, pack);
+    }
+    if (d)
+        closedir(d);
+    int fd = PackFd(pack_, true);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        *error = "cannot open " + PackName(pack_) + ": " + strerror(errno);
+        return false;
+    }
+    pack_end_ = st.st_size;
+    return true;
+}
+
+bool Archive::PutChunk(const std::string &data, std::string *digest, bool *added, std::string *error)
+{
+    unsigned char md[SHA256_DIGEST_LENGTH];
+    SHA256((const unsigned char *)data.data(), data.size(), md);
+    digest->assign((const char *)md, sizeof(md));
+    *added = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (index_.count(*digest))
+            return true;
+    }
+
+    // Stored raw when compression does not help.
+    std::string compressed(compressBound(data.size()), '\0');
+    uLongf length = compressed.size();
+    bool packed = compress2((Bytef *)&compressed[0], &length, (const Bytef *)data.data(), data.size(), level_) == Z_OK &&
+                  length < data.size();
+    const std::string &stored = packed ? compressed : data;
+    size_t stored_bytes = packed ? length : data.size();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index_.count(*digest))
+        return true; // another thread stored it meanwhile
+    if (pack_end_ > 0 && pack_end_ + stored_bytes > kPackBytes)
+    {
+        pack_++;
+        pack_end_ = 0;
+    }
+    int fd = PackFd(pack_, true);
+    if (fd < 0 || !PwriteAll(fd, stored.data(), stored_bytes, pack_end_))
+    {
+        *error = "cannot write " + PackName(pack_) + ": " + strerror(fd < 0 ? -fd : errno);
+        return false;
+    }
+    Location location{pack_, pack_end_, (uint32_t)stored_bytes, (uint32_t)data.size()};
+    pack_end_ += stored_bytes;
+    index_[*digest] = location;
+    unsynced_.emplace_back(*digest, location);
+    added_bytes_ += stored_bytes;
+    *added = true;
+    return true;
+}
+
+bool Archive::GetChunk(const std::string &digest, std::string *data, std::string *error)
+{
+    Location location;
+    int fd;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(digest);
+        if (it == index_.end())
+        {
+            *error = "missing chunk " + Hex(digest);
+            return false;
+        }
+        location = it->second;
+        fd = PackFd(location.pack, false);
+    }
+    std::string stored(location.stored, '\0');
+    if (fd < 0 || !PreadAll(fd, &stored[0], stored.size(), location.offset))
+    {
+        *error = "cannot read chunk " + Hex(digest) + " from " + PackName(location.pack);
+        return false;
+    }
+    if (location.stored == location.raw)
+    {
+        *data = std::move(stored);
+        return true;
+    }
+    data->assign(location.raw, '\0');
+    uLongf length = location.raw;
+    if (uncompress((Bytef *)&(*data)[0], &length, (const Bytef *)stored.data(), stored.size()) != Z_OK ||
+        length != location.raw)
+    {
+        *error = "corrupt chunk " + Hex(digest);
+        return false;
+    }
+    return true;
+}
+
+bool Archive::Sync(std::string *error)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (unsynced_.empty())
+        return true;
+    for (auto &entry : pack_fds_)
+    {
+        if (fdatasync(entry.second) != 0)
+        {
+            *error = "cannot sync " + PackName(entry.first) + ": " + strerror(errno);
+            return false;
+        }
+    }
+
+    std::string records;
+    for (const auto &entry : unsynced_)
+    {
+        IndexRecord record;
+        memcpy(record.digest, entry.first.data(), sizeof(record.digest));
+        record.pack = entry.second.pack;
+        record.offset = entry.second.offset;
+        record.stored = entry.second.stored;
+        record.raw = entry.second.raw;
+        records.append((const char *)&record, sizeof(record));
+    }
+    struct stat st;
+    if (fstat(index_fd_, &st) != 0 || !PwriteAll(index_fd_, records.data(), records.size(), st.st_size) ||
+        fdatasync(index_fd_) != 0)
+    {
+        *error = std::string("cannot write chunks.idx: ") + strerror(errno);
+        return false;
+    }
+    unsynced_.clear();
+    return true;
+}
+
+std::vector<uint64_t> Archive::Snapshots()
+{
+    std::vector<uint64_t> numbers;
+    DIR *d = opendir((dir_ + "/snapshots").c_str());
+    while (struct dirent *entry = d ? readdir(d) : nullptr)
+    {
+        unsigned long long number;
+        char suffix[8];
+        if (sscanf(entry->d_name, "%llu.%7s", &number, suffix) == 2 && strcmp(suffix, "gz") == 0)
+            numbers.push_back(number);
+    }
+    if (d)
+        closedir(d);
+    std::sort(numbers.begin(), numbers.end());
+    return numbers;
+}
+
+static std::string SnapshotName(const std::string &dir, uint64_t number)
+{
+    char buf[40];
+    snprintf(buf, sizeof(buf), "/snapshots/%08llu.gz", (unsigned long long)number);
+    return dir + buf;
+}
+
+bool Archive::ReadSnapshot(uint64_t number, Manifest *manifest, uint64_t *cursor, std::string *error)
+{
+    std::string path = SnapshotName(dir_, number);
+    gzFile file = gzopen(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        *error = "cannot open " + path;
+        return false;
+    }
+    manifest->clear();
+    std::string line;
+    unsigned long long position = 0;
+    bool ok = ReadLine(file, &line) && line == kSnapshotMagic && ReadLine(file, &line) &&
+              sscanf(line.c_str(), "cursor %llu", &position) == 1;
+    while (ok && ReadLine(file, &line))
+    {
+        // path \t size \t mtime \t version \t digest,digest,...
+        std::vector<std::string> fields;
+        size_t start = 0;
+        for (size_t tab; (tab = line.find('\t', start)) != std::string::npos; start = tab + 1)
+            fields.push_back(line.substr(start, tab - start));
+        fields.push_back(line.substr(start));
+        if (fields.size() != 5)
+        {
+            ok = false;
+            break;
+        }
+        File &entry = (*manifest)[UnescapePath(fields[0])];
+        entry.size = strtoll(fields[1].c_str(), nullptr, 10);
+        entry.mtime = strtoll(fields[2].c_str(), nullptr, 10);
+        entry.version = strtoll(fields[3].c_str(), nullptr, 10);
+        start = 0;
+        while (ok && start < fields[4].size())
+        {
+            size_t comma = fields[4].find(',', start);
+            if (comma == std::string::npos)
+                comma = fields[4].size();
+            std::string digest;
+            ok = Unhex(fields[4].substr(start, comma - start), &digest);
+            entry.chunks.push_back(digest);
+            start = comma + 1;
+        }
+    }
+    gzclose(file);
+    if (!ok)
+    {
+        *error = "corrupt snapshot " + path;
+        return false;
+    }
+    *cursor = position;
+    return true;
+}
+
+bool Archive::WriteSnapshot(const Manifest &manifest, uint64_t cursor, uint64_t *number, std::string *error)
+{
+    std::vector<uint64_t> existing = Snapshots();
+    *number = existing.empty() ? 1 : existing.back() + 1;
+    std::string path = SnapshotName(dir_, *number);
+    std::string temporary = dir_ + "/snapshots/.incomplete";
+
+    gzFile file = gzopen(temporary.c_str(), "wb");
+    bool ok = file != nullptr;
+    if (ok)
+    {
+        std::string header = std::string(kSnapshotMagic) + "\ncursor " + std::to_string(cursor) + "\n";
+        ok = gzputs(file, header.c_str()) >= 0;
+    }
+    for (auto it = manifest.begin(); ok && it != manifest.end(); ++it)
+    {
+        std::string line = EscapePath(it->first) + "\t" + std::to_string(it->second.size) + "\t" +
+                           std::to_string(it->second.mtime) + "\t" + std::to_string(it->second.version) + "\t";
+        for (size_t i = 0; i < it->second.chunks.size(); i++)
+            line += (i ? "," : "") + Hex(it->second.chunks[i]);
+        line += "\n";
+        ok = gzwrite(file, line.data(), line.size()) == (int)line.size();
+    }
+    if (file != nullptr && gzclose(file) != Z_OK)
+        ok = false;
+    if (!ok || !SyncPath(temporary) || rename(temporary.c_str(), path.c_str()) != 0 ||
+        !SyncPath(dir_ + "/snapshots"))
+    {
+        *error = "cannot write " + path + ": " + strerror(errno);
+        return false;
+    }
+    return true;
+}
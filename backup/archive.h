@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A backup archive directory:
+//
+//   packs/pack-00000001 ...  zlib-compressed chunks, appended
+//   chunks.idx               SHA-256 -> (pack, offset, stored and raw size)
+//   snapshots/00000001.gz ...  one manifest per backup run
+//
+// Chunks are stored once however many files and snapshots refer to them,
+// so an incremental snapshot costs only its new chunks plus a manifest.
+// New index entries are written only after the packs they point into are
+// synced, so a crash can leave unreferenced pack bytes but never an index
+// entry (or a snapshot) pointing at missing data.
+class Archive
+{
+public:
+    struct File
+    {
+        int64_t size = 0;
+        int64_t mtime = 0;
+        int64_t version = 0;
+        std::vector<std::string> chunks; // raw SHA-256 digests, in order
+    };
+    // Keyed by server path (normalized, no leading '/').
+    using Manifest = std::map<std::string, File>;
+
+    static std::unique_ptr<Archive> Open(const std::string &dir, int compression_level, std::string *error);
+    ~Archive();
+
+    // Stores a chunk unless one with the same digest is already present.
+    // Thread-safe. Returns false with `error` set on I/O failure.
+    bool PutChunk(const std::string &data, std::string *digest, bool *added, std::string *error);
+    bool GetChunk(const std::string &digest, std::string *data, std::string *error);
+    // Makes every chunk stored so far durable.
+    bool Sync(std::string *error);
+
+    // Snapshot numbers, oldest first.
+    std::vector<uint64_t> Snapshots();
+    // `cursor` is the server change-journal position the snapshot is
+    // current to (0 = none).
+    bool ReadSnapshot(uint64_t number, Manifest *manifest, uint64_t *cursor, std::string *error);
+    // Writes the next snapshot; call Sync() first.
+    bool WriteSnapshot(const Manifest &manifest, uint64_t cursor, uint64_t *number, std::string *error);
+
+    // Stored bytes added by PutChunk so far (after compression).
+    uint64_t added_bytes() const { return added_bytes_; }
+
+private:
+    struct Location
+    {
+        uint32_t pack;
+        uint64_t offset;
+        uint32_t stored; // == raw: stored uncompressed
+        uint32_t raw;
+    };
+
+    Archive(const std::string &dir, int level) : dir_(dir), level_(level) {}
+
+    bool Load(std::string *error);
+    int PackFd(uint32_t pack, bool create);
+    std::string PackName(uint32_t pack) const;
+
+    std::string dir_;
+    int level_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, Location> index_;
+    std::vector<std::pair<std::string, Location>> unsynced_; // not in chunks.idx yet
+    std::map<uint32_t, int> pack_fds_;
+    uint32_t pack_ = 1;    // receiving appends
+    uint64_t pack_end_ = 0;
+    int index_fd_ = -1;
+    uint64_t added_bytes_ = 0;
+};
@@ -0,0 +1,77 @@
+#include "chunker.h"
+
+#include <algorithm>
+
+// Fixed pseudo-random table (splitmix64), so chunk boundaries, and with
+// them deduplication, are the same across runs.
+static const uint64_t *GearTable()
+{
+    static uint64_t table[256];
+    static bool initialized = [] {
+        uint64_t state = 0x9e3779b97f4a7c15ULL;
+        for (uint64_t &entry : table)
+        {
+            uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            entry = z ^ (z >> 31);
+        }
+        return true;
+    }();
+    (void)initialized;
+    return table;
+}
+
+Chunker::Chunker(size_t avg_bytes, std::function<bool(const std::string &)> emit)
+    : emit_(std::move(emit))
+{
+    avg_bytes = std::max<size_t>(avg_bytes, 256);
+    min_bytes_ = avg_bytes / 4;
+    max_bytes_ = avg_bytes * 4;
+    // Expected distance between mask matches is avg - min after the minimum.
+    int bits = 0;
+    while ((2ULL << bits) <= avg_bytes - min_bytes_)
+        bits++;
+    mask_ = ((1ULL << bits) - 1) << (64 - bits); // high bits mix the most bytes
+}
+
+bool Chunker::Add(const char *data, size_t size)
+{
+    const uint64_t *gear = GearTable();
+    pending_.append(data, size);
+    while (true)
+    {
+        size_t cut = 0;
+        if (scanned_ < min_bytes_)
+            scanned_ = std::min(min_bytes_, pending_.size());
+        size_t limit = std::min(pending_.size(), max_bytes_);
+        while (scanned_ < limit)
+        {
+            hash_ = (hash_ << 1) + gear[(unsigned char)pending_[scanned_++]];
+            if ((hash_ & mask_) == 0)
+            {
+                cut = scanned_;
+                break;
+            }
+        }
+        if (cut == 0 && scanned_ >= max_bytes_)
+            cut = max_bytes_;
+        if (cut == 0)
+            return true; // need more data
+
+        if (!emit_(pending_.substr(0, cut)))
+            return false;
+        pending_.erase(0, cut);
+        hash_ = 0;
+        scanned_ = 0;
+    }
+}
+
+bool Chunker::Finish()
+{
+    bool ok = pending_.empty() || emit_(pending_);
+    pending_.clear();
+    hash_ = 0;
+    scanned_ = 0;
+    return ok;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Content-defined chunking with a gear rolling hash (as in FastCDC): a cut
+// falls where the hash of the last few dozen bytes matches a mask, so an
+// insertion early in a file only changes the chunks around it and the rest
+// still deduplicate. Chunks are between avg/4 and avg*4 bytes, avg on
+// average.
+class Chunker
+{
+public:
+    Chunker(size_t avg_bytes, std::function<bool(const std::string &)> emit);
+
+    // Feeds the next bytes of the file; returns false if `emit` did.
+    bool Add(const char *data, size_t size);
+    // Emits what is left; call once at end of file.
+    bool Finish();
+
+private:
+    size_t min_bytes_;
+    size_t max_bytes_;
+    uint64_t mask_;
+    std::function<bool(const std::string &)> emit_;
+    std::string pending_;
+    uint64_t hash_ = 0;
+    size_t scanned_ = 0; // bytes of pending_ already hashed
+};
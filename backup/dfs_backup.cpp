@@ -0,0 +1,454 @@
+// Snapshot backups of a DFS server into a compressed, chunk-deduplicated
+// archive (see archive.h).
+//
+//   ./build/dfs_backup backup /backups/dfs
+//   ./build/dfs_backup list /backups/dfs
+//   ./build/dfs_backup restore /backups/dfs /restore/dir [--backup.snapshot=N]
+//
+// The first backup walks the whole tree. Later ones read the server's
+// change journal (server.journal_dir) from where the last snapshot left
+// off and export only the files it names; without a journal, or if the
+// journal no longer reaches back that far, they walk the tree again but
+// re-read only files whose size, mtime or version changed. Either way
+// unchanged chunks of re-read files are not stored twice.
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+#include "../build/dfs.grpc.pb.h"
+#include "../common/config.h"
+#include "../common/transport.h"
+#include "archive.h"
+#include "chunker.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct BackupOptions
+{
+    int64_t timeout_ms = 0;
+    size_t read_bytes = 1 << 20;
+    size_t chunk_bytes = 64 << 10;
+    int parallelism = 4;
+};
+
+// A file to (re-)export, with the attributes it was listed with.
+struct ExportTask
+{
+    std::string path;
+    Archive::File attrs;
+};
+
+struct BackupStats
+{
+    std::atomic<uint64_t> exported{0};
+    std::atomic<uint64_t> read_bytes{0};
+    std::atomic<uint64_t> vanished{0};
+};
+
+// Streams `path` through the chunker into the archive. Sets `*vanished`
+// if the file was removed before it could be read.
+static bool ExportFile(dfs::DFS::Stub *stub, Archive &archive, const BackupOptions &options, const std::string &path,
+                       Archive::File *file, bool *vanished, BackupStats *stats, std::string *error)
+{
+    *vanished = false;
+    file->chunks.clear();
+    Chunker chunker(options.chunk_bytes, [&](const std::string &chunk) {
+        std::string digest;
+        bool added;
+        if (!archive.PutChunk(chunk, &digest, &added, error))
+            return false;
+        file->chunks.push_back(digest);
+        return true;
+    });
+
+    int64_t offset = 0;
+    while (true)
+    {
+        dfs::ReadRequest request;
+        request.set_path(path);
+        request.set_offset(offset);
+        request.set_size(options.read_bytes);
+        dfs::ReadResponse response;
+        grpc::ClientContext context;
+        dfs::SetRpcDeadline(context, options.timeout_ms);
+        grpc::Status status = stub->Read(&context, request, &response);
+        if (status.error_code() == grpc::StatusCode::NOT_FOUND)
+        {
+            *vanished = true;
+            return true;
+        }
+        if (!status.ok())
+        {
+            *error = "cannot read " + path + ": " + status.error_message();
+            return false;
+        }
+        if (!chunker.Add(response.data().data(), response.data().size()))
+            return false;
+        offset += response.data().size();
+        stats->read_bytes += response.data().size();
+        if (response.data().size() < options.read_bytes)
+            break;
+    }
+    if (!chunker.Finish())
+        return false;
+    file->size = offset; // what was read, even if the file grew meanwhile
+    stats->exported++;
+    return true;
+}
+
+// Exports `tasks` on `parallelism` threads into `manifest`.
+static bool ExportAll(dfs::DFS::Stub *stub, Archive &archive, const BackupOptions &options,
+                      std::vector<ExportTask> &tasks, Archive::Manifest *manifest, BackupStats *stats,
+                      std::string *error)
+{
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::vector<char> vanished(tasks.size()); // not vector<bool>: written concurrently
+    std::mutex error_mutex;
+    auto worker = [&] {
+        for (size_t i; !failed && (i = next++) < tasks.size();)
+        {
+            std::string message;
+            bool gone;
+            if (!ExportFile(stub, archive, options, tasks[i].path, &tasks[i].attrs, &gone, stats, &message))
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                *error = message;
+                failed = true;
+            }
+            vanished[i] = gone;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < options.parallelism; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread &thread : threads)
+        thread.join();
+    if (failed)
+        return false;
+
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        if (vanished[i])
+        {
+            manifest->erase(tasks[i].path);
+            stats->vanished++;
+        }
+        else
+        {
+            (*manifest)[tasks[i].path] = std::move(tasks[i].attrs);
+        }
+    }
+    return true;
+}
+
+static bool SameVersion(const Archive::File &a, const Archive::File &b)
+{
+    return a.size == b.size && a.mtime == b.mtime && a.version == b.version;
+}
+
+// Walks the tree; unchanged files keep their chunks from `previous`, the
+// rest become tasks.
+static bool Walk(dfs::DFS::Stub *stub, const BackupOptions &options, const Archive::Manifest &previous,
+                 Archive::Manifest *manifest, std::vector<ExportTask> *tasks, std::string *error)
+{
+    std::vector<std::string> dirs = {""};
+    while (!dirs.empty())
+    {
+        std::string dir = dirs.back();
+        dirs.pop_back();
+        std::string start_after;
+        bool more = true;
+        while (more)
+        {
+            dfs::ListDirectoryRequest request;
+            request.set_path(dir);
+            request.set_start_after(start_after);
+            dfs::ListDirectoryResponse response;
+            grpc::ClientContext context;
+            dfs::SetRpcDeadline(context, options.timeout_ms);
+            grpc::Status status = stub->ListDirectory(&context, request, &response);
+            if (status.error_code() == grpc::StatusCode::NOT_FOUND && !dir.empty())
+                break; // removed while we walked
+            if (!status.ok())
+            {
+                *error = "cannot list /" + dir + ": " + status.error_message();
+                return false;
+            }
+            for (const dfs::ListDirectoryEntry &entry : response.entries())
+            {
+                std::string path = dir.empty() ? entry.name() : dir + "/" + entry.name();
+                start_after = entry.name();
+                if (entry.is_dir())
+                {
+                    dirs.push_back(path);
+                    continue;
+                }
+                Archive::File attrs;
+                attrs.size = entry.size();
+                attrs.mtime = entry.mtime();
+                attrs.version = entry.version();
+                auto it = previous.find(path);
+                if (it != previous.end() && SameVersion(it->second, attrs))
+                    (*manifest)[path] = it->second;
+                else
+                    tasks->push_back({path, attrs});
+            }
+            more = response.more() && response.entries_size() > 0;
+        }
+    }
+    return true;
+}
+
+// Collects the paths changed after `*cursor` and advances it. False if the
+// journal cannot say (none configured, or it dropped changes we need).
+static bool ReadChanges(dfs::DFS::Stub *stub, const BackupOptions &options, uint64_t *cursor,
+                        std::set<std::string> *changed)
+{
+    while (true)
+    {
+        dfs::ReadJournalRequest request;
+        request.set_cursor(*cursor);
+        dfs::ReadJournalResponse response;
+        grpc::ClientContext context;
+        dfs::SetRpcDeadline(context, options.timeout_ms);
+        grpc::Status status = stub->ReadJournal(&context, request, &response);
+        if (!status.ok() || response.truncated())
+            return false;
+        for (const dfs::WatchEvent &event : response.events())
+            changed->insert(event.path());
+        *cursor = response.next_cursor();
+        if (response.events_size() == 0)
+            return true;
+    }
+}
+
+// Current end of the change journal, or 0 without one.
+static uint64_t JournalEnd(dfs::DFS::Stub *stub, const BackupOptions &options)
+{
+    dfs::ReadJournalRequest request;
+    request.set_latest(true);
+    dfs::ReadJournalResponse response;
+    grpc::ClientContext context;
+    dfs::SetRpcDeadline(context, options.timeout_ms);
+    return stub->ReadJournal(&context, request, &response).ok() ? response.next_cursor() : 0;
+}
+
+static int Backup(dfs::DFS::Stub *stub, Archive &archive, const BackupOptions &options, bool full)
+{
+    auto start = Clock::now();
+    std::string error;
+    Archive::Manifest previous;
+    uint64_t cursor = 0;
+    std::vector<uint64_t> snapshots = archive.Snapshots();
+    if (!snapshots.empty() && !archive.ReadSnapshot(snapshots.back(), &previous, &cursor, &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    Archive::Manifest manifest;
+    std::vector<ExportTask> tasks;
+    std::set<std::string> changed;
+    uint64_t next_cursor = cursor;
+    bool incremental = !full && !snapshots.empty() && cursor != 0 && ReadChanges(stub, options, &next_cursor, &changed);
+    if (incremental)
+    {
+        manifest = previous;
+        for (const std::string &path : changed)
+        {
+            dfs::GetAttrRequest request;
+            request.set_path(path);
+            dfs::GetAttrResponse response;
+            grpc::ClientContext context;
+            dfs::SetRpcDeadline(context, options.timeout_ms);
+            grpc::Status status = stub->GetAttr(&context, request, &response);
+            if (!status.ok() && status.error_code() != grpc::StatusCode::NOT_FOUND)
+            {
+                std::cerr << "cannot stat /" << path << ": " << status.error_message() << std::endl;
+                return 1;
+            }
+            if (!status.ok() || !response.exists())
+            {
+                manifest.erase(path);
+                continue;
+            }
+            Archive::File attrs;
+            attrs.size = response.size();
+            attrs.mtime = response.mtime();
+            attrs.version = response.version();
+            auto it = previous.find(path);
+            if (it == previous.end() || !SameVersion(it->second, attrs))
+                tasks.push_back({path, attrs});
+        }
+    }
+    else
+    {
+        // Changes made during the walk are picked up by the next run.
+        next_cursor = JournalEnd(stub, options);
+        if (!Walk(stub, options, previous, &manifest, &tasks, &error))
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+    }
+
+    BackupStats stats;
+    uint64_t number;
+    if (!ExportAll(stub, archive, options, tasks, &manifest, &stats, &error) || !archive.Sync(&error) ||
+        !archive.WriteSnapshot(manifest, next_cursor, &number, &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << "Snapshot " << number << " (" << (incremental ? "incremental, " : "full walk, ") << changed.size()
+              << " journaled changes): " << manifest.size() << " files, " << stats.exported << " exported, "
+              << stats.vanished << " vanished; read " << stats.read_bytes / (1 << 20) << " MiB, stored "
+              << archive.added_bytes() / (1 << 20) << " MiB new in " << seconds << " s" << std::endl;
+    return 0;
+}
+
+static int List(Archive &archive)
+{
+    std::string error;
+    for (uint64_t number : archive.Snapshots())
+    {
+        Archive::Manifest manifest;
+        uint64_t cursor;
+        if (!archive.ReadSnapshot(number, &manifest, &cursor, &error))
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        int64_t bytes = 0;
+        for (const auto &entry : manifest)
+            bytes += entry.second.size;
+        std::cout << number << "\t" << manifest.size() << " files\t" << bytes << " bytes" << std::endl;
+    }
+    return 0;
+}
+
+// Creates the directories leading to `path` under `root`.
+static bool MakeParents(const std::string &root, const std::string &path)
+{
+    for (size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1))
+    {
+        std::string dir = root + "/" + path.substr(0, slash);
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+    }
+    return true;
+}
+
+static int Restore(Archive &archive, const std::string &dest, uint64_t number)
+{
+    std::string error;
+    std::vector<uint64_t> snapshots = archive.Snapshots();
+    if (number == 0 && !snapshots.empty())
+        number = snapshots.back();
+    Archive::Manifest manifest;
+    uint64_t cursor;
+    if (!archive.ReadSnapshot(number, &manifest, &cursor, &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    if (mkdir(dest.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        std::cerr << "cannot create " << dest << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    for (const auto &entry : manifest)
+    {
+        const std::string &path = entry.first;
+        // Server paths are normalized; anything else is not ours to write.
+        if (path.empty() || path[0] == '/' || ("/" + path + "/").find("/../") != std::string::npos)
+        {
+            std::cerr << "skipping unsafe path " << path << std::endl;
+            continue;
+        }
+        std::string target = dest + "/" + path;
+        int fd = MakeParents(dest, path) ? open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+        if (fd < 0)
+        {
+            std::cerr << "cannot create " << target << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+        std::string data;
+        bool ok = true;
+        for (const std::string &digest : entry.second.chunks)
+        {
+            ok = archive.GetChunk(digest, &data, &error) && write(fd, data.data(), data.size()) == (ssize_t)data.size();
+            if (!ok)
+                break;
+        }
+        struct timespec times[2] = {{entry.second.mtime, 0}, {entry.second.mtime, 0}};
+        futimens(fd, times);
+        close(fd);
+        if (!ok)
+        {
+            std::cerr << "cannot restore " << path << ": " << (error.empty() ? strerror(errno) : error) << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "Restored snapshot " << number << ": " << manifest.size() << " files" << std::endl;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    dfs::Config config;
+    std::vector<char *> args;
+    std::string error;
+    if (!config.ParseCommandLine(argc, argv, &args, &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    std::string command = args.size() > 1 ? args[1] : "";
+    if (!((command == "backup" || command == "list") && args.size() == 3) && !(command == "restore" && args.size() == 4))
+    {
+        std::cerr << "Usage: " << argv[0] << " backup ARCHIVE | list ARCHIVE | restore ARCHIVE DEST [--key=value ...]"
+                  << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<Archive> archive = Archive::Open(args[2], config.GetInt("backup.compression_level", 6), &error);
+    if (!archive)
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    if (command == "list")
+        return List(*archive);
+    if (command == "restore")
+        return Restore(*archive, args[3], config.GetInt("backup.snapshot", 0));
+
+    BackupOptions options;
+    options.timeout_ms = config.GetInt("client.rpc_timeout_ms", 0);
+    options.read_bytes = std::max<int64_t>(config.GetInt("backup.read_bytes", options.read_bytes), 4096);
+    options.chunk_bytes = config.GetInt("backup.chunk_bytes", options.chunk_bytes);
+    options.parallelism = std::max<int64_t>(config.GetInt("backup.parallelism", options.parallelism), 1);
+    std::string target = dfs::ResolveClientTarget(config, config.GetString("client.server_address", "localhost:50051"));
+    auto stub = dfs::DFS::NewStub(dfs::CreateDfsChannel(target, dfs::LoadTransportOptions(config)));
+    return Backup(stub.get(), *archive, options, config.GetBool("backup.full", false));
+}
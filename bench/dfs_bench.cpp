@@ -0,0 +1,404 @@
+// Read-throughput benchmark for the gRPC transport settings.
+//
+// Runs an in-memory DFS Read service on loopback behind a TCP proxy that
+// delays every chunk by RTT/2 in each direction, so high-BDP links can be
+// emulated without `tc netem` or root. Each RTT is measured twice: once with
+// gRPC's stock channel settings and once with the transport options loaded
+// from $DFS_CONFIG (see config/dfs.conf).
+//
+//   ./build/dfs_bench --rtt_ms=0,10,50,100 --total_mb=256 --chunk_kb=1024
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+#include "../build/dfs.grpc.pb.h"
+#include "../common/transport.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Serves Read from a fixed in-memory pattern; measures transport only.
+class BenchService final : public dfs::DFS::Service
+{
+public:
+    grpc::Status Read(grpc::ServerContext *context, const dfs::ReadRequest *request, dfs::ReadResponse *response) override
+    {
+        int64_t size = request->size();
+        if (size < 0 || size > (int64_t)payload_.size())
+            return grpc::Status(grpc::INVALID_ARGUMENT, "size out of range");
+        response->set_data(payload_.data(), size);
+        response->set_bytes_read(size);
+        return grpc::Status::OK;
+    }
+
+    void Reserve(size_t size) { payload_.assign(size, 'x'); }
+
+private:
+    std::string payload_;
+};
+
+// One direction of a proxied connection: everything read from `in` is
+// written to `out` no earlier than `delay` after it arrived.
+class DelayedPipe
+{
+public:
+    DelayedPipe(int in, int out, std::chrono::microseconds delay)
+        : in_(in), out_(out), delay_(delay)
+    {
+        reader_ = std::thread([this] { ReadLoop(); });
+        writer_ = std::thread([this] { WriteLoop(); });
+    }
+
+    ~DelayedPipe()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            stopped_ = true;
+        }
+        cv_.notify_all();
+        shutdown(in_, SHUT_RDWR);
+        shutdown(out_, SHUT_RDWR);
+        reader_.join();
+        writer_.join();
+    }
+
+private:
+    struct Chunk
+    {
+        Clock::time_point due;
+        std::string data;
+    };
+
+    void ReadLoop()
+    {
+        char buf[64 * 1024];
+        for (;;)
+        {
+            ssize_t n = read(in_, buf, sizeof(buf));
+            std::lock_guard<std::mutex> lock(mu_);
+            if (n <= 0)
+            {
+                eof_ = true;
+                cv_.notify_all();
+                return;
+            }
+            queue_.push_back({Clock::now() + delay_, std::string(buf, n)});
+            cv_.notify_all();
+        }
+    }
+
+    void WriteLoop()
+    {
+        std::unique_lock<std::mutex> lock(mu_);
+        for (;;)
+        {
+            cv_.wait(lock, [this] { return stopped_ || eof_ || !queue_.empty(); });
+            if (stopped_ || (queue_.empty() && eof_))
+            {
+                shutdown(out_, SHUT_WR);
+                return;
+            }
+            Clock::time_point due = queue_.front().due;
+            if (Clock::now() < due)
+            {
+                cv_.wait_until(lock, due);
+                continue;
+            }
+            std::string data = std::move(queue_.front().data);
+            queue_.pop_front();
+
+            lock.unlock();
+            size_t sent = 0;
+            while (sent < data.size())
+            {
+                ssize_t n = write(out_, data.data() + sent, data.size() - sent);
+                if (n <= 0)
+                    break;
+                sent += n;
+            }
+            lock.lock();
+        }
+    }
+
+    int in_;
+    int out_;
+    std::chrono::microseconds delay_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Chunk> queue_;
+    bool eof_ = false;
+    bool stopped_ = false;
+    std::thread reader_;
+    std::thread writer_;
+};
+
+static int ListenLoopback(int *port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr *)&addr, &len);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static int ConnectLoopback(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// Loopback TCP proxy adding `rtt / 2` of latency in each direction.
+class DelayProxy
+{
+public:
+    DelayProxy(int upstream_port, std::chrono::microseconds rtt)
+        : upstream_port_(upstream_port), one_way_(rtt / 2)
+    {
+        listen_fd_ = ListenLoopback(&port_);
+        acceptor_ = std::thread([this] { AcceptLoop(); });
+    }
+
+    ~DelayProxy()
+    {
+        stopped_ = true;
+        shutdown(listen_fd_, SHUT_RDWR);
+        acceptor_.join();
+        close(listen_fd_);
+
+        std::lock_guard<std::mutex> lock(mu_);
+        pipes_.clear();
+        for (int fd : fds_)
+            close(fd);
+    }
+
+    int port() const { return port_; }
+
+private:
+    void AcceptLoop()
+    {
+        while (!stopped_)
+        {
+            int client = accept(listen_fd_, nullptr, nullptr);
+            if (client < 0)
+                return;
+            int one = 1;
+            setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            int server = ConnectLoopback(upstream_port_);
+            if (server < 0)
+            {
+                close(client);
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(mu_);
+            fds_.push_back(client);
+            fds_.push_back(server);
+            pipes_.emplace_back(new DelayedPipe(client, server, one_way_));
+            pipes_.emplace_back(new DelayedPipe(server, client, one_way_));
+        }
+    }
+
+    int upstream_port_;
+    std::chrono::microseconds one_way_;
+    int listen_fd_ = -1;
+    int port_ = 0;
+    std::atomic<bool> stopped_{false};
+    std::thread acceptor_;
+    std::mutex mu_;
+    std::vector<int> fds_;
+    std::vector<std::unique_ptr<DelayedPipe>> pipes_;
+};
+
+struct BenchResult
+{
+    double mib_per_sec = 0;
+    std::string error;
+};
+
+static BenchResult RunReads(std::shared_ptr<grpc::Channel> channel, int64_t total_bytes, int64_t chunk, int inflight)
+{
+    std::unique_ptr<dfs::DFS::Stub> stub = dfs::DFS::NewStub(channel);
+    std::atomic<int64_t> remaining(total_bytes);
+    std::mutex error_mu;
+    std::string error;
+
+    // Warm the connection so the handshake is not counted.
+    {
+        dfs::ReadRequest request;
+        request.set_size(1);
+        dfs::ReadResponse response;
+        grpc::ClientContext context;
+        grpc::Status status = stub->Read(&context, request, &response);
+        if (!status.ok())
+            return {0, status.error_message()};
+    }
+
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < inflight; i++)
+    {
+        workers.emplace_back([&] {
+            while (remaining.fetch_sub(chunk) > 0)
+            {
+                dfs::ReadRequest request;
+                request.set_path("bench");
+                request.set_size(chunk);
+                dfs::ReadResponse response;
+                grpc::ClientContext context;
+                grpc::Status status = stub->Read(&context, request, &response);
+                if (!status.ok())
+                {
+                    std::lock_guard<std::mutex> lock(error_mu);
+                    error = status.error_message();
+                    remaining = 0;
+                    return;
+                }
+            }
+        });
+    }
+    for (auto &t : workers)
+        t.join();
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (!error.empty())
+        return {0, error};
+    return {total_bytes / seconds / (1 << 20), ""};
+}
+
+static std::vector<int> ParseIntList(const std::string &text)
+{
+    std::vector<int> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        values.push_back(std::stoi(item));
+    return values;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<int> rtts_ms = {0, 10, 50, 100};
+    int64_t total_mb = 256;
+    int64_t chunk_kb = 1024;
+    int inflight = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (name == "--rtt_ms")
+            rtts_ms = ParseIntList(value);
+        else if (name == "--total_mb")
+            total_mb = std::stoll(value);
+        else if (name == "--chunk_kb")
+            chunk_kb = std::stoll(value);
+        else if (name == "--inflight")
+            inflight = std::stoi(value);
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--rtt_ms=0,10,50] [--total_mb=N] [--chunk_kb=N] [--inflight=N]\n";
+            return 1;
+        }
+    }
+
+    dfs::Config config;
+    std::string error;
+    if (!config.LoadFromEnvironment(&error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    dfs::TransportOptions tuned = dfs::LoadTransportOptions(config);
+
+    int64_t chunk = chunk_kb << 10;
+    BenchService service;
+    service.Reserve(chunk);
+
+    // The server side always uses the tuned options so that only the
+    // client's receive window and message cap differ between runs.
+    int server_port = 0;
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &server_port);
+    dfs::ApplyServerTransport(builder, tuned);
+    builder.RegisterService(&service);
+    std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+    if (!server)
+    {
+        std::cerr << "failed to start bench server" << std::endl;
+        return 1;
+    }
+
+    std::cout << "total=" << total_mb << "MiB chunk=" << chunk_kb << "KiB inflight=" << inflight
+              << " config=" << (config.source().empty() ? "(none)" : config.source()) << "\n\n";
+    std::cout << std::left << std::setw(10) << "rtt_ms" << std::setw(12) << "profile" << "MiB/s\n";
+
+    for (int rtt : rtts_ms)
+    {
+        DelayProxy proxy(server_port, std::chrono::milliseconds(rtt));
+        std::string target = "127.0.0.1:" + std::to_string(proxy.port());
+
+        struct Profile
+        {
+            const char *name;
+            std::shared_ptr<grpc::Channel> channel;
+        };
+        grpc::ChannelArguments stock;
+        stock.SetInt("dfs.bench.profile", 0); // keep the two runs on separate connections
+        Profile profiles[] = {
+            {"defaults", grpc::CreateCustomChannel(target, grpc::InsecureChannelCredentials(), stock)},
+            {"tuned", dfs::CreateDfsChannel(target, tuned)},
+        };
+
+        for (Profile &p : profiles)
+        {
+            BenchResult r = RunReads(p.channel, total_mb << 20, chunk, inflight);
+            std::cout << std::left << std::setw(10) << rtt << std::setw(12) << p.name;
+            if (r.error.empty())
+                std::cout << std::fixed << std::setprecision(1) << r.mib_per_sec << "\n";
+            else
+                std::cout << "error: " << r.error << "\n";
+        }
+    }
+
+    server->Shutdown();
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include "access_predictor.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+AccessPredictor::Node &AccessPredictor::Touch(const std::string &path)
+{
+    auto it = nodes_.find(path);
+    if (it != nodes_.end())
+    {
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+        return it->second;
+    }
+    while (!lru_.empty() && nodes_.size() >= max_files_)
+    {
+        nodes_.erase(lru_.back());
+        lru_.pop_back();
+    }
+    lru_.push_front(path);
+    Node &node = nodes_[path];
+    node.lru = lru_.begin();
+    return node;
+}
+
+void AccessPredictor::Count(const std::string &from, const std::string &to, uint32_t count)
+{
+    std::vector<Successor> &next = Touch(from).next;
+    size_t i = 0;
+    while (i < next.size() && next[i].path != to)
+        i++;
+    if (i < next.size())
+        next[i].count += count;
+    else if (next.size() < kMaxSuccessors)
+        next.push_back({to, count});
+    else
+        next[--i] = {to, count}; // replaces the least frequent
+    // Restore the order by moving the updated entry forward.
+    while (i > 0 && next[i - 1].count < next[i].count)
+    {
+        std::swap(next[i - 1], next[i]);
+        i--;
+    }
+}
+
+const std::string *AccessPredictor::Predict(const std::string &path) const
+{
+    auto it = nodes_.find(path);
+    if (it == nodes_.end() || it->second.next.empty())
+        return nullptr;
+    const std::vector<Successor> &next = it->second.next;
+    uint64_t total = 0;
+    for (const Successor &successor : next)
+        total += successor.count;
+    const Successor &best = next.front();
+    if (best.count < min_count_ || best.count * 2 <= total)
+        return nullptr;
+    return &best.path;
+}
+
+std::vector<std::string> AccessPredictor::Record(uint64_t stream, const std::string &path, size_t depth)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto last = last_open_.find(stream);
+    if (last != last_open_.end())
+    {
+        if (last->second == path)
+            return {}; // reopened, nothing new
+        Count(last->second, path, 1);
+        last->second = path;
+    }
+    else
+    {
+        if (last_open_.size() >= kMaxStreams)
+            last_open_.clear(); // exited processes are never seen again
+        last_open_[stream] = path;
+        Touch(path);
+    }
+
+    std::vector<std::string> predicted;
+    const std::string *current = &path;
+    for (size_t i = 0; i < depth; i++)
+    {
+        current = Predict(*current);
+        if (current == nullptr || *current == path)
+            break;
+        if (recent_set_.count(*current))
+            continue;
+        predicted.push_back(*current);
+        recent_.push_back(*current);
+        recent_set_.insert(*current);
+        if (recent_.size() > kRecentPredictions)
+        {
+            recent_set_.erase(recent_.front());
+            recent_.pop_front();
+        }
+    }
+    // The file being opened needs no prefetch from now on either.
+    recent_set_.erase(path);
+    return predicted;
+}
+
+bool AccessPredictor::Load(const std::string &file, std::string *error)
+{
+    std::ifstream in(file);
+    if (!in)
+    {
+        if (errno == ENOENT)
+            return true; // first mount
+        *error = "cannot read " + file + ": " + strerror(errno);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        size_t first = line.find('\t');
+        size_t second = first == std::string::npos ? first : line.find('\t', first + 1);
+        if (second == std::string::npos)
+            continue;
+        uint32_t count = strtoul(line.c_str(), nullptr, 10);
+        if (count > 0)
+            Count(line.substr(first + 1, second - first - 1), line.substr(second + 1), count);
+    }
+    return true;
+}
+
+bool AccessPredictor::Save(const std::string &file, std::string *error)
+{
+    std::ostringstream out;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Least recently opened first, so reloading keeps the LRU order.
+        for (auto it = lru_.rbegin(); it != lru_.rend(); ++it)
+        {
+            if (it->find_first_of("\t\n") != std::string::npos)
+                continue;
+            for (const Successor &successor : nodes_[*it].next)
+            {
+                if (successor.path.find_first_of("\t\n") == std::string::npos)
+                    out << successor.count << '\t' << *it << '\t' << successor.path << '\n';
+            }
+        }
+    }
+
+    std::string temp = file + ".tmp";
+    std::ofstream stream(temp, std::ios::trunc);
+    stream << out.str();
+    stream.close();
+    if (!stream || rename(temp.c_str(), file.c_str()) < 0)
+    {
+        *error = "cannot write " + file + ": " + strerror(errno);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Learns which file tends to be opened after which (a first-order Markov
+// chain over opens) so the client can ask the server to warm the next
+// files of a recorded sequence, e.g. an epoch of a training job re-reading
+// its shards in the same order.
+//
+// Opens are chained per stream (the calling process), so interleaved
+// readers do not pollute each other's sequences. Each file keeps its
+// kMaxSuccessors most frequent successors; a prediction is only made when
+// one successor has been seen at least `min_count` times and accounts for
+// most of the transitions, so randomly shuffled reads predict nothing. At
+// most `max_files` files are remembered, least recently opened dropped.
+class AccessPredictor
+{
+public:
+    AccessPredictor(size_t max_files, int min_count) : max_files_(max_files), min_count_(min_count) {}
+
+    // Records that `stream` opened `path` and returns up to `depth` files
+    // expected next, in order, leaving out those returned recently.
+    std::vector<std::string> Record(uint64_t stream, const std::string &path, size_t depth);
+
+    // The model as "count<TAB>from<TAB>to" lines, so it survives remounts.
+    bool Load(const std::string &file, std::string *error);
+    bool Save(const std::string &file, std::string *error);
+
+private:
+    static const size_t kMaxSuccessors = 4;
+    static const size_t kMaxStreams = 4096;
+    static const size_t kRecentPredictions = 256;
+
+    struct Successor
+    {
+        std::string path;
+        uint32_t count;
+    };
+    struct Node
+    {
+        std::vector<Successor> next; // most frequent first
+        std::list<std::string>::iterator lru;
+    };
+
+    // Require mutex_ held.
+    Node &Touch(const std::string &path);
+    void Count(const std::string &from, const std::string &to, uint32_t count);
+    const std::string *Predict(const std::string &path) const;
+
+    size_t max_files_;
+    uint32_t min_count_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, Node> nodes_;
+    std::list<std::string> lru_; // front = most recently opened
+    std::unordered_map<uint64_t, std::string> last_open_;
+    std::deque<std::string> recent_;
+    std::unordered_set<std::string> recent_set_;
+};
@@ -0,0 +1,185 @@
+#include "channel_pool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+
+#include "../common/transport.h"
+
+ChannelPool::ChannelPool(const std::vector<std::shared_ptr<grpc::Channel>> &channels)
+{
+    for (const auto &channel : channels)
+        stubs_.push_back(dfs::DFS::NewStub(channel));
+}
+
+dfs::DFS::Stub *ChannelPool::Next()
+{
+    return stubs_[next_++ % stubs_.size()].get();
+}
+
+void LatencyTracker::Record(std::chrono::microseconds latency)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (samples_.size() < kWindow)
+        samples_.push_back(latency.count());
+    else
+        samples_[next_++ % kWindow] = latency.count();
+    since_recompute_++;
+}
+
+std::chrono::microseconds LatencyTracker::Percentile(double percentile)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (samples_.size() < kRecompute)
+        return std::chrono::microseconds(-1);
+    if (since_recompute_ >= kRecompute || percentile != percentile_)
+    {
+        std::vector<int64_t> sorted = samples_;
+        size_t rank = std::min(sorted.size() - 1, (size_t)(percentile / 100 * sorted.size()));
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        cached_ = sorted[rank];
+        percentile_ = percentile;
+        since_recompute_ = 0;
+    }
+    return std::chrono::microseconds(cached_);
+}
+
+namespace
+{
+
+struct Chunk
+{
+    grpc::ClientContext context;
+    dfs::ReadRequest request;
+    dfs::ReadResponse response;
+    grpc::Status status;
+    ShmRing::Slot slot;
+    bool shm = false;
+};
+
+} // namespace
+
+ssize_t ReadRanges(ChannelPool &pool, const dfs::ReadRequest &base, char *buf, size_t size, off_t offset,
+                   size_t chunk_bytes, int64_t timeout_ms, ShmRing *shm)
+{
+    size_t count = (size + chunk_bytes - 1) / chunk_bytes;
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t remaining = count;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        chunks.emplace_back(new Chunk);
+        Chunk *chunk = chunks.back().get();
+        size_t length = std::min(chunk_bytes, size - i * chunk_bytes);
+        chunk->request = base;
+        chunk->request.set_offset(offset + i * chunk_bytes);
+        chunk->request.set_size(length);
+        chunk->shm = shm && shm->Acquire(length, &chunk->slot, false);
+        if (chunk->shm)
+        {
+            chunk->request.set_shm_channel(shm->channel());
+            chunk->request.set_shm_offset(chunk->slot.offset);
+        }
+        dfs::SetRpcDeadline(chunk->context, timeout_ms);
+        pool.Next()->async()->Read(&chunk->context, &chunk->request, &chunk->response,
+                                   [chunk, &mutex, &done, &remaining](grpc::Status status) {
+                                       chunk->status = std::move(status);
+                                       std::lock_guard<std::mutex> lock(mutex);
+                                       if (--remaining == 0)
+                                           done.notify_one();
+                                   });
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&remaining] { return remaining == 0; });
+
+    ssize_t total = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        Chunk &chunk = *chunks[i];
+        int64_t n = chunk.response.bytes_read();
+        if (total >= 0 && (!chunk.status.ok() || n < 0 || n > chunk.request.size() ||
+                           (!chunk.shm && (size_t)n != chunk.response.data().size())))
+            total = -EIO;
+        if (total >= 0 && total == (ssize_t)(i * chunk_bytes))
+        {
+            memcpy(buf + total, chunk.shm ? chunk.slot.data : chunk.response.data().data(), n);
+            total += n; // a short chunk ends the file; later ones stay out
+        }
+        if (chunk.shm)
+            shm->Release(chunk.slot);
+    }
+    return total;
+}
+
+ssize_t HedgedRead(ChannelPool &pool, const dfs::ReadRequest &request, char *buf, int64_t timeout_ms,
+                   std::chrono::microseconds hedge_delay, LatencyTracker *latency)
+{
+    using Clock = std::chrono::steady_clock;
+    struct Attempt
+    {
+        grpc::ClientContext context;
+        dfs::ReadResponse response;
+        grpc::Status status;
+        Clock::time_point sent;
+        bool done = false;
+    };
+    Attempt attempts[2];
+    std::mutex mutex;
+    std::condition_variable changed;
+    int started = 0;
+    int finished = 0;
+    int winner = -1;
+    size_t first = pool.NextIndex();
+
+    // Requires `mutex` held; drops it while issuing the call.
+    auto send = [&](std::unique_lock<std::mutex> &lock) {
+        int i = started++;
+        Attempt &attempt = attempts[i];
+        attempt.sent = Clock::now();
+        dfs::SetRpcDeadline(attempt.context, timeout_ms);
+        lock.unlock();
+        pool.at(first + i)->async()->Read(&attempt.context, &request, &attempt.response,
+                                          [&, i](grpc::Status status) {
+                                              std::lock_guard<std::mutex> guard(mutex);
+                                              attempts[i].status = std::move(status);
+                                              attempts[i].done = true;
+                                              finished++;
+                                              if (winner < 0 && attempts[i].status.ok())
+                                                  winner = i;
+                                              changed.notify_all();
+                                          });
+        lock.lock();
+    };
+
+    std::unique_lock<std::mutex> lock(mutex);
+    send(lock);
+    if (hedge_delay.count() > 0 && pool.size() > 1 &&
+        !changed.wait_for(lock, hedge_delay, [&] { return finished > 0; }))
+        send(lock);
+    // A failed first reply still waits for the hedge, if there is one.
+    changed.wait(lock, [&] { return winner >= 0 || finished == started; });
+    lock.unlock();
+    for (int i = 0; i < started; i++)
+    {
+        if (i != winner)
+            attempts[i].context.TryCancel();
+    }
+    lock.lock();
+    changed.wait(lock, [&] { return finished == started; });
+
+    if (winner < 0)
+        return -EIO;
+    const Attempt &attempt = attempts[winner];
+    int64_t n = attempt.response.bytes_read();
+    if (n < 0 || n > request.size() || (size_t)n != attempt.response.data().size())
+        return -EIO;
+    if (latency)
+        latency->Record(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - attempt.sent));
+    memcpy(buf, attempt.response.data().data(), n);
+    return n;
+}
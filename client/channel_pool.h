@@ -0,0 +1,72 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+#include "../build/dfs.grpc.pb.h"
+#include "shm_ring.h"
+
+// Stubs over several independent connections to the same server, handed
+// out round-robin so concurrent calls do not queue behind one connection's
+// flow-control window.
+class ChannelPool
+{
+public:
+    explicit ChannelPool(const std::vector<std::shared_ptr<grpc::Channel>> &channels);
+
+    size_t size() const { return stubs_.size(); }
+    dfs::DFS::Stub *Next();
+    // Round-robin position, for callers that want a stub and then a
+    // different one: at(index), at(index + 1).
+    size_t NextIndex() { return next_++; }
+    dfs::DFS::Stub *at(size_t index) { return stubs_[index % stubs_.size()].get(); }
+
+private:
+    std::vector<std::unique_ptr<dfs::DFS::Stub>> stubs_;
+    std::atomic<size_t> next_{0};
+};
+
+// Recent read latencies, for choosing when a read is late enough to hedge.
+// The percentile is recomputed every kRecompute samples, not per read.
+class LatencyTracker
+{
+public:
+    void Record(std::chrono::microseconds latency);
+    // The `percentile` (0-100) of the last kWindow samples, or -1 until
+    // kRecompute samples are in.
+    std::chrono::microseconds Percentile(double percentile);
+
+private:
+    static const size_t kWindow = 1024;
+    static const size_t kRecompute = 64;
+
+    std::mutex mutex_;
+    std::vector<int64_t> samples_; // ring of kWindow
+    size_t next_ = 0;
+    size_t since_recompute_ = 0;
+    double percentile_ = -1;
+    int64_t cached_ = -1;
+};
+
+// Reads [offset, offset + size) as chunks of at most `chunk_bytes`, all in
+// flight at once across the pool, each copied into place in `buf`.
+// `base` supplies the path and handle. A chunk goes through `shm` when one
+// of its slots is free right away. Returns the bytes read, short only at
+// end of file, or -EIO if any chunk failed.
+ssize_t ReadRanges(ChannelPool &pool, const dfs::ReadRequest &base, char *buf, size_t size, off_t offset,
+                   size_t chunk_bytes, int64_t timeout_ms, ShmRing *shm);
+
+// One read that is sent again on the next channel if no reply came within
+// `hedge_delay` (0 = never): the first successful reply is used and the
+// other call cancelled. Reads are idempotent, so either is as good. Replies
+// come inline, not through shared memory, since a cancelled call may still
+// be filling its slot. Records the winner's latency in `latency`. Returns
+// the bytes read into `buf` or -EIO.
+ssize_t HedgedRead(ChannelPool &pool, const dfs::ReadRequest &request, char *buf, int64_t timeout_ms,
+                   std::chrono::microseconds hedge_delay, LatencyTracker *latency);
@@ -1,10 +1,22 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <grpcpp/grpcpp.h>
 #include "../build/dfs.grpc.pb.h"
+#include "../common/transport.h"
+#include "channel_pool.h"
+#include "uploader.h"
 
 using grpc::Channel;
 using grpc::ClientContext;
@@ -16,8 +28,8 @@ using dfs::ReadResponse;
 
 class DFSClient {
 public:
-    DFSClient(std::shared_ptr<Channel> channel)
-        : stub_(DFS::NewStub(channel)) {}
+    DFSClient(std::shared_ptr<Channel> channel, int64_t timeout_ms = 0)
+        : stub_(DFS::NewStub(channel)), timeout_ms_(timeout_ms) {}
 
     void ReadFile(const std::string& path, int64_t offset, int64_t size) {
         ReadRequest request;
@@ -27,6 +39,7 @@ public:
 
         ReadResponse response;
         ClientContext context;
+        dfs::SetRpcDeadline(context, timeout_ms_);
 
         Status status = stub_->Read(&context, request, &response);
 
@@ -48,6 +61,7 @@ public:
     
         dfs::WriteResponse response;
         grpc::ClientContext context;
+        dfs::SetRpcDeadline(context, timeout_ms_);
     
         grpc::Status status = stub_->Write(&context, request, &response);
     
@@ -63,6 +77,7 @@ public:
         request.set_path(path);
         dfs::UnlinkResponse response;
         grpc::ClientContext context;
+        dfs::SetRpcDeadline(context, timeout_ms_);
     
         auto status = stub_->Unlink(&context, request, &response);
         if (status.ok() && response.success()) {
@@ -77,6 +92,7 @@ public:
         request.set_path(path);
         dfs::GetAttrResponse response;
         grpc::ClientContext context;
+        dfs::SetRpcDeadline(context, timeout_ms_);
     
         auto status = stub_->GetAttr(&context, request, &response);
         if (status.ok() && response.exists()) {
@@ -89,13 +105,115 @@ public:
 
 private:
     std::unique_ptr<DFS::Stub> stub_;
+    int64_t timeout_ms_;
 };
 
 int main(int argc, char** argv) {
-    std::string target_str = "localhost:50051";
-    DFSClient client(grpc::CreateChannel(target_str, grpc::InsecureChannelCredentials()));
+    dfs::Config config;
+    std::vector<char*> args;
+    std::string error;
+    if (!config.ParseCommandLine(argc, argv, &args, &error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    std::string target_str = config.GetString("client.server_address", "localhost:50051");
+    target_str = dfs::ResolveClientTarget(config, target_str);
+
+    // put <local file> <remote path>: multi-part upload over several connections.
+    if (args.size() == 4 && std::string(args[1]) == "put") {
+        int fd = open(args[2], O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            std::cerr << "Cannot open " << args[2] << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+        ChannelPool pool(dfs::CreateDfsChannels(target_str, dfs::LoadTransportOptions(config),
+                                                config.GetInt("client.channels", 4)));
+        UploadOptions options;
+        options.part_bytes = config.GetInt("client.upload_part_bytes", options.part_bytes);
+        options.parallelism = config.GetInt("client.upload_parallelism", options.parallelism);
+        options.timeout_ms = config.GetInt("client.rpc_timeout_ms", 0);
+        options.retry.max_attempts = std::max<int64_t>(config.GetInt("client.write_attempts", 5), 1);
+        options.retry.initial_backoff_ms = config.GetInt("client.retry_backoff_ms", 50);
+        options.retry.max_backoff_ms = config.GetInt("client.retry_max_backoff_ms", 2000);
+
+        auto start = std::chrono::steady_clock::now();
+        bool ok = UploadFile(pool, fd, st.st_size, args[3], options, &error);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        close(fd);
+        if (!ok) {
+            std::cerr << "Upload failed: " << error << std::endl;
+            return 1;
+        }
+        std::cout << "Uploaded " << st.st_size << " bytes in " << seconds << " s ("
+                  << st.st_size / std::max(seconds, 1e-9) / (1 << 20) << " MiB/s)" << std::endl;
+        return 0;
+    }
+
+    // rm PATH... | stat PATH... | mkdir [-p] PATH...: all paths in one Batch
+    // call, with a result line per path.
+    std::string command = args.size() > 1 ? args[1] : "";
+    if (args.size() > 2 && (command == "rm" || command == "stat" || command == "mkdir")) {
+        bool parents = command == "mkdir" && std::string(args[2]) == "-p";
+        dfs::BatchRequest request;
+        for (size_t i = parents ? 3 : 2; i < args.size(); i++) {
+            dfs::BatchOperation* op = request.add_operations();
+            if (command == "rm") {
+                op->mutable_unlink()->set_path(args[i]);
+            } else if (command == "stat") {
+                op->mutable_get_attr()->set_path(args[i]);
+            } else {
+                op->mutable_mkdir()->set_path(args[i]);
+                op->mutable_mkdir()->set_parents(parents);
+            }
+        }
+        auto stub = DFS::NewStub(dfs::CreateDfsChannel(target_str, dfs::LoadTransportOptions(config)));
+        dfs::BatchResponse response;
+        grpc::ClientContext context;
+        dfs::SetRpcDeadline(context, config.GetInt("client.rpc_timeout_ms", 0));
+        grpc::Status status = stub->Batch(&context, request, &response);
+        if (!status.ok()) {
+            std::cerr << "Batch failed: " << status.error_message() << std::endl;
+            return 1;
+        }
+        int failures = 0;
+        for (int i = 0; i < response.results_size(); i++) {
+            const dfs::BatchResult& result = response.results(i);
+            const dfs::BatchOperation& op = request.operations(i);
+            const std::string& path = op.has_unlink() ? op.unlink().path()
+                                      : op.has_get_attr() ? op.get_attr().path() : op.mkdir().path();
+            if (result.code() != grpc::OK) {
+                std::cerr << command << " " << path << ": " << result.error() << std::endl;
+                failures++;
+            } else if (command == "stat") {
+                std::cout << path << ": size " << result.attr().size() << ", modified " << result.attr().mtime()
+                          << ", version " << result.attr().version() << std::endl;
+            }
+        }
+        return failures > 0 ? 1 : 0;
+    }
+
+    // watch [prefix]: prints changes as "PATH EVENT" lines, like inotifywait -m.
+    if ((args.size() == 2 || args.size() == 3) && std::string(args[1]) == "watch") {
+        auto stub = DFS::NewStub(dfs::CreateDfsChannel(target_str, dfs::LoadTransportOptions(config)));
+        dfs::WatchRequest request;
+        if (args.size() == 3) request.set_prefix(args[2]);
+        grpc::ClientContext context;
+        auto reader = stub->Watch(&context, request);
+        dfs::WatchEvent event;
+        while (reader->Read(&event)) {
+            std::cout << "/" << event.path() << " " << dfs::WatchEvent::Type_Name(event.type()) << std::endl;
+        }
+        grpc::Status status = reader->Finish();
+        std::cerr << "Watch ended: " << status.error_message() << std::endl;
+        return 1;
+    }
+
+    DFSClient client(dfs::CreateDfsChannel(target_str, dfs::LoadTransportOptions(config)),
+                     config.GetInt("client.rpc_timeout_ms", 0));
 
-    std::string file = argc > 1 ? argv[1] : "test.txt";
+    std::string file = args.size() > 1 ? args[1] : "test.txt";
     client.ReadFile(file, 0, 1024);  // Read first 1KB of the file
 
     client.WriteFile("test.txt", "Modified content\n");
@@ -0,0 +1,418 @@
+#include "disk_cache.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <set>
+
+static const char kIndexName[] = "/index.log";
+static const char kIndexTmpName[] = "/index.log.tmp";
+
+// Journal record: 'V' new cached incarnation of a file (id, version),
+// 'B' block present (block, checksum, length), 'D' file dropped.
+struct CacheRecordHeader
+{
+    char type;
+    uint64_t id;
+    int64_t version;
+    uint64_t block;
+    uint64_t checksum;
+    uint32_t length;
+    uint32_t path_len;
+} __attribute__((packed));
+
+static uint64_t Fnv1a(const char *data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static ssize_t PreadAll(int fd, char *buf, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = pread(fd, buf + done, size - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n < 0 ? -errno : done;
+        done += n;
+    }
+    return done;
+}
+
+std::unique_ptr<DiskCache> DiskCache::Open(const std::string &dir, uint64_t capacity_bytes, uint64_t block_bytes,
+                                           std::string *error)
+{
+    if (block_bytes == 0)
+    {
+        *error = "client.cache_block_bytes must be positive";
+        return nullptr;
+    }
+    if ((mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) ||
+        (mkdir((dir + "/data").c_str(), 0700) != 0 && errno != EEXIST))
+    {
+        *error = "cannot create cache directory " + dir + ": " + strerror(errno);
+        return nullptr;
+    }
+
+    std::unique_ptr<DiskCache> cache(new DiskCache(dir, capacity_bytes, block_bytes));
+    if (!cache->Replay(error))
+        return nullptr;
+    if (!cache->Compact())
+    {
+        *error = "cannot rewrite cache index in " + dir + ": " + strerror(errno);
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(cache->mutex_);
+    cache->EvictToFit();
+    return cache;
+}
+
+DiskCache::~DiskCache()
+{
+    if (index_fd_ >= 0)
+        close(index_fd_);
+}
+
+std::string DiskCache::DataPath(uint64_t id) const
+{
+    return dir_ + "/data/" + std::to_string(id);
+}
+
+bool DiskCache::Replay(std::string *error)
+{
+    std::string index = dir_ + kIndexName;
+    int fd = open(index.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 && errno != ENOENT)
+    {
+        *error = "cannot read " + index + ": " + strerror(errno);
+        return false;
+    }
+
+    off_t offset = 0;
+    while (fd >= 0)
+    {
+        // A short or unknown record is a torn tail; Compact() drops it.
+        CacheRecordHeader header;
+        if (PreadAll(fd, (char *)&header, sizeof(header), offset) != sizeof(header))
+            break;
+        std::string path(header.path_len, '\0');
+        if (PreadAll(fd, &path[0], path.size(), offset + sizeof(header)) != (ssize_t)path.size())
+            break;
+        offset += sizeof(header) + path.size();
+
+        if (header.type == 'V')
+        {
+            File &file = files_[path];
+            file = File();
+            file.id = header.id;
+            file.version = header.version;
+            next_id_ = std::max(next_id_, header.id + 1);
+        }
+        else if (header.type == 'B')
+        {
+            auto it = files_.find(path);
+            if (it != files_.end() && it->second.id == header.id && !it->second.blocks.count(header.block))
+            {
+                it->second.blocks[header.block] = {header.checksum, header.length, false};
+                it->second.bytes += header.length;
+            }
+        }
+        else if (header.type == 'D')
+        {
+            files_.erase(path);
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+
+    std::set<std::string> live;
+    for (auto &entry : files_)
+    {
+        live.insert(std::to_string(entry.second.id));
+        live_records_ += 1 + entry.second.blocks.size();
+        total_bytes_ += entry.second.bytes;
+        lru_.push_back(entry.first);
+        entry.second.lru = std::prev(lru_.end());
+    }
+
+    // Data files whose drop record made it but whose unlink did not.
+    if (DIR *d = opendir((dir_ + "/data").c_str()))
+    {
+        while (struct dirent *entry = readdir(d))
+        {
+            if (entry->d_name[0] != '.' && !live.count(entry->d_name))
+                unlink((dir_ + "/data/" + entry->d_name).c_str());
+        }
+        closedir(d);
+    }
+    return true;
+}
+
+// Rewrites the journal with just the live state; tmp + rename so a crash
+// leaves either the old or the new index.
+bool DiskCache::Compact()
+{
+    std::string tmp = dir_ + kIndexTmpName;
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return false;
+
+    std::string buffer;
+    uint64_t records = 0;
+    auto add = [&](char type, const std::string &path, const File &file, uint64_t block, const BlockInfo &info) {
+        CacheRecordHeader header{type, file.id, file.version, block, info.checksum, info.length, (uint32_t)path.size()};
+        buffer.append((const char *)&header, sizeof(header));
+        buffer.append(path);
+        records++;
+    };
+    for (const auto &entry : files_)
+    {
+        add('V', entry.first, entry.second, 0, {0, 0, false});
+        for (const auto &block : entry.second.blocks)
+            add('B', entry.first, entry.second, block.first, block.second);
+    }
+
+    bool ok = write(fd, buffer.data(), buffer.size()) == (ssize_t)buffer.size() && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), (dir_ + kIndexName).c_str()) != 0)
+        return false;
+
+    if (index_fd_ >= 0)
+        close(index_fd_);
+    index_fd_ = open((dir_ + kIndexName).c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    index_records_ = records;
+    return index_fd_ >= 0;
+}
+
+int DiskCache::Append(char type, const std::string &path, uint64_t id, int64_t version, uint64_t block,
+                      uint64_t checksum, uint32_t length)
+{
+    CacheRecordHeader header{type, id, version, block, checksum, length, (uint32_t)path.size()};
+    std::string record((const char *)&header, sizeof(header));
+    record += path;
+
+    // O_APPEND: a single write() lands the record contiguously.
+    ssize_t n = write(index_fd_, record.data(), record.size());
+    if (n != (ssize_t)record.size())
+        return n < 0 ? -errno : -EIO;
+    index_records_++;
+    return 0;
+}
+
+// Called after the in-memory state reflects the last appended record.
+void DiskCache::MaybeCompact()
+{
+    if (index_records_ > 4 * live_records_ + 4096 && !Compact())
+        std::cerr << "[CACHE] cannot compact index: " << strerror(errno) << std::endl;
+}
+
+void DiskCache::Touch(File &file)
+{
+    lru_.splice(lru_.begin(), lru_, file.lru);
+}
+
+void DiskCache::Drop(const std::string &path)
+{
+    auto it = files_.find(path);
+    if (it == files_.end())
+        return;
+    Append('D', path, it->second.id, it->second.version);
+    unlink(DataPath(it->second.id).c_str());
+    total_bytes_ -= it->second.bytes;
+    live_records_ -= 1 + it->second.blocks.size();
+    lru_.erase(it->second.lru);
+    files_.erase(it);
+    MaybeCompact();
+}
+
+void DiskCache::EvictToFit()
+{
+    while (total_bytes_ > capacity_ && !lru_.empty())
+    {
+        std::string victim = lru_.back();
+        Drop(victim);
+    }
+}
+
+std::vector<std::pair<std::string, int64_t>> DiskCache::Unvalidated()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::pair<std::string, int64_t>> result;
+    for (const auto &entry : files_)
+    {
+        if (!entry.second.validated)
+            result.emplace_back(entry.first, entry.second.version);
+    }
+    return result;
+}
+
+void DiskCache::Validate(const std::string &path, int64_t version, bool valid)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = files_.find(path);
+    if (it == files_.end() || it->second.version != version)
+        return;
+    if (!valid)
+    {
+        Drop(path);
+        return;
+    }
+    it->second.validated = true;
+    versions_[path] = version;
+}
+
+void DiskCache::SetVersion(const std::string &path, int64_t version)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (version == 0)
+        versions_.erase(path);
+    else
+        versions_[path] = version;
+
+    auto it = files_.find(path);
+    if (it == files_.end())
+        return;
+    if (version != 0 && it->second.version == version)
+        it->second.validated = true;
+    else
+        Drop(path);
+}
+
+void DiskCache::Invalidate(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    versions_.erase(path);
+    Drop(path);
+}
+
+int DiskCache::OpenRange(const std::string &path, size_t size, off_t offset, size_t *length)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = files_.find(path);
+    if (it == files_.end() || !it->second.validated)
+        return -1;
+    File &file = it->second;
+
+    // Check coverage before touching the disk.
+    uint64_t end = offset + size;
+    uint64_t available = end;
+    for (uint64_t block = offset / block_bytes_; block * block_bytes_ < end; block++)
+    {
+        auto info = file.blocks.find(block);
+        if (info == file.blocks.end())
+            return -1;
+        if (info->second.length < block_bytes_)
+        {
+            available = std::min(end, block * block_bytes_ + info->second.length);
+            break;
+        }
+    }
+
+    int fd = open(DataPath(file.id).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        Drop(path);
+        return -1;
+    }
+
+    std::string data;
+    for (uint64_t block = offset / block_bytes_; block * block_bytes_ < available; block++)
+    {
+        BlockInfo &info = file.blocks[block];
+        if (info.verified)
+            continue;
+        data.resize(info.length);
+        if (PreadAll(fd, &data[0], info.length, block * block_bytes_) != (ssize_t)info.length ||
+            Fnv1a(data.data(), info.length) != info.checksum)
+        {
+            // Lost in a crash (or tampered with); refetch the whole file.
+            close(fd);
+            Drop(path);
+            return -1;
+        }
+        info.verified = true;
+    }
+    Touch(file);
+    *length = available > (uint64_t)offset ? available - offset : 0;
+    return fd;
+}
+
+int64_t DiskCache::Version(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = versions_.find(path);
+    return it == versions_.end() ? 0 : it->second;
+}
+
+void DiskCache::Store(const std::string &path, int64_t version, uint64_t block, const char *data, size_t length)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    // A getattr, local write or invalidation during the fetch means the
+    // data may predate the current version.
+    auto current = versions_.find(path);
+    if (version == 0 || current == versions_.end() || current->second != version)
+        return;
+    auto it = files_.find(path);
+    if (it == files_.end())
+    {
+        File file;
+        file.id = next_id_++;
+        file.version = version;
+        file.validated = true;
+        if (Append('V', path, file.id, file.version) < 0)
+            return;
+        lru_.push_front(path);
+        file.lru = lru_.begin();
+        live_records_++;
+        it = files_.emplace(path, file).first;
+    }
+
+    File &file = it->second;
+    if (!file.validated || file.version != version || file.blocks.count(block))
+        return;
+
+    int fd = open(DataPath(file.id).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return;
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t n = pwrite(fd, data + done, length - done, block * block_bytes_ + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    close(fd);
+
+    // The block record goes in only after its data is written.
+    uint64_t checksum = Fnv1a(data, length);
+    if (done != length || Append('B', path, file.id, file.version, block, checksum, length) < 0)
+        return;
+    file.blocks[block] = {checksum, (uint32_t)length, true};
+    file.bytes += length;
+    total_bytes_ += length;
+    live_records_++;
+    Touch(file);
+    EvictToFit();
+    MaybeCompact();
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Persistent block cache for the FUSE client, kept in client.cache_dir so
+// a remount starts warm.
+//
+// Each cached file has a sparse data file data/<id> holding the blocks
+// fetched so far, tagged with the server's write generation of the file.
+// The index is an append-only journal (index.log) of checksummed block
+// records. Block data is never fsynced: a block whose bytes were lost in a
+// crash fails its checksum on read and is simply refetched. A torn journal
+// tail is cut off on open.
+//
+// Entries loaded from disk are unvalidated until the server confirms their
+// version (in bulk at mount, or per file on getattr); only validated
+// entries serve reads.
+class DiskCache
+{
+public:
+    static std::unique_ptr<DiskCache> Open(const std::string &dir, uint64_t capacity_bytes, uint64_t block_bytes,
+                                           std::string *error);
+    ~DiskCache();
+
+    uint64_t block_bytes() const { return block_bytes_; }
+
+    // Unvalidated files and their cached versions, for mount validation.
+    std::vector<std::pair<std::string, int64_t>> Unvalidated();
+    // Marks a cached version current, or drops the file if it is not.
+    void Validate(const std::string &path, int64_t version, bool valid);
+    // Records the server's version from getattr; a different one drops
+    // the cached blocks. Version 0 (unknown) disables caching the file.
+    void SetVersion(const std::string &path, int64_t version);
+    // Local write or unlink: drop the blocks, version unknown until the
+    // next getattr.
+    void Invalidate(const std::string &path);
+
+    // If [offset, offset + size) is fully cached, returns a new read-only fd
+    // of the file's data file (same offsets as the file) and sets *length
+    // to the bytes it holds there, short only at end of file; -1 on a miss.
+    // The caller closes the fd. Blocks loaded from disk have their checksum
+    // verified the first time they are served.
+    int OpenRange(const std::string &path, size_t size, off_t offset, size_t *length);
+    // The server version data fetched now would be tagged with; 0 if none.
+    int64_t Version(const std::string &path);
+    // Caches block `block` of the file, read while Version() returned
+    // `version`; dropped if the file changed since. `length` < block_bytes
+    // marks EOF.
+    void Store(const std::string &path, int64_t version, uint64_t block, const char *data, size_t length);
+
+private:
+    struct BlockInfo
+    {
+        uint64_t checksum;
+        uint32_t length;
+        bool verified; // written or checked since open; not journaled
+    };
+
+    struct File
+    {
+        uint64_t id = 0;
+        int64_t version = 0;
+        bool validated = false;
+        std::map<uint64_t, BlockInfo> blocks;
+        uint64_t bytes = 0;
+        std::list<std::string>::iterator lru;
+    };
+
+    DiskCache(const std::string &dir, uint64_t capacity_bytes, uint64_t block_bytes)
+        : dir_(dir), capacity_(capacity_bytes), block_bytes_(block_bytes)
+    {
+    }
+
+    bool Replay(std::string *error);
+    bool Compact();
+    void MaybeCompact();
+    int Append(char type, const std::string &path, uint64_t id, int64_t version, uint64_t block = 0,
+               uint64_t checksum = 0, uint32_t length = 0);
+    std::string DataPath(uint64_t id) const;
+    // Require mutex_ held.
+    void Drop(const std::string &path);
+    void Touch(File &file);
+    void EvictToFit();
+
+    std::string dir_;
+    uint64_t capacity_;
+    uint64_t block_bytes_;
+
+    std::mutex mutex_;
+    int index_fd_ = -1;
+    uint64_t index_records_ = 0;
+    uint64_t live_records_ = 0; // what a compacted index would hold
+    uint64_t next_id_ = 1;
+    uint64_t total_bytes_ = 0;
+    std::unordered_map<std::string, File> files_;
+    // Server versions seen via getattr; a file is cached on first Store().
+    std::unordered_map<std::string, int64_t> versions_;
+    std::list<std::string> lru_; // front = most recently used
+};
@@ -1,10 +1,28 @@
 #define FUSE_USE_VERSION 35
 #include <fuse3/fuse.h>
+#include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <grpcpp/grpcpp.h>
 #include "../build/dfs.grpc.pb.h"
+#include "../common/transport.h"
+#include "access_predictor.h"
+#include "channel_pool.h"
+#include "disk_cache.h"
+#include "kernel_cache.h"
+#include "offline_log.h"
+#include "retry_policy.h"
+#include "shm_ring.h"
+#include "write_pipeline.h"
 
 using grpc::Channel;
 using dfs::DFS;
@@ -15,43 +33,448 @@ using dfs::ReadResponse;
 
 // Global gRPC stub
 std::unique_ptr<DFS::Stub> stub_;
+std::shared_ptr<grpc::Channel> channel_;
+// Extra connections for split reads (client.channels > 1)
+std::unique_ptr<ChannelPool> channel_pool_;
+// Reads larger than this are split across the pool (client.read_split_bytes)
+size_t read_split_bytes_ = 256 << 10;
+// Shared-memory data channel, only when connected over the Unix socket
+std::unique_ptr<ShmRing> shm_ring_;
+// Per-RPC deadline (client.rpc_timeout_ms), overridden per kind of call
+// by client.{read,write,metadata}_timeout_ms when those are set; all
+// hot-reloadable
+std::atomic<int64_t> rpc_timeout_ms_{0};
+std::atomic<int64_t> read_timeout_ms_{0};
+std::atomic<int64_t> write_timeout_ms_{0};
+std::atomic<int64_t> metadata_timeout_ms_{0};
+// Reads not answered by the hedge_percentile latency of recent reads (and
+// at least hedge_min_delay_ms) are sent again on another channel; 0
+// disables hedging. Hot-reloadable
+std::atomic<int64_t> hedge_percentile_{95};
+std::atomic<int64_t> hedge_min_delay_ms_{2};
+LatencyTracker read_latency_;
+// Persistent block cache (client.cache_dir), if configured
+std::unique_ptr<DiskCache> disk_cache_;
+// Bypass the kernel page cache for all files (client.direct_io) or for
+// files at least client.direct_io_min_bytes long at open; hot-reloadable
+std::atomic<bool> direct_io_{false};
+std::atomic<int64_t> direct_io_min_bytes_{0};
+// Largest FUSE read/write request (client.max_read / client.max_write)
+size_t max_read_ = 1 << 20;
+size_t max_write_ = 1 << 20;
+// Kernel page cache versions (client.kernel_cache); created in init, which
+// is where the struct fuse to invalidate through becomes available
+std::unique_ptr<KernelCache> kernel_cache_;
+bool kernel_cache_enabled_ = true;
+bool writeback_cache_ = false;
+double attr_timeout_s_ = 1.0;
+// Writes in flight per file (client.write_window); 1 waits for each reply
+size_t write_window_ = 8;
+// Retries of writes that failed transiently (client.write_attempts,
+// client.retry_backoff_ms, client.retry_max_backoff_ms)
+RetryPolicy write_retry_;
 
-static int dfs_getattr(const char *path, struct stat *st, struct fuse_file_info *) {
+// One write pipeline per path with a writable open, shared by its opens
+// and dropped with the last one.
+struct OpenWrites {
+    std::shared_ptr<WritePipeline> pipeline;
+    int opens = 0;
+};
+std::mutex open_writes_mutex_;
+std::unordered_map<std::string, OpenWrites> open_writes_;
+
+// Learned open order (client.prefetch_predict); its predictions, like the
+// user.dfs.prefetch xattr, become Prefetch RPCs
+std::unique_ptr<AccessPredictor> predictor_;
+std::string prefetch_model_;
+size_t prefetch_depth_ = 2;
+int64_t prefetch_bytes_ = 0;
+
+// Change stream from the server (client.watch): other clients' changes
+// drop our cached copies as they happen instead of at the next getattr
+std::thread watcher_;
+std::mutex watcher_mutex_;
+std::condition_variable watcher_wake_;
+grpc::ClientContext *watch_context_ = nullptr;
+bool watch_ = false;
+bool watcher_stop_ = false;
+
+// Re-reads the config file (config.reload_interval_ms); started in init,
+// since fuse_main would not carry its thread across the fork
+std::unique_ptr<dfs::ConfigReloader> reloader_;
+
+static int64_t Timeout(const std::atomic<int64_t> &op_timeout_ms) {
+    int64_t ms = op_timeout_ms;
+    return ms > 0 ? ms : rpc_timeout_ms_.load();
+}
+
+// Disconnected operation (client.offline): while the server is
+// unreachable, changes go to the journal and reads to the disk cache. The
+// reintegrator thread probes every offline_probe_ms and replays the
+// journal once the server answers.
+std::unique_ptr<OfflineLog> offline_;
+int64_t offline_probe_ms_ = 2000;
+std::thread reintegrator_;
+std::mutex reintegrator_mutex_;
+std::condition_variable reintegrator_wake_;
+bool reintegrator_stop_ = false;
+
+static bool Offline() {
+    return offline_ && offline_->offline();
+}
+
+// Switches to offline operation if a call failed because the server is
+// unreachable: UNAVAILABLE, or any failure while the connection is down
+// (reads only report -EIO).
+static bool WentOffline(grpc::StatusCode code) {
+    if (!offline_ || code == grpc::StatusCode::OK) return false;
+    if (code != grpc::StatusCode::UNAVAILABLE && channel_->GetState(false) != GRPC_CHANNEL_TRANSIENT_FAILURE)
+        return false;
+    offline_->SetOffline();
+    return true;
+}
+
+static const char kPrefetchXattr[] = "user.dfs.prefetch";
+
+// Fire and forget: a hint has nothing to report back.
+static void SendPrefetch(const std::vector<std::string> &paths, int64_t max_bytes) {
+    struct Call {
+        grpc::ClientContext context;
+        dfs::PrefetchRequest request;
+        dfs::PrefetchResponse response;
+    };
+    Call *call = new Call;
+    for (const auto &path : paths) call->request.add_paths(path.substr(1));
+    call->request.set_max_bytes(max_bytes);
+    dfs::SetRpcDeadline(call->context, rpc_timeout_ms_);
+    stub_->async()->Prefetch(&call->context, &call->request, &call->response, [call](grpc::Status) { delete call; });
+}
+
+static bool Pipelined(struct fuse_file_info *fi) {
+    return write_window_ > 1 && fi->fh != 0 && (fi->flags & O_ACCMODE) != O_RDONLY;
+}
+
+static std::shared_ptr<WritePipeline> FindPipeline(const char *path) {
+    std::lock_guard<std::mutex> lock(open_writes_mutex_);
+    auto it = open_writes_.find(path);
+    return it == open_writes_.end() ? nullptr : it->second.pipeline;
+}
+
+// Reads, getattr and unlink wait for this path's writes to land first.
+static void DrainWrites(const char *path) {
+    if (auto pipeline = FindPipeline(path)) pipeline->Drain();
+}
+
+static int FillStat(struct stat *st, int64_t size, int64_t mtime) {
+    st->st_mode = S_IFREG | 0666;
+    st->st_nlink = 1;
+    st->st_size = size;
+    st->st_mtime = mtime;
+    return 0;
+}
+
+static int dfs_getattr(const char *path, struct stat *st, struct fuse_file_info *fi) {
+    DrainWrites(path);
     memset(st, 0, sizeof(struct stat));
+    if (Offline()) {
+        int64_t size, mtime;
+        int result = offline_->GetAttr(path, &size, &mtime);
+        if (result != -EAGAIN) return result < 0 ? result : FillStat(st, size, mtime);
+    }
     GetAttrRequest request;
     request.set_path(path + 1); // remove leading "/"
 
     GetAttrResponse response;
     grpc::ClientContext context;
+    dfs::SetRpcDeadline(context, Timeout(metadata_timeout_ms_));
     auto status = stub_->GetAttr(&context, request, &response);
 
+    if (WentOffline(status.error_code())) return dfs_getattr(path, st, fi);
     if (!status.ok() || !response.exists()) return -ENOENT;
 
-    st->st_mode = S_IFREG | 0666;
-    st->st_nlink = 1;
-    st->st_size = response.size();
-    st->st_mtime = response.mtime();
+    FillStat(st, response.size(), response.mtime());
+    if (disk_cache_) disk_cache_->SetVersion(path + 1, response.version());
+    if (kernel_cache_) kernel_cache_->Observe(path, response.version());
+    if (offline_) offline_->Remember(path, response.size(), response.mtime(), response.version());
+
+    return 0;
+}
+
+// The errno for a failed metadata call, undoing the server's ErrnoStatus.
+static int StatusErrno(const grpc::Status &status) {
+    switch (status.error_code()) {
+    case grpc::StatusCode::NOT_FOUND: return -ENOENT;
+    case grpc::StatusCode::PERMISSION_DENIED: return -EACCES;
+    case grpc::StatusCode::ALREADY_EXISTS: return -EEXIST;
+    case grpc::StatusCode::INVALID_ARGUMENT: return -EINVAL;
+    default: return -EIO;
+    }
+}
+
+// Opens a server handle for fi->fh; 0 (path-based I/O) if the server
+// predates Open/Close or is out of handles.
+static int dfs_open(const char *path, struct fuse_file_info *fi) {
+    fi->fh = 0;
+    if (Offline()) {
+        int64_t size, mtime;
+        int result = offline_->GetAttr(path, &size, &mtime);
+        if (result != -EAGAIN) return result;
+    }
+    dfs::OpenRequest request;
+    request.set_path(path + 1);
+    request.set_mode((fi->flags & O_ACCMODE) == O_RDONLY ? "r" : "rw");
+
+    dfs::OpenResponse response;
+    grpc::ClientContext context;
+    dfs::SetRpcDeadline(context, Timeout(metadata_timeout_ms_));
+    auto status = stub_->Open(&context, request, &response);
+
+    if (WentOffline(status.error_code())) return dfs_open(path, fi);
+    if (status.error_code() == grpc::StatusCode::UNIMPLEMENTED ||
+        status.error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED)
+        return 0;
+    if (!status.ok()) return StatusErrno(status);
+
+    fi->fh = response.handle();
+    int64_t direct_min = direct_io_min_bytes_;
+    fi->direct_io = direct_io_ || (direct_min > 0 && response.size() >= direct_min);
+    // Pages the kernel cached from this same version survive the open.
+    fi->keep_cache = kernel_cache_ && kernel_cache_->Observe(path, response.version());
+    if (disk_cache_) disk_cache_->SetVersion(path + 1, response.version());
+    if (Pipelined(fi)) {
+        std::lock_guard<std::mutex> lock(open_writes_mutex_);
+        OpenWrites &writes = open_writes_[path];
+        if (!writes.pipeline) writes.pipeline = std::make_shared<WritePipeline>(write_window_, write_retry_);
+        writes.opens++;
+    }
+    if (predictor_) {
+        auto next = predictor_->Record(fuse_get_context()->pid, path, prefetch_depth_);
+        if (!next.empty()) SendPrefetch(next, prefetch_bytes_);
+    }
+    return 0;
+}
+
+// Where pipelined write errors surface: close() and fsync() return them,
+// to the open whose writes failed (fi->fh tells opens apart).
+static int dfs_flush(const char *path, struct fuse_file_info *fi) {
+    auto pipeline = Pipelined(fi) ? FindPipeline(path) : nullptr;
+    return pipeline ? pipeline->Flush(fi->fh) : 0;
+}
 
+static int dfs_fsync(const char *path, int, struct fuse_file_info *fi) {
+    return dfs_flush(path, fi);
+}
+
+static int dfs_release(const char *path, struct fuse_file_info *fi) {
+    if (Pipelined(fi)) {
+        std::shared_ptr<WritePipeline> pipeline;
+        {
+            std::lock_guard<std::mutex> lock(open_writes_mutex_);
+            auto it = open_writes_.find(path);
+            if (it != open_writes_.end()) {
+                pipeline = it->second.pipeline;
+                if (--it->second.opens == 0) open_writes_.erase(it);
+            }
+        }
+        if (pipeline) pipeline->Flush(fi->fh); // flush already reported any error
+    }
+    if (fi->fh == 0 || Offline()) return 0;
+    dfs::CloseRequest request;
+    request.set_handle(fi->fh);
+    dfs::CloseResponse response;
+    grpc::ClientContext context;
+    dfs::SetRpcDeadline(context, Timeout(metadata_timeout_ms_));
+    stub_->Close(&context, request, &response); // idle handles expire anyway
     return 0;
 }
 
-static int dfs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *) {
+// Reads [offset, offset + size) from the server into buf. Large ranges
+// are fetched as concurrent chunks over the channel pool; others are
+// hedged across it (TCP only: a cancelled call may still be filling its
+// shared-memory slot).
+static int FetchRange(const char *path, uint64_t fh, char *buf, size_t size, off_t offset) {
     ReadRequest request;
     request.set_path(path + 1);
+    request.set_handle(fh);
+    if (channel_pool_ && read_split_bytes_ > 0 && size > read_split_bytes_)
+        return ReadRanges(*channel_pool_, request, buf, size, offset, read_split_bytes_, Timeout(read_timeout_ms_),
+                          shm_ring_.get());
     request.set_offset(offset);
     request.set_size(size);
 
+    int64_t percentile = hedge_percentile_;
+    if (channel_pool_ && !shm_ring_ && percentile > 0) {
+        // Until enough latencies are in, reads are only timed (delay 0).
+        std::chrono::microseconds delay = read_latency_.Percentile(percentile);
+        if (delay.count() < 0)
+            delay = std::chrono::microseconds(0);
+        else
+            delay = std::max<std::chrono::microseconds>(delay, std::chrono::milliseconds(hedge_min_delay_ms_));
+        return HedgedRead(*channel_pool_, request, buf, Timeout(read_timeout_ms_), delay, &read_latency_);
+    }
+
+    ShmRing::Slot slot;
+    bool use_shm = shm_ring_ && shm_ring_->Acquire(size, &slot);
+    if (use_shm) {
+        request.set_shm_channel(shm_ring_->channel());
+        request.set_shm_offset(slot.offset);
+    }
+
     ReadResponse response;
     grpc::ClientContext context;
+    dfs::SetRpcDeadline(context, Timeout(read_timeout_ms_));
     auto status = stub_->Read(&context, request, &response);
 
+    if (status.ok())
+        memcpy(buf, use_shm ? slot.data : response.data().c_str(), response.bytes_read());
+    if (use_shm) shm_ring_->Release(slot);
     if (!status.ok()) return -EIO;
 
-    memcpy(buf, response.data().c_str(), response.bytes_read());
     return response.bytes_read();
 }
 
-static int dfs_create(const char *path, mode_t, struct fuse_file_info *fi) {
+// libfuse sends the reply from the thread that called read_buf, after it
+// returns, so an fd handed out in a buffer stays open until that thread's
+// next read.
+struct ReplyFd {
+    int fd = -1;
+    ~ReplyFd() { Reset(-1); }
+    void Reset(int next) {
+        if (fd >= 0) close(fd);
+        fd = next;
+    }
+};
+static thread_local ReplyFd reply_fd_;
+
+static int MemoryBuf(struct fuse_bufvec **bufp, char *mem, size_t size) {
+    struct fuse_bufvec *bufv = (struct fuse_bufvec *)malloc(sizeof(struct fuse_bufvec));
+    if (!bufv) {
+        free(mem);
+        return -ENOMEM;
+    }
+    *bufv = FUSE_BUFVEC_INIT(size);
+    bufv->buf[0].mem = mem; // freed by libfuse
+    *bufp = bufv;
+    return 0;
+}
+
+// Copies [offset, offset + size) out of the disk cache; false on a miss.
+static bool ReadCached(const char *path, char *buf, size_t size, off_t offset) {
+    size_t length;
+    int fd = disk_cache_ ? disk_cache_->OpenRange(path + 1, size, offset, &length) : -1;
+    if (fd < 0) return false;
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pread(fd, buf + done, length - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    close(fd);
+    return done == length;
+}
+
+// Offline: the disk cache with journaled writes laid over it. -EAGAIN if
+// the server came back meanwhile.
+static int ReadOffline(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset) {
+    char *mem = (char *)malloc(std::max<size_t>(size, 1));
+    if (!mem) return -ENOMEM;
+    ssize_t n = offline_->Read(path, mem, size, offset,
+                               [path](char *buf, size_t length, off_t at) { return ReadCached(path, buf, length, at); });
+    if (n < 0) {
+        free(mem);
+        return n;
+    }
+    return MemoryBuf(bufp, mem, n);
+}
+
+// Cache hits reply with an fd into the cache's data file, which the kernel
+// splices without the data passing through this process. Misses land in
+// a heap buffer that libfuse replies from and frees.
+static int dfs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset,
+                        struct fuse_file_info *fi) {
+    uint64_t fh = fi ? fi->fh : 0;
+    reply_fd_.Reset(-1);
+    DrainWrites(path);
+    if (Offline()) {
+        int result = ReadOffline(path, bufp, size, offset);
+        if (result != -EAGAIN) return result;
+    }
+    if (!disk_cache_) {
+        char *mem = (char *)malloc(std::max<size_t>(size, 1));
+        if (!mem) return -ENOMEM;
+        int n = FetchRange(path, fh, mem, size, offset);
+        if (n < 0) {
+            free(mem);
+            return n == -EIO && WentOffline(grpc::StatusCode::UNKNOWN) ? dfs_read_buf(path, bufp, size, offset, fi) : n;
+        }
+        return MemoryBuf(bufp, mem, n);
+    }
+
+    size_t length;
+    int fd = disk_cache_->OpenRange(path + 1, size, offset, &length);
+    if (fd >= 0) {
+        struct fuse_bufvec *bufv = (struct fuse_bufvec *)malloc(sizeof(struct fuse_bufvec));
+        if (!bufv) {
+            close(fd);
+            return -ENOMEM;
+        }
+        *bufv = FUSE_BUFVEC_INIT(length);
+        bufv->buf[0].flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+        bufv->buf[0].fd = fd;
+        bufv->buf[0].pos = offset;
+        reply_fd_.Reset(fd);
+        *bufp = bufv;
+        return 0;
+    }
+
+    // Miss: fetch whole blocks so they can be cached.
+    uint64_t block_bytes = disk_cache_->block_bytes();
+    uint64_t first = offset / block_bytes;
+    uint64_t last = (offset + size + block_bytes - 1) / block_bytes;
+    size_t span = std::max<uint64_t>((last - first) * block_bytes, 1);
+    char *blocks = (char *)malloc(span);
+    if (!blocks) return -ENOMEM;
+    int64_t version = disk_cache_->Version(path + 1);
+    int n = FetchRange(path, fh, blocks, (last - first) * block_bytes, first * block_bytes);
+    if (n < 0) {
+        free(blocks);
+        return n == -EIO && WentOffline(grpc::StatusCode::UNKNOWN) ? dfs_read_buf(path, bufp, size, offset, fi) : n;
+    }
+
+    for (uint64_t start = 0; start <= (uint64_t)n && start < span; start += block_bytes) {
+        size_t length = std::min<uint64_t>(block_bytes, n - start);
+        disk_cache_->Store(path + 1, version, first + start / block_bytes, blocks + start, length);
+        if (length < block_bytes) break; // end of file
+    }
+
+    uint64_t skip = offset - first * block_bytes;
+    length = skip >= (uint64_t)n ? 0 : std::min<uint64_t>(size, n - skip);
+    memmove(blocks, blocks + skip, length);
+    return MemoryBuf(bufp, blocks, length);
+}
+
+// Transient failures are retried under one request id, which the server
+// uses to apply the write once however many attempts reach it. A caller's
+// id (a replayed journal record's) is kept.
+static grpc::Status WriteWithRetry(dfs::WriteRequest &request, dfs::WriteResponse *response) {
+    if (request.request_id() == 0) request.set_request_id(NewRequestId());
+    for (int attempt = 1;; attempt++) {
+        grpc::ClientContext context;
+        dfs::SetRpcDeadline(context, Timeout(write_timeout_ms_));
+        auto status = stub_->Write(&context, request, response);
+        if (status.ok() || !write_retry_.Retryable(status) || attempt >= write_retry_.max_attempts)
+            return status;
+        std::this_thread::sleep_for(write_retry_.Backoff(attempt - 1));
+    }
+}
+
+static int dfs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+    if (Offline()) {
+        fi->fh = 0;
+        ssize_t result = offline_->Write(path, "", 0, 0);
+        if (result != -EAGAIN) return result < 0 ? result : 0;
+    }
     std::string empty_data = "";
     dfs::WriteRequest request;
     request.set_path(path + 1); // strip leading "/"
@@ -60,47 +483,463 @@ static int dfs_create(const char *path, mode_t, struct fuse_file_info *fi) {
     request.set_mtime(std::time(nullptr)); // send current time
 
     dfs::WriteResponse response;
-    grpc::ClientContext context;
+    auto status = WriteWithRetry(request, &response);
+    if (disk_cache_) disk_cache_->Invalidate(path + 1);
+    if (WentOffline(status.error_code())) return dfs_create(path, mode, fi);
+    if (!status.ok()) return -EIO;
+    return dfs_open(path, fi);
+}
 
-    auto status = stub_->Write(&context, request, &response);
-    return status.ok() ? 0 : -EIO;
+// Bookkeeping once a write's reply is in. A write that failed because the
+// server went away is journaled instead; returns the resulting status.
+static grpc::Status WriteDone(const std::string &path, grpc::Status status, const dfs::WriteRequest &request,
+                              const char *data, const dfs::WriteResponse &response) {
+    if (disk_cache_) disk_cache_->Invalidate(path.substr(1));
+    size_t length = request.shm_channel() != 0 ? request.shm_length() : request.data().size();
+    if (!status.ok() && WentOffline(status.error_code()) && offline_->Write(path, data, length, request.offset()) >= 0)
+        return grpc::Status::OK; // the kernel's pages match the journaled data
+    if (status.ok() && offline_)
+        offline_->Extend(path, request.offset() + response.bytes_written(), response.version());
+    if (!kernel_cache_) return status;
+    if (status.ok())
+        kernel_cache_->Wrote(path, response.previous_version(), response.version());
+    else
+        kernel_cache_->Wrote(path, -1, 0); // unknown how much landed: treat as someone else's write
+    return status;
 }
 
-static int dfs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *) {
-    dfs::WriteRequest request;
-    request.set_path(path + 1);
-    request.set_offset(offset);
-    request.set_data(std::string(buf, size));
-    request.set_mtime(std::time(nullptr));
+// Offline write: copies the FUSE buffer into the journal.
+static int WriteOffline(const char *path, struct fuse_bufvec *buf, off_t offset) {
+    size_t size = fuse_buf_size(buf);
+    std::string data(size, '\0');
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+    dst.buf[0].mem = &data[0];
+    ssize_t copied = fuse_buf_copy(&dst, buf, (enum fuse_buf_copy_flags)0);
+    if (copied < 0) return copied;
+    return offline_->Write(path, data.data(), copied, offset);
+}
+
+// The payload is copied once, from the FUSE buffer (spliced from the
+// kernel where possible) into the shm slot or the request itself. With a
+// write pipeline the reply is not waited for; see dfs_flush.
+static int dfs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fi) {
+    // Checked once: the buffer can only be consumed once.
+    if (Offline()) {
+        int result = WriteOffline(path, buf, offset);
+        if (result != -EAGAIN) return result;
+    }
+    size_t size = fuse_buf_size(buf);
+    std::unique_ptr<dfs::WriteRequest> request(new dfs::WriteRequest);
+    request->set_path(path + 1);
+    if (fi) request->set_handle(fi->fh);
+    request->set_offset(offset);
+    request->set_mtime(std::time(nullptr));
+
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+    ShmRing::Slot slot;
+    bool use_shm = shm_ring_ && shm_ring_->Acquire(size, &slot);
+    if (use_shm) {
+        dst.buf[0].mem = slot.data;
+        request->set_shm_channel(shm_ring_->channel());
+        request->set_shm_offset(slot.offset);
+    } else {
+        request->mutable_data()->resize(size);
+        dst.buf[0].mem = &(*request->mutable_data())[0];
+    }
+    ssize_t copied = fuse_buf_copy(&dst, buf, (enum fuse_buf_copy_flags)0);
+    if (copied < 0) {
+        if (use_shm) shm_ring_->Release(slot);
+        return copied;
+    }
+    if (use_shm)
+        request->set_shm_length(copied);
+    else
+        request->mutable_data()->resize(copied);
+
+    if (auto pipeline = fi && Pipelined(fi) ? FindPipeline(path) : nullptr) {
+        std::string file = path;
+        int result = pipeline->Submit(fi->fh, stub_.get(), std::move(request), Timeout(write_timeout_ms_),
+                                      [file, use_shm, slot](const grpc::Status &status,
+                                                            const dfs::WriteRequest &request,
+                                                            const dfs::WriteResponse &response) {
+                                          const char *data = use_shm ? slot.data : request.data().data();
+                                          grpc::Status result = WriteDone(file, status, request, data, response);
+                                          if (use_shm) shm_ring_->Release(slot);
+                                          return result;
+                                      });
+        if (result < 0 && use_shm) shm_ring_->Release(slot);
+        return result < 0 ? result : copied;
+    }
 
     dfs::WriteResponse response;
-    grpc::ClientContext context;
+    auto status = WriteWithRetry(*request, &response);
+    const char *data = use_shm ? slot.data : request->data().data();
+    grpc::Status result = WriteDone(path, status, *request, data, response);
+    if (use_shm) shm_ring_->Release(slot);
+    if (!result.ok()) return -EIO;
 
-    auto status = stub_->Write(&context, request, &response);
-    if (!status.ok()) return -EIO;
+    return status.ok() ? response.bytes_written() : copied; // else journaled
+}
 
-    return response.bytes_written();
+// `setfattr -n user.dfs.prefetch [-v BYTES] FILE` asks the server to warm
+// FILE (its first BYTES, default client.prefetch_bytes) ahead of reads.
+static int dfs_setxattr(const char *path, const char *name, const char *value, size_t size, int) {
+    if (strcmp(name, kPrefetchXattr) != 0) return -ENOTSUP;
+    std::string text(value, size);
+    int64_t max_bytes = text.empty() ? prefetch_bytes_ : strtoll(text.c_str(), nullptr, 10);
+    SendPrefetch({path}, max_bytes);
+    return 0;
 }
 
 static int dfs_unlink(const char *path) {
+    DrainWrites(path);
+    if (Offline()) {
+        int result = offline_->Unlink(path);
+        if (result != -EAGAIN) {
+            if (disk_cache_) disk_cache_->Invalidate(path + 1);
+            if (kernel_cache_) kernel_cache_->Forget(path);
+            return result;
+        }
+    }
     dfs::UnlinkRequest request;
     request.set_path(path + 1);
     dfs::UnlinkResponse response;
     grpc::ClientContext context;
+    dfs::SetRpcDeadline(context, Timeout(metadata_timeout_ms_));
 
     auto status = stub_->Unlink(&context, request, &response);
+    if (WentOffline(status.error_code())) return dfs_unlink(path);
+    if (disk_cache_) disk_cache_->Invalidate(path + 1);
+    if (kernel_cache_) kernel_cache_->Forget(path);
+    if (offline_) offline_->Forget(path);
     return (status.ok() && response.success()) ? 0 : -ENOENT;
 }
 
-static struct fuse_operations dfs_ops = {};
+static bool Unreachable(const grpc::Status &status) {
+    return status.error_code() == grpc::StatusCode::UNAVAILABLE ||
+           status.error_code() == grpc::StatusCode::DEADLINE_EXCEEDED;
+}
+
+// Anything but a version conflict leaves the change journaled and the
+// mount offline, to try again on the next probe.
+static OfflineLog::Outcome ReplayFailed(const OfflineLog::Record &record, const grpc::Status &status) {
+    if (!Unreachable(status))
+        std::cerr << "[OFFLINE] cannot replay change to " << record.path << ": " << status.error_message()
+                  << "; will retry" << std::endl;
+    return OfflineLog::Outcome::kUnreachable;
+}
+
+// Replays one journaled change. A write applies only if the file is still
+// at the record's base version (last-writer-wins on its original time for
+// files not seen online), and its original request id lets the dedup table
+// answer a write an interrupted replay already applied. An unlink loses to
+// a file the server changed after it was journaled.
+static OfflineLog::Outcome ReplayRecord(const OfflineLog::Record &record, int64_t *version) {
+    grpc::Status status;
+    if (record.type == 'W') {
+        dfs::WriteRequest request;
+        request.set_path(record.path.substr(1));
+        request.set_offset(record.offset);
+        request.set_data(record.data);
+        request.set_mtime(record.time_ns / 1000000000);
+        request.set_request_id(record.request_id);
+        request.set_base_version(record.base_version);
+        dfs::WriteResponse response;
+        status = WriteWithRetry(request, &response);
+        if (status.error_code() == grpc::StatusCode::FAILED_PRECONDITION) return OfflineLog::Outcome::kConflict;
+        if (!status.ok()) return ReplayFailed(record, status);
+        *version = response.version();
+        return OfflineLog::Outcome::kApplied;
+    }
+
+    GetAttrRequest attr_request;
+    attr_request.set_path(record.path.substr(1));
+    GetAttrResponse attr;
+    grpc::ClientContext attr_context;
+    dfs::SetRpcDeadline(attr_context, Timeout(metadata_timeout_ms_));
+    status = stub_->GetAttr(&attr_context, attr_request, &attr);
+    if (status.error_code() == grpc::StatusCode::NOT_FOUND || (status.ok() && !attr.exists()))
+        return OfflineLog::Outcome::kApplied; // already gone
+    if (!status.ok()) return ReplayFailed(record, status);
+    if (record.base_version != 0 ? attr.version() != record.base_version
+                                 : attr.version() > record.time_ns) // generation: write time in ns
+        return OfflineLog::Outcome::kConflict;
+
+    dfs::UnlinkRequest request;
+    request.set_path(record.path.substr(1));
+    dfs::UnlinkResponse response;
+    grpc::ClientContext context;
+    dfs::SetRpcDeadline(context, Timeout(metadata_timeout_ms_));
+    status = stub_->Unlink(&context, request, &response);
+    if (!status.ok() && status.error_code() != grpc::StatusCode::NOT_FOUND) return ReplayFailed(record, status);
+    return OfflineLog::Outcome::kApplied;
+}
+
+// While offline, probes the server every offline_probe_ms and reintegrates
+// the journal once it answers.
+static void Reintegrator() {
+    std::unique_lock<std::mutex> lock(reintegrator_mutex_);
+    while (!reintegrator_wake_.wait_for(lock, std::chrono::milliseconds(offline_probe_ms_),
+                                        [] { return reintegrator_stop_; })) {
+        if (!offline_->offline()) continue;
+        lock.unlock();
+        GetAttrRequest request;
+        GetAttrResponse response;
+        grpc::ClientContext context;
+        dfs::SetRpcDeadline(context, Timeout(metadata_timeout_ms_));
+        std::vector<std::string> touched;
+        if (!Unreachable(stub_->GetAttr(&context, request, &response)) &&
+            offline_->Reintegrate(ReplayRecord, &touched)) {
+            for (const std::string &path : touched) {
+                if (disk_cache_) disk_cache_->Invalidate(path.substr(1));
+                if (kernel_cache_) kernel_cache_->Wrote(path, -1, 0);
+            }
+        }
+        lock.lock();
+    }
+}
+
+// Follows the server's change stream, reconnecting after a second if it
+// breaks and resuming after the last event seen.
+static void Watcher() {
+    uint64_t since = 0;
+    uint64_t run = 0;
+    std::unique_lock<std::mutex> lock(watcher_mutex_);
+    while (!watcher_stop_) {
+        grpc::ClientContext context;
+        watch_context_ = &context;
+        lock.unlock();
+        dfs::WatchRequest request;
+        request.set_since(since);
+        request.set_run(run);
+        auto reader = stub_->Watch(&context, request);
+        dfs::WatchEvent event;
+        while (reader->Read(&event)) {
+            since = event.sequence();
+            run = event.run();
+            if (event.type() == dfs::WatchEvent::OVERFLOW) {
+                // Getattr still catches what was missed, one file at a time.
+                std::cerr << "[WATCH] missed changes; cached files revalidate on access" << std::endl;
+                continue;
+            }
+            std::string path = "/" + event.path();
+            if (disk_cache_) disk_cache_->Invalidate(event.path());
+            if (kernel_cache_)
+                kernel_cache_->Changed(path, event.type() == dfs::WatchEvent::UNLINK ? 0 : event.version());
+        }
+        grpc::Status status = reader->Finish();
+        lock.lock();
+        watch_context_ = nullptr;
+        if (!watcher_stop_ && status.error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED)
+            std::cerr << "[WATCH] " << status.error_message() << "; retrying" << std::endl;
+        watcher_wake_.wait_for(lock, std::chrono::seconds(1), [] { return watcher_stop_; });
+    }
+}
+
+// Confirms what the disk cache kept from the last mount in batched RPCs.
+// Files the server no longer has at the cached version are dropped.
+static void ValidateDiskCache() {
+    const size_t kBatch = 1000;
+    auto files = disk_cache_->Unvalidated();
+    size_t kept = 0;
+    for (size_t i = 0; i < files.size(); i += kBatch) {
+        size_t end = std::min(files.size(), i + kBatch);
+        dfs::ValidateVersionsRequest request;
+        for (size_t j = i; j < end; j++) {
+            dfs::FileVersion *file = request.add_files();
+            file->set_path(files[j].first);
+            file->set_version(files[j].second);
+        }
+
+        dfs::ValidateVersionsResponse response;
+        grpc::ClientContext context;
+        dfs::SetRpcDeadline(context, rpc_timeout_ms_);
+        auto status = stub_->ValidateVersions(&context, request, &response);
+        if (!status.ok() || response.valid_size() != (int)(end - i)) {
+            // Left unvalidated: getattr revalidates files one by one.
+            std::cerr << "[CACHE] cannot validate cached files: " << status.error_message() << std::endl;
+            return;
+        }
+        for (size_t j = i; j < end; j++) {
+            disk_cache_->Validate(files[j].first, files[j].second, response.valid(j - i));
+            kept += response.valid(j - i);
+        }
+    }
+    if (!files.empty())
+        std::cerr << "[CACHE] " << kept << " of " << files.size() << " cached files still current" << std::endl;
+}
+
+// The knobs that are safe to change while mounted.
+static void ApplyRuntimeConfig(const dfs::Config &config) {
+    rpc_timeout_ms_ = config.GetInt("client.rpc_timeout_ms", 0);
+    read_timeout_ms_ = config.GetInt("client.read_timeout_ms", 0);
+    write_timeout_ms_ = config.GetInt("client.write_timeout_ms", 0);
+    metadata_timeout_ms_ = config.GetInt("client.metadata_timeout_ms", 0);
+    hedge_percentile_ = config.GetInt("client.hedge_percentile", 95);
+    hedge_min_delay_ms_ = config.GetInt("client.hedge_min_delay_ms", 2);
+    direct_io_ = config.GetBool("client.direct_io", false);
+    direct_io_min_bytes_ = config.GetInt("client.direct_io_min_bytes", 0);
+}
+
+// Opens the channels and the shared-memory ring. gRPC is not fork-safe, so
+// this waits for init, after fuse_main has daemonized.
+static void Connect(const dfs::Config &config) {
+    std::string target = dfs::ResolveClientTarget(config, config.GetString("client.server_address", "localhost:50051"));
+    auto channels = dfs::CreateDfsChannels(target, dfs::LoadTransportOptions(config),
+                                           config.GetInt("client.channels", 4));
+    channel_ = channels[0];
+    stub_ = DFS::NewStub(channel_);
+    if (channels.size() > 1) channel_pool_.reset(new ChannelPool(channels));
+    if (target.rfind("unix:", 0) == 0)
+        shm_ring_ = ShmRing::Create(stub_.get(), config.GetInt("client.shm_ring_bytes", 64 << 20),
+                                    config.GetInt("client.shm_slot_bytes", 1 << 20));
+}
+
+// Asks for big requests and splice in both directions where the kernel
+// supports them. (Large writes need no flag in FUSE 3.)
+//
+// Page cache use is decided per open from server versions rather than by
+// kernel_cache (never drop) or auto_cache (drop on mtime change, one
+// second granularity), so both stay off. With AUTO_INVAL_DATA the kernel
+// revalidates attributes of open files once they expire, and the getattr
+// that sees a new version invalidates the stale pages.
+static void *dfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg) {
+    const dfs::Config &config = *(const dfs::Config *)fuse_get_context()->private_data;
+    Connect(config);
+
+    conn->max_write = max_write_;
+    conn->max_read = max_read_;
+    conn->max_readahead = std::min<size_t>(conn->max_readahead, max_read_);
+    conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE |
+                                   FUSE_CAP_PARALLEL_DIROPS);
+    if (writeback_cache_) conn->want |= conn->capable & FUSE_CAP_WRITEBACK_CACHE;
+
+    cfg->kernel_cache = 0;
+    cfg->auto_cache = 0;
+    cfg->attr_timeout = attr_timeout_s_;
+    cfg->entry_timeout = attr_timeout_s_;
+    if (kernel_cache_enabled_) {
+        conn->want |= conn->capable & FUSE_CAP_AUTO_INVAL_DATA;
+        struct fuse *fuse = fuse_get_context()->fuse;
+        kernel_cache_.reset(new KernelCache([fuse](const std::string &path) {
+            int result = fuse_invalidate_path(fuse, path.c_str());
+            if (result < 0 && result != -ENOENT)
+                std::cerr << "[CACHE] cannot invalidate " << path << ": " << strerror(-result) << std::endl;
+        }));
+    }
+    if (disk_cache_) ValidateDiskCache();
+    if (offline_) reintegrator_ = std::thread(Reintegrator);
+    if (watch_) watcher_ = std::thread(Watcher);
+    reloader_.reset(new dfs::ConfigReloader(config));
+    reloader_->OnReload(ApplyRuntimeConfig);
+    reloader_->Start(config.GetInt("config.reload_interval_ms", 2000));
+    return nullptr;
+}
+
+static void dfs_destroy(void *) {
+    reloader_.reset();
+    if (watcher_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(watcher_mutex_);
+            watcher_stop_ = true;
+            if (watch_context_) watch_context_->TryCancel();
+        }
+        watcher_wake_.notify_all();
+        watcher_.join();
+    }
+    if (reintegrator_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(reintegrator_mutex_);
+            reintegrator_stop_ = true;
+        }
+        reintegrator_wake_.notify_all();
+        reintegrator_.join();
+    }
+    kernel_cache_.reset();
+    std::string error;
+    if (predictor_ && !prefetch_model_.empty() && !predictor_->Save(prefetch_model_, &error))
+        std::cerr << "[PREFETCH] " << error << std::endl;
+}
 
+static struct fuse_operations dfs_ops = {};
 
 int main(int argc, char *argv[]) {
-    stub_ = DFS::NewStub(grpc::CreateChannel("localhost:50051", grpc::InsecureChannelCredentials()));
+    dfs::Config config;
+    std::vector<char *> fuse_args;
+    std::string error;
+    if (!config.ParseCommandLine(argc, argv, &fuse_args, &error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    ApplyRuntimeConfig(config);
+
+    read_split_bytes_ = config.GetInt("client.read_split_bytes", 256 << 10);
+    write_window_ = std::max<int64_t>(config.GetInt("client.write_window", 8), 1);
+    write_retry_.max_attempts = std::max<int64_t>(config.GetInt("client.write_attempts", 5), 1);
+    write_retry_.initial_backoff_ms = config.GetInt("client.retry_backoff_ms", 50);
+    write_retry_.max_backoff_ms = config.GetInt("client.retry_max_backoff_ms", 2000);
+
+    std::string cache_dir = config.GetString("client.cache_dir", "");
+    if (!cache_dir.empty()) {
+        disk_cache_ = DiskCache::Open(cache_dir, config.GetInt("client.cache_bytes", 1LL << 30),
+                                      config.GetInt("client.cache_block_bytes", 128 << 10), &error);
+        if (!disk_cache_) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+    }
+    if (config.GetBool("client.offline", false)) {
+        std::string journal = config.GetString("client.offline_journal", "");
+        if (journal.empty() && !cache_dir.empty()) journal = cache_dir + "/reintegration.log";
+        if (journal.empty()) {
+            std::cerr << "client.offline needs client.offline_journal or client.cache_dir" << std::endl;
+            return 1;
+        }
+        offline_ = OfflineLog::Open(journal, config.GetBool("client.offline_sync", false), &error);
+        if (!offline_) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        offline_probe_ms_ = std::max<int64_t>(config.GetInt("client.offline_probe_ms", 2000), 10);
+    }
+    // The kernel only honours max_read if it is also a mount option.
+    max_read_ = config.GetInt("client.max_read", 1 << 20);
+    max_write_ = config.GetInt("client.max_write", 1 << 20);
+    std::string max_read_option = "max_read=" + std::to_string(max_read_);
+    fuse_args.push_back((char *)"-o");
+    fuse_args.push_back(&max_read_option[0]);
+
+    if (config.GetBool("client.prefetch_predict", false)) {
+        predictor_.reset(new AccessPredictor(config.GetInt("client.prefetch_max_files", 100000),
+                                             config.GetInt("client.prefetch_min_count", 2)));
+        prefetch_model_ = config.GetString("client.prefetch_model", "");
+        if (!prefetch_model_.empty() && !predictor_->Load(prefetch_model_, &error))
+            std::cerr << "[PREFETCH] " << error << std::endl;
+    }
+    prefetch_depth_ = config.GetInt("client.prefetch_depth", 2);
+    prefetch_bytes_ = config.GetInt("client.prefetch_bytes", 0);
+
+    watch_ = config.GetBool("client.watch", false);
+    kernel_cache_enabled_ = config.GetBool("client.kernel_cache", true);
+    writeback_cache_ = config.GetBool("client.writeback_cache", false);
+    attr_timeout_s_ = config.GetInt("client.attr_timeout_ms", 1000) / 1000.0;
+
+    dfs_ops.init = dfs_init;
+    dfs_ops.destroy = dfs_destroy;
     dfs_ops.getattr = dfs_getattr;
-    dfs_ops.read = dfs_read;
-    dfs_ops.write = dfs_write;
+    dfs_ops.read_buf = dfs_read_buf;
+    dfs_ops.write_buf = dfs_write_buf;
     dfs_ops.create = dfs_create;
+    dfs_ops.open = dfs_open;
+    dfs_ops.flush = dfs_flush;
+    dfs_ops.fsync = dfs_fsync;
+    dfs_ops.release = dfs_release;
     dfs_ops.unlink = dfs_unlink;
-    return fuse_main(argc, argv, &dfs_ops, nullptr);
+    dfs_ops.setxattr = dfs_setxattr;
+    int ret = fuse_main((int)fuse_args.size(), fuse_args.data(), &dfs_ops, &config);
+    shm_ring_.reset();
+    channel_pool_.reset();
+    disk_cache_.reset();
+    return ret;
 }
\ No newline at end of file
@@ -0,0 +1,91 @@
+#include "kernel_cache.h"
+
+KernelCache::KernelCache(std::function<void(const std::string &)> invalidate)
+    : invalidate_(std::move(invalidate)), worker_(&KernelCache::Run, this)
+{
+}
+
+KernelCache::~KernelCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    worker_.join();
+}
+
+bool KernelCache::Observe(const std::string &path, int64_t version)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = versions_.find(path);
+    if (it != versions_.end() && it->second == version && version != 0)
+        return true;
+
+    if (it != versions_.end())
+        Queue(path);
+    if (version == 0)
+    {
+        if (it != versions_.end())
+            versions_.erase(it);
+    }
+    else
+    {
+        versions_[path] = version;
+    }
+    return false;
+}
+
+void KernelCache::Wrote(const std::string &path, int64_t previous, int64_t version)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = versions_.find(path);
+    if (it == versions_.end())
+        return;
+    if (it->second == previous && version != 0)
+    {
+        it->second = version;
+        return;
+    }
+    // Someone else wrote in between.
+    Queue(path);
+    versions_.erase(it);
+}
+
+void KernelCache::Forget(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    versions_.erase(path);
+}
+
+void KernelCache::Changed(const std::string &path, int64_t version)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = versions_.find(path);
+    if (it == versions_.end() || (it->second == version && version != 0))
+        return; // untracked, or our own write
+    Queue(path);
+    versions_.erase(it);
+}
+
+void KernelCache::Queue(const std::string &path)
+{
+    pending_.push_back(path);
+    wake_.notify_one();
+}
+
+void KernelCache::Run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        wake_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+        if (stop_)
+            return;
+        std::string path = std::move(pending_.front());
+        pending_.pop_front();
+        lock.unlock();
+        invalidate_(path);
+        lock.lock();
+    }
+}
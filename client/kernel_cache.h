@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// Tracks which server version of each file the kernel page cache holds, so
+// open can keep the cached pages (fuse_file_info::keep_cache) exactly when
+// they are still current. A version change seen by getattr invalidates the
+// pages of files that are already open.
+//
+// Invalidation runs on a worker thread: the kernel may wait on locks held
+// by the request that reported the change, so notifying from the request
+// thread can deadlock.
+class KernelCache
+{
+public:
+    // `invalidate` is called on the worker thread with the FUSE path.
+    explicit KernelCache(std::function<void(const std::string &)> invalidate);
+    ~KernelCache();
+
+    // Records the server's version of `path` (0 = unknown, never cached).
+    // Returns true if the kernel's pages are from this version.
+    bool Observe(const std::string &path, int64_t version);
+    // Our own write moved the file from `previous` to `version`; the
+    // kernel already has the written data, so its pages stay valid.
+    void Wrote(const std::string &path, int64_t previous, int64_t version);
+    void Forget(const std::string &path);
+    // Another client changed `path` to `version` (0 = removed). Unlike
+    // Observe(), files the kernel holds no pages of stay untracked.
+    void Changed(const std::string &path, int64_t version);
+
+private:
+    // Requires mutex_ held.
+    void Queue(const std::string &path);
+    void Run();
+
+    std::function<void(const std::string &)> invalidate_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+    std::unordered_map<std::string, int64_t> versions_;
+    std::deque<std::string> pending_;
+    std::thread worker_;
+};
@@ -0,0 +1,399 @@
+#include "offline_log.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <set>
+
+#include "retry_policy.h"
+
+// Journal record, followed by the path and (for 'W') the data. The
+// checksum covers everything after it. Replay markers ('A' applied, 'C'
+// conflict) have no data and keep the version left in base_version.
+struct JournalRecordHeader
+{
+    uint64_t checksum;
+    char type;
+    int64_t offset;
+    int64_t time_ns;
+    uint64_t request_id;
+    int64_t base_version;
+    uint32_t path_len;
+    uint32_t length;
+} __attribute__((packed));
+
+// Remembered online sizes; files beyond this are not answered offline.
+static const size_t kMaxRemembered = 1 << 20;
+
+static uint64_t Fnv1a(const char *data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static ssize_t PreadAll(int fd, char *buf, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = pread(fd, buf + done, size - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n < 0 ? -errno : done;
+        done += n;
+    }
+    return done;
+}
+
+static int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::unique_ptr<OfflineLog> OfflineLog::Open(const std::string &file, bool sync, std::string *error)
+{
+    int fd = open(file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        *error = "cannot open offline journal " + file + ": " + strerror(errno);
+        return nullptr;
+    }
+    std::unique_ptr<OfflineLog> log(new OfflineLog(fd, sync));
+    if (!log->Load(error))
+        return nullptr;
+    if (!log->entries_.empty())
+    {
+        log->offline_ = true;
+        std::cerr << "[OFFLINE] " << log->entries_.size() << " journaled changes to reintegrate" << std::endl;
+    }
+    return log;
+}
+
+OfflineLog::~OfflineLog()
+{
+    close(fd_);
+}
+
+bool OfflineLog::Load(std::string *error)
+{
+    while (true)
+    {
+        // A short or corrupt record is a torn tail; cut it off below.
+        JournalRecordHeader header;
+        if (PreadAll(fd_, (char *)&header, sizeof(header), end_) != sizeof(header))
+            break;
+        std::string rest(header.path_len + (size_t)header.length, '\0');
+        if (PreadAll(fd_, &rest[0], rest.size(), end_ + sizeof(header)) != (ssize_t)rest.size())
+            break;
+        uint64_t checksum = Fnv1a((const char *)&header + sizeof(header.checksum),
+                                  sizeof(header) - sizeof(header.checksum));
+        if (Fnv1a(rest.data(), rest.size(), checksum) != header.checksum || !strchr("WUAC", header.type))
+            break;
+        off_t at = end_;
+        end_ += sizeof(header) + rest.size();
+        if (header.type == 'A' || header.type == 'C')
+        {
+            Replayed(header.type, rest.substr(0, header.path_len), header.base_version);
+            continue;
+        }
+
+        Entry entry{header.type, rest.substr(0, header.path_len), header.offset, header.length, header.time_ns,
+                    header.request_id, header.base_version, (off_t)(at + sizeof(header) + header.path_len)};
+        entries_.push_back(std::move(entry));
+        Apply(entries_.size() - 1);
+    }
+    if (ftruncate(fd_, end_) < 0)
+    {
+        *error = std::string("cannot truncate offline journal: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void OfflineLog::SetOffline()
+{
+    if (!offline_.exchange(true))
+        std::cerr << "[OFFLINE] server unreachable; journaling changes until it is back" << std::endl;
+}
+
+void OfflineLog::Remember(const std::string &path, int64_t size, int64_t mtime, int64_t version)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (offline_)
+        return; // a late online reply; the journal's view wins now
+    auto it = attrs_.find(path);
+    if (it == attrs_.end())
+    {
+        if (attrs_.size() >= kMaxRemembered)
+            return;
+        it = attrs_.emplace(path, Attr()).first;
+    }
+    it->second.base_size = it->second.size = size;
+    it->second.mtime = mtime;
+    it->second.version = version;
+}
+
+void OfflineLog::Extend(const std::string &path, int64_t end, int64_t version)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = attrs_.find(path);
+    if (!offline_ && it != attrs_.end())
+    {
+        it->second.base_size = it->second.size = std::max(it->second.size, end);
+        it->second.version = version;
+    }
+}
+
+void OfflineLog::Forget(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!offline_)
+        attrs_.erase(path);
+}
+
+void OfflineLog::Apply(size_t index)
+{
+    const Entry &entry = entries_[index];
+    Attr &attr = attrs_[entry.path];
+    attr.mtime = entry.time_ns / 1000000000;
+    if (entry.type == 'U')
+    {
+        attr.exists = false;
+        attr.base_size = attr.size = 0;
+        attr.version = 0; // a later write creates a new file
+        attr.writes.clear();
+        return;
+    }
+    if (!attr.exists)
+    {
+        attr.exists = true; // recreated after an unlink
+        attr.base_size = attr.size = 0;
+    }
+    attr.writes.push_back(index);
+    attr.size = std::max<int64_t>(attr.size, entry.offset + entry.length);
+}
+
+int OfflineLog::Append(Entry entry, const char *data)
+{
+    off_t at = end_;
+    int result = WriteRecord(entry, data);
+    if (result < 0)
+        return result;
+    entry.data_at = at + sizeof(JournalRecordHeader) + entry.path.size();
+    entries_.push_back(std::move(entry));
+    Apply(entries_.size() - 1);
+    return 0;
+}
+
+int OfflineLog::WriteRecord(const Entry &entry, const char *data)
+{
+    JournalRecordHeader header;
+    header.type = entry.type;
+    header.offset = entry.offset;
+    header.time_ns = entry.time_ns;
+    header.request_id = entry.request_id;
+    header.base_version = entry.base_version;
+    header.path_len = entry.path.size();
+    header.length = entry.length;
+    std::string record((const char *)&header, sizeof(header));
+    record += entry.path;
+    record.append(data, entry.length);
+    uint64_t checksum = Fnv1a(record.data() + sizeof(header.checksum), sizeof(header) - sizeof(header.checksum));
+    header.checksum = Fnv1a(record.data() + sizeof(header), record.size() - sizeof(header), checksum);
+    memcpy(&record[0], &header.checksum, sizeof(header.checksum));
+
+    size_t done = 0;
+    while (done < record.size())
+    {
+        ssize_t n = pwrite(fd_, record.data() + done, record.size() - done, end_ + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            int result = -errno;
+            std::cerr << "[OFFLINE] cannot append to journal: " << strerror(errno) << std::endl;
+            return result;
+        }
+        done += n;
+    }
+    if (sync_ && fdatasync(fd_) < 0)
+        return -errno;
+    end_ += record.size();
+    return 0;
+}
+
+int OfflineLog::MarkReplayed(char outcome, const std::string &path, int64_t version)
+{
+    int result = WriteRecord({outcome, path, 0, 0, 0, 0, version, 0}, "");
+    if (result == 0)
+        Replayed(outcome, path, version);
+    return result;
+}
+
+void OfflineLog::Replayed(char outcome, const std::string &path, int64_t version)
+{
+    // Records of files already in conflict get no marker of their own.
+    while (replayed_count_ < entries_.size() && conflicts_.count(entries_[replayed_count_].path))
+        replayed_count_++;
+    replayed_count_++;
+    if (outcome == 'A')
+        replayed_[path] = version;
+    else
+        conflicts_.insert(path);
+}
+
+int OfflineLog::GetAttr(const std::string &path, int64_t *size, int64_t *mtime)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!offline_)
+        return -EAGAIN;
+    auto it = attrs_.find(path);
+    if (it == attrs_.end() || !it->second.exists)
+        return -ENOENT;
+    *size = it->second.size;
+    *mtime = it->second.mtime;
+    return 0;
+}
+
+ssize_t OfflineLog::Write(const std::string &path, const char *data, size_t size, off_t offset)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!offline_)
+        return -EAGAIN;
+    auto it = attrs_.find(path);
+    int64_t version = it != attrs_.end() && it->second.exists ? it->second.version : 0;
+    int result = Append({'W', path, offset, (uint32_t)size, NowNs(), NewRequestId(), version, 0}, data);
+    return result < 0 ? result : (ssize_t)size;
+}
+
+int OfflineLog::Unlink(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!offline_)
+        return -EAGAIN;
+    auto it = attrs_.find(path);
+    if (it == attrs_.end() || !it->second.exists)
+        return -ENOENT;
+    return Append({'U', path, 0, 0, NowNs(), 0, it->second.version, 0}, "");
+}
+
+ssize_t OfflineLog::Read(const std::string &path, char *buf, size_t size, off_t offset,
+                         const std::function<bool(char *, size_t, off_t)> &base)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!offline_)
+        return -EAGAIN;
+    auto it = attrs_.find(path);
+    if (it == attrs_.end() || !it->second.exists)
+        return -ENOENT;
+    const Attr &attr = it->second;
+    if (offset >= attr.size)
+        return 0;
+    size_t length = std::min<int64_t>(size, attr.size - offset);
+    memset(buf, 0, length);
+
+    int64_t base_end = std::min<int64_t>(offset + length, attr.base_size);
+    if (offset < base_end && !base(buf, base_end - offset, offset))
+    {
+        // Not cached: only readable if journaled writes cover it all.
+        std::vector<std::pair<int64_t, int64_t>> covered;
+        for (size_t index : attr.writes)
+            covered.emplace_back(entries_[index].offset, entries_[index].offset + entries_[index].length);
+        std::sort(covered.begin(), covered.end());
+        int64_t reached = offset;
+        for (const auto &range : covered)
+        {
+            if (range.first > reached)
+                break;
+            reached = std::max(reached, range.second);
+        }
+        if (reached < base_end)
+            return -EIO;
+    }
+
+    for (size_t index : attr.writes)
+    {
+        const Entry &entry = entries_[index];
+        int64_t begin = std::max<int64_t>(offset, entry.offset);
+        int64_t end = std::min<int64_t>(offset + length, entry.offset + entry.length);
+        if (begin >= end)
+            continue;
+        ssize_t n = PreadAll(fd_, buf + (begin - offset), end - begin, entry.data_at + (begin - entry.offset));
+        if (n != end - begin)
+            return -EIO;
+    }
+    return length;
+}
+
+bool OfflineLog::Reintegrate(const std::function<Outcome(const Record &, int64_t *version)> &apply,
+                             std::vector<std::string> *touched)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Resumes after the last record a previous replay got through; later
+    // changes to a file replayed then are checked against the version it
+    // left, not the journaled one.
+    for (size_t index = replayed_count_; index < entries_.size(); index = replayed_count_)
+    {
+        const Entry &entry = entries_[index];
+        if (conflicts_.count(entry.path))
+        {
+            replayed_count_++;
+            continue;
+        }
+        auto it = replayed_.find(entry.path);
+        Record record{entry.type,       entry.path,       entry.offset, std::string(entry.length, '\0'),
+                      entry.time_ns,    entry.request_id, it != replayed_.end() ? it->second : entry.base_version};
+        int64_t version = 0;
+        Outcome outcome;
+        if (PreadAll(fd_, &record.data[0], entry.length, entry.data_at) != (ssize_t)entry.length)
+        {
+            std::cerr << "[OFFLINE] cannot read journaled change to " << entry.path << "; dropped" << std::endl;
+            outcome = Outcome::kConflict;
+        }
+        else
+        {
+            outcome = apply(record, &version);
+            if (outcome == Outcome::kUnreachable)
+                return false; // resumed at this record; its request id keeps that safe
+            if (outcome == Outcome::kConflict)
+                std::cerr << "[OFFLINE] conflict on " << entry.path << ": kept the server's newer version"
+                          << std::endl;
+        }
+        if (MarkReplayed(outcome == Outcome::kApplied ? 'A' : 'C', entry.path, version) < 0)
+            return false; // replays this record again next time
+    }
+
+    if (ftruncate(fd_, 0) < 0)
+    {
+        std::cerr << "[OFFLINE] cannot empty journal: " << strerror(errno) << std::endl;
+        return false;
+    }
+    std::set<std::string> paths;
+    for (const Entry &entry : entries_)
+        paths.insert(entry.path);
+    std::cerr << "[OFFLINE] server back; reintegrated " << entries_.size() << " changes to " << paths.size()
+              << " files (" << conflicts_.size() << " conflicts)" << std::endl;
+    end_ = 0;
+    entries_.clear();
+    replayed_count_ = 0;
+    replayed_.clear();
+    conflicts_.clear();
+    for (const std::string &path : paths)
+    {
+        attrs_.erase(path);
+        touched->push_back(path);
+    }
+    offline_ = false;
+    return true;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Disconnected operation for the FUSE client, after Coda: while the server
+// is unreachable, writes, creates and unlinks are appended to a local
+// reintegration journal and reads are served from the disk cache with the
+// journaled writes laid over it. Once the server answers again the journal
+// is replayed in order and emptied.
+//
+// Journal records carry the server version the file had when the client
+// last saw it online, and a request id. A replayed change applies only if
+// the file is still at that version, or at the one this replay's previous
+// change to it left; a replay cut short and started over does not apply a
+// write twice. A file changed on the server meanwhile keeps the server's
+// contents, and its remaining records are dropped.
+//
+// Replay progress is journaled too: each replayed record is followed by a
+// marker with its outcome and the version it left, and a replay
+// interrupted by an outage or a restart resumes after the last marker
+// rather than from the first record.
+//
+// The journal survives restarts (checksummed records, torn tail cut off on
+// open); a mount that finds records starts offline until they replay.
+// File sizes for getattr come from what was last seen online, so a file
+// never seen before the outage can only be created, not read.
+class OfflineLog
+{
+public:
+    struct Record
+    {
+        char type; // 'W' write, 'U' unlink
+        std::string path;
+        int64_t offset;
+        std::string data;
+        int64_t time_ns;
+        uint64_t request_id;
+        // Server version to apply it against; 0 for a file not seen online,
+        // which falls back to last-writer-wins on time_ns.
+        int64_t base_version;
+    };
+    enum class Outcome
+    {
+        kApplied,
+        kConflict,    // the server's version wins
+        kUnreachable, // stop; stay offline
+    };
+
+    static std::unique_ptr<OfflineLog> Open(const std::string &file, bool sync, std::string *error);
+    ~OfflineLog();
+
+    bool offline() const { return offline_; }
+    void SetOffline();
+
+    // Online view of a file, kept to answer getattr while offline.
+    void Remember(const std::string &path, int64_t size, int64_t mtime, int64_t version);
+    // An online write reached `end`, leaving the file at `version`.
+    void Extend(const std::string &path, int64_t end, int64_t version);
+    void Forget(const std::string &path);
+
+    // Offline operations. Each returns -EAGAIN if the log went back online
+    // meanwhile, and the caller should redo the operation online.
+    int GetAttr(const std::string &path, int64_t *size, int64_t *mtime);
+    ssize_t Write(const std::string &path, const char *data, size_t size, off_t offset);
+    int Unlink(const std::string &path);
+    // `base` fills [offset, offset + size) with the file's contents from
+    // before the outage (the disk cache) and returns false on a miss.
+    ssize_t Read(const std::string &path, char *buf, size_t size, off_t offset,
+                 const std::function<bool(char *, size_t, off_t)> &base);
+
+    // Replays every record not yet replayed through `apply`, in order,
+    // which sets `version` to the file's server version after a change it
+    // applied. If it reports the server unreachable, returns false and
+    // keeps the journal; otherwise empties it, goes online and lists the
+    // replayed paths in `touched`.
+    bool Reintegrate(const std::function<Outcome(const Record &, int64_t *version)> &apply,
+                     std::vector<std::string> *touched);
+
+private:
+    struct Entry
+    {
+        char type;
+        std::string path;
+        int64_t offset;
+        uint32_t length;
+        int64_t time_ns;
+        uint64_t request_id;
+        int64_t base_version;
+        off_t data_at; // in the journal
+    };
+    struct Attr
+    {
+        bool exists = true;
+        int64_t base_size = 0; // online size before the outage
+        int64_t size = 0;
+        int64_t mtime = 0;
+        int64_t version = 0; // server version before the outage; 0 if new
+        std::vector<size_t> writes; // entries_ laid over the base, in order
+    };
+
+    OfflineLog(int fd, bool sync) : fd_(fd), sync_(sync) {}
+
+    bool Load(std::string *error);
+    // Require mutex_ held.
+    int Append(Entry entry, const char *data);
+    int WriteRecord(const Entry &entry, const char *data);
+    void Apply(size_t index);
+    // Journals that the next record replayed, 'A' leaving its file at
+    // `version`, or 'C' dropping the file's remaining records.
+    int MarkReplayed(char outcome, const std::string &path, int64_t version);
+    void Replayed(char outcome, const std::string &path, int64_t version);
+
+    int fd_;
+    bool sync_;
+    off_t end_ = 0;
+    std::atomic<bool> offline_{false};
+    std::mutex mutex_;
+    std::vector<Entry> entries_;
+    std::unordered_map<std::string, Attr> attrs_;
+    // Replay progress: entries_ before `replayed_count_` are done; the
+    // version the last one replayed left each file at, and the files whose
+    // remaining records are dropped.
+    size_t replayed_count_ = 0;
+    std::unordered_map<std::string, int64_t> replayed_;
+    std::set<std::string> conflicts_;
+};
@@ -0,0 +1,39 @@
+#include "retry_policy.h"
+
+#include <algorithm>
+#include <random>
+
+static std::mt19937_64 &Rng()
+{
+    static thread_local std::mt19937_64 rng{std::random_device{}()};
+    return rng;
+}
+
+bool RetryPolicy::Retryable(const grpc::Status &status) const
+{
+    switch (status.error_code())
+    {
+    case grpc::StatusCode::UNAVAILABLE:
+    case grpc::StatusCode::DEADLINE_EXCEEDED:
+    case grpc::StatusCode::RESOURCE_EXHAUSTED:
+    case grpc::StatusCode::ABORTED:
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::chrono::milliseconds RetryPolicy::Backoff(int retry) const
+{
+    int64_t cap = initial_backoff_ms << std::min(retry, 30);
+    cap = std::max<int64_t>(std::min(cap, max_backoff_ms), 1);
+    return std::chrono::milliseconds(std::uniform_int_distribution<int64_t>(0, cap)(Rng()));
+}
+
+uint64_t NewRequestId()
+{
+    uint64_t id = 0;
+    while (id == 0)
+        id = Rng()();
+    return id;
+}
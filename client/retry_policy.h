@@ -0,0 +1,24 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include <grpcpp/grpcpp.h>
+
+// When and how soon to retry an RPC that failed transiently (unavailable
+// server, deadline, overload). Only for calls that are safe to repeat:
+// reads, or writes carrying a request id the server deduplicates.
+struct RetryPolicy
+{
+    int max_attempts = 5; // including the first; 1 disables retries
+    int64_t initial_backoff_ms = 50;
+    int64_t max_backoff_ms = 2000;
+
+    bool Retryable(const grpc::Status &status) const;
+    // Random delay ("full jitter") before retry number `retry` (0-based),
+    // up to initial_backoff_ms doubled per retry and max_backoff_ms.
+    std::chrono::milliseconds Backoff(int retry) const;
+};
+
+// A random nonzero id for WriteRequest.request_id.
+uint64_t NewRequestId();
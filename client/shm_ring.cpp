@@ -0,0 +1,105 @@
+#include "shm_ring.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <grpcpp/grpcpp.h>
+
+std::unique_ptr<ShmRing> ShmRing::Create(dfs::DFS::Stub *stub, int64_t ring_bytes, int64_t slot_bytes)
+{
+    if (ring_bytes <= 0 || slot_bytes <= 0 || ring_bytes < slot_bytes)
+        return nullptr;
+    ring_bytes -= ring_bytes % slot_bytes;
+
+    dfs::AttachSharedMemoryRequest request;
+    request.set_size(ring_bytes);
+    dfs::AttachSharedMemoryResponse response;
+    grpc::ClientContext context;
+    grpc::Status status = stub->AttachSharedMemory(&context, request, &response);
+    if (!status.ok() || !response.success())
+    {
+        std::cerr << "[SHM] server declined shared memory: " << status.error_message() << std::endl;
+        return nullptr;
+    }
+
+    // The server's memory, sealed at ring_bytes; only reachable through
+    // /proc if we may inspect the server process.
+    void *base = MAP_FAILED;
+    int fd = open(response.path().c_str(), O_RDWR | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        base = mmap(nullptr, ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    if (base == MAP_FAILED)
+    {
+        std::cerr << "[SHM] cannot map " << response.path() << ": " << strerror(errno) << std::endl;
+        dfs::DetachSharedMemoryRequest detach;
+        detach.set_channel(response.channel());
+        dfs::DetachSharedMemoryResponse detached;
+        grpc::ClientContext detach_context;
+        stub->DetachSharedMemory(&detach_context, detach, &detached);
+        return nullptr;
+    }
+
+    return std::unique_ptr<ShmRing>(new ShmRing(stub, static_cast<char *>(base), ring_bytes, slot_bytes, response.channel()));
+}
+
+ShmRing::ShmRing(dfs::DFS::Stub *stub, char *base, int64_t ring_bytes, int64_t slot_bytes, uint64_t channel)
+    : stub_(stub), base_(base), ring_bytes_(ring_bytes), slot_bytes_(slot_bytes), channel_(channel),
+      busy_(ring_bytes / slot_bytes, false)
+{
+}
+
+ShmRing::~ShmRing()
+{
+    dfs::DetachSharedMemoryRequest request;
+    request.set_channel(channel_);
+    dfs::DetachSharedMemoryResponse response;
+    grpc::ClientContext context;
+    stub_->DetachSharedMemory(&context, request, &response);
+    munmap(base_, ring_bytes_);
+}
+
+bool ShmRing::Acquire(int64_t size, Slot *slot, bool wait)
+{
+    if (size > slot_bytes_)
+        return false;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    int count = busy_.size();
+    for (;;)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            int index = (next_ + i) % count;
+            if (!busy_[index])
+            {
+                busy_[index] = true;
+                next_ = (index + 1) % count;
+                slot->index = index;
+                slot->offset = index * slot_bytes_;
+                slot->data = base_ + slot->offset;
+                return true;
+            }
+        }
+        if (!wait)
+            return false;
+        slot_freed_.wait(lock);
+    }
+}
+
+void ShmRing::Release(const Slot &slot)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        busy_[slot.index] = false;
+    }
+    slot_freed_.notify_one();
+}
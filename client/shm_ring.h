@@ -0,0 +1,54 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../build/dfs.grpc.pb.h"
+
+// Shared-memory data channel to a co-located server. The mapping is split
+// into fixed-size slots handed out round-robin; a Read or Write borrows one
+// slot for the duration of its RPC so the payload never travels through the
+// socket.
+class ShmRing
+{
+public:
+    struct Slot
+    {
+        char *data = nullptr;
+        int64_t offset = 0;
+        int index = -1;
+    };
+
+    // Has the server create the shared memory and maps it. Returns nullptr
+    // (and logs why) if the server refuses, e.g. over TCP, or its memory
+    // cannot be opened, e.g. as another user.
+    static std::unique_ptr<ShmRing> Create(dfs::DFS::Stub *stub, int64_t ring_bytes, int64_t slot_bytes);
+
+    ~ShmRing();
+
+    uint64_t channel() const { return channel_; }
+    int64_t slot_bytes() const { return slot_bytes_; }
+
+    // Blocks until a slot is free (or, without `wait`, fails if none is).
+    // Returns false if `size` exceeds a slot, in which case the caller
+    // should send the payload inline.
+    bool Acquire(int64_t size, Slot *slot, bool wait = true);
+    void Release(const Slot &slot);
+
+private:
+    ShmRing(dfs::DFS::Stub *stub, char *base, int64_t ring_bytes, int64_t slot_bytes, uint64_t channel);
+
+    dfs::DFS::Stub *stub_;
+    char *base_;
+    int64_t ring_bytes_;
+    int64_t slot_bytes_;
+    uint64_t channel_;
+
+    std::mutex mutex_;
+    std::condition_variable slot_freed_;
+    std::vector<bool> busy_;
+    int next_ = 0;
+};
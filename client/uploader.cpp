@@ -0,0 +1,133 @@
+#include "uploader.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../common/transport.h"
+
+static bool ReadAt(int fd, std::string *buf, size_t size, off_t offset)
+{
+    buf->resize(size);
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = pread(fd, &(*buf)[done], size - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            if (n == 0)
+                errno = EIO; // source shorter than announced
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+bool UploadFile(ChannelPool &pool, int fd, int64_t size, const std::string &remote, const UploadOptions &options,
+                std::string *error)
+{
+    int64_t part_bytes = std::max<int64_t>(options.part_bytes, 1);
+
+    uint64_t id;
+    {
+        dfs::BeginUploadRequest request;
+        request.set_path(remote);
+        dfs::BeginUploadResponse response;
+        grpc::ClientContext context;
+        dfs::SetRpcDeadline(context, options.timeout_ms);
+        grpc::Status status = pool.Next()->BeginUpload(&context, request, &response);
+        if (!status.ok())
+        {
+            *error = "cannot begin upload: " + status.error_message();
+            return false;
+        }
+        id = response.upload_id();
+    }
+
+    // Each worker claims the next part, reads it and sends it.
+    int64_t parts = (size + part_bytes - 1) / part_bytes;
+    std::atomic<int64_t> next{0};
+    std::atomic<bool> failed{false};
+    std::mutex error_mutex;
+    auto fail = [&](const std::string &message) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!failed.exchange(true))
+            *error = message;
+    };
+    auto worker = [&]() {
+        dfs::UploadPartRequest request;
+        request.set_upload_id(id);
+        for (int64_t part; !failed && (part = next++) < parts;)
+        {
+            int64_t offset = part * part_bytes;
+            size_t length = std::min(part_bytes, size - offset);
+            if (!ReadAt(fd, request.mutable_data(), length, offset))
+            {
+                fail(std::string("cannot read source: ") + strerror(errno));
+                return;
+            }
+            request.set_offset(offset);
+            dfs::UploadPartResponse response;
+            grpc::Status status;
+            for (int attempt = 0;; attempt++)
+            {
+                grpc::ClientContext context;
+                dfs::SetRpcDeadline(context, options.timeout_ms);
+                status = pool.Next()->UploadPart(&context, request, &response);
+                if (status.ok() || attempt + 1 >= options.retry.max_attempts || !options.retry.Retryable(status) ||
+                    failed)
+                    break;
+                std::this_thread::sleep_for(options.retry.Backoff(attempt));
+            }
+            if (!status.ok() || response.bytes_written() != (int64_t)length)
+            {
+                fail("part at " + std::to_string(offset) + " failed: " + status.error_message());
+                return;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int64_t i = 0; i < std::min<int64_t>(std::max(options.parallelism, 1), parts); i++)
+        threads.emplace_back(worker);
+    for (std::thread &thread : threads)
+        thread.join();
+
+    grpc::ClientContext context;
+    dfs::SetRpcDeadline(context, options.timeout_ms);
+    if (failed)
+    {
+        dfs::AbortUploadRequest request;
+        request.set_upload_id(id);
+        dfs::AbortUploadResponse response;
+        pool.Next()->AbortUpload(&context, request, &response);
+        return false;
+    }
+
+    dfs::CompleteUploadRequest request;
+    request.set_upload_id(id);
+    request.set_size(size);
+    request.set_mtime(std::time(nullptr));
+    dfs::CompleteUploadResponse response;
+    grpc::Status status = pool.Next()->CompleteUpload(&context, request, &response);
+    if (status.ok())
+        return true;
+    *error = "cannot complete upload: " + status.error_message();
+    // The server keeps an upload whose completion failed; nothing retries it.
+    dfs::AbortUploadRequest abort;
+    abort.set_upload_id(id);
+    dfs::AbortUploadResponse aborted;
+    grpc::ClientContext abort_context;
+    dfs::SetRpcDeadline(abort_context, options.timeout_ms);
+    pool.Next()->AbortUpload(&abort_context, abort, &aborted);
+    return false;
+}
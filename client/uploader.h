@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "channel_pool.h"
+#include "retry_policy.h"
+
+struct UploadOptions
+{
+    int64_t part_bytes = 8 << 20; // client.upload_part_bytes
+    int parallelism = 4;          // client.upload_parallelism: parts in flight
+    int64_t timeout_ms = 0;       // per RPC
+    // Parts failing transiently are sent again (client.write_attempts,
+    // client.retry_backoff_ms, client.retry_max_backoff_ms); rewriting a
+    // part is harmless.
+    RetryPolicy retry;
+};
+
+// Uploads the first `size` bytes of `fd` as `remote`, replacing it, through
+// BeginUpload/UploadPart/CompleteUpload with parts sent concurrently over
+// the pool. Returns false with `error` set; a failed upload is aborted.
+bool UploadFile(ChannelPool &pool, int fd, int64_t size, const std::string &remote, const UploadOptions &options,
+                std::string *error);
@@ -0,0 +1,95 @@
+#include "write_pipeline.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <thread>
+
+#include "../common/transport.h"
+
+bool WritePipeline::Overlaps(int64_t begin, int64_t end) const
+{
+    for (const Pending &pending : pending_)
+    {
+        if (begin < pending.end && pending.begin < end)
+            return true;
+    }
+    return false;
+}
+
+int WritePipeline::Submit(uint64_t writer, dfs::DFS::Stub *stub, std::unique_ptr<dfs::WriteRequest> request,
+                          int64_t timeout_ms, Done done)
+{
+    int64_t begin = request->offset();
+    int64_t length = request->shm_channel() != 0 ? request->shm_length() : (int64_t)request->data().size();
+    int64_t end = begin + std::max<int64_t>(length, 1);
+    if (request->request_id() == 0)
+        request->set_request_id(NewRequestId());
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [&] { return errors_.count(writer) || (pending_.size() < window_ && !Overlaps(begin, end)); });
+    auto failed = errors_.find(writer);
+    if (failed != errors_.end())
+        return failed->second;
+
+    pending_.emplace_back();
+    Iterator it = std::prev(pending_.end());
+    it->writer = writer;
+    it->stub = stub;
+    it->timeout_ms = timeout_ms;
+    it->done = std::move(done);
+    it->request = std::move(request);
+    it->begin = begin;
+    it->end = end;
+    lock.unlock();
+
+    Send(it);
+    return 0;
+}
+
+void WritePipeline::Send(Iterator it)
+{
+    it->attempts++;
+    it->context.reset(new grpc::ClientContext);
+    it->response.Clear();
+    dfs::SetRpcDeadline(*it->context, it->timeout_ms);
+    it->stub->async()->Write(it->context.get(), it->request.get(), &it->response,
+                             [this, it](grpc::Status status) { Complete(it, std::move(status)); });
+}
+
+void WritePipeline::Complete(Iterator it, grpc::Status status)
+{
+    if (!status.ok() && retry_.Retryable(status) && it->attempts < retry_.max_attempts)
+    {
+        std::chrono::milliseconds delay = retry_.Backoff(it->attempts - 1);
+        std::thread([this, it, delay] {
+            std::this_thread::sleep_for(delay);
+            Send(it);
+        }).detach(); // the entry stays pending, so Drain() waits for it
+        return;
+    }
+
+    status = it->done(status, *it->request, it->response);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!status.ok())
+        errors_.emplace(it->writer, -EIO); // keeps the first
+    pending_.erase(it);
+    changed_.notify_all();
+}
+
+void WritePipeline::Drain()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this] { return pending_.empty(); });
+}
+
+int WritePipeline::Flush(uint64_t writer)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this] { return pending_.empty(); });
+    auto failed = errors_.find(writer);
+    if (failed == errors_.end())
+        return 0;
+    int error = failed->second;
+    errors_.erase(failed);
+    return error;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include <grpcpp/grpcpp.h>
+#include "../build/dfs.grpc.pb.h"
+#include "retry_policy.h"
+
+// Keeps up to `window` Write RPCs for one file in flight instead of waiting
+// for each reply, so sequential writes are limited by bandwidth rather than
+// round trips. A write overlapping one still in flight waits for it, so
+// the server applies overlapping writes in order.
+//
+// Transient failures are retried per `retry` (after a backoff, on a
+// thread of their own, so the gRPC callback thread is not held); requests
+// get a request id so a retry is never applied twice. The first failure
+// that remains is kept for the writer (one open file) that submitted it,
+// and returned by that writer's next Submit() and Flush(); that is how
+// write errors reach the flush/fsync/close of the open that wrote.
+class WritePipeline
+{
+public:
+    // Gets the final outcome of a write and returns the one to record: a
+    // callback that dealt with a failure (e.g. journaled the write for
+    // later) returns OK.
+    using Done = std::function<grpc::Status(const grpc::Status &, const dfs::WriteRequest &,
+                                            const dfs::WriteResponse &)>;
+
+    WritePipeline(size_t window, const RetryPolicy &retry) : window_(window), retry_(retry) {}
+    ~WritePipeline() { Drain(); }
+
+    // Sends `request` for `writer` without waiting for the reply; `done`
+    // runs on a gRPC thread with the final outcome. Returns an earlier
+    // write's error for `writer` instead of sending if there is one.
+    int Submit(uint64_t writer, dfs::DFS::Stub *stub, std::unique_ptr<dfs::WriteRequest> request, int64_t timeout_ms,
+               Done done);
+    // Waits for every write in flight.
+    void Drain();
+    // Drain(), then returns and clears `writer`'s first error (0 if none).
+    int Flush(uint64_t writer);
+
+private:
+    struct Pending
+    {
+        uint64_t writer;
+        dfs::DFS::Stub *stub;
+        int64_t timeout_ms;
+        Done done;
+        std::unique_ptr<grpc::ClientContext> context; // one per attempt
+        std::unique_ptr<dfs::WriteRequest> request;
+        dfs::WriteResponse response;
+        int attempts = 0;
+        int64_t begin;
+        int64_t end;
+    };
+    using Iterator = std::list<Pending>::iterator;
+
+    // Requires mutex_ held.
+    bool Overlaps(int64_t begin, int64_t end) const;
+    // Starts the next attempt of `it`.
+    void Send(Iterator it);
+    void Complete(Iterator it, grpc::Status status);
+
+    size_t window_;
+    RetryPolicy retry_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::list<Pending> pending_;
+    std::unordered_map<uint64_t, int> errors_; // by writer; only failed ones
+};
@@ -0,0 +1,242 @@
+#include "config.h"
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace dfs
+{
+
+static std::string Trim(const std::string &s)
+{
+    size_t begin = s.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos)
+        return "";
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return s.substr(begin, end - begin + 1);
+}
+
+bool Config::LoadFile(const std::string &path, std::string *error)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        *error = "cannot open config file " + path;
+        return false;
+    }
+
+    std::string line;
+    int line_no = 0;
+    while (std::getline(file, line))
+    {
+        line_no++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos)
+            line.erase(hash);
+        line = Trim(line);
+        if (line.empty())
+            continue;
+
+        size_t eq = line.find('=');
+        if (eq == std::string::npos)
+        {
+            *error = path + ":" + std::to_string(line_no) + ": expected key = value";
+            return false;
+        }
+        values_[Trim(line.substr(0, eq))] = Trim(line.substr(eq + 1));
+    }
+
+    source_ = path;
+    return true;
+}
+
+bool Config::LoadFromEnvironment(std::string *error)
+{
+    const char *path = std::getenv("DFS_CONFIG");
+    if (path == nullptr || *path == '\0')
+        return true;
+    return LoadFile(path, error);
+}
+
+bool Config::ParseCommandLine(int argc, char **argv, std::vector<char *> *remaining, std::string *error)
+{
+    std::string config_path;
+    std::map<std::string, std::string> overrides;
+
+    remaining->clear();
+    remaining->push_back(argv[0]);
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--config" && i + 1 < argc)
+        {
+            config_path = argv[++i];
+            continue;
+        }
+        if (arg.rfind("--config=", 0) == 0)
+        {
+            config_path = arg.substr(strlen("--config="));
+            continue;
+        }
+
+        // Only dotted keys are ours; "--help", "-o opts" etc. pass through.
+        size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) == 0 && eq != std::string::npos && arg.find('.') < eq)
+        {
+            overrides[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+            continue;
+        }
+        remaining->push_back(argv[i]);
+    }
+
+    bool ok = config_path.empty() ? LoadFromEnvironment(error) : LoadFile(config_path, error);
+    if (!ok)
+        return false;
+
+    overrides_ = overrides;
+    for (const auto &kv : overrides_)
+        values_[kv.first] = kv.second;
+    return true;
+}
+
+bool Config::Reload(Config *fresh, std::string *error) const
+{
+    Config next;
+    if (!source_.empty() && !next.LoadFile(source_, error))
+        return false;
+    next.overrides_ = overrides_;
+    for (const auto &kv : overrides_)
+        next.values_[kv.first] = kv.second;
+    *fresh = next;
+    return true;
+}
+
+bool Config::Has(const std::string &key) const
+{
+    return values_.count(key) != 0;
+}
+
+void Config::Set(const std::string &key, const std::string &value)
+{
+    values_[key] = value;
+}
+
+std::string Config::GetString(const std::string &key, const std::string &fallback) const
+{
+    auto it = values_.find(key);
+    return it == values_.end() ? fallback : it->second;
+}
+
+// Integers accept an optional K/M/G suffix (powers of 1024) so window and
+// message sizes can be written as "16M".
+int64_t Config::GetInt(const std::string &key, int64_t fallback) const
+{
+    auto it = values_.find(key);
+    if (it == values_.end() || it->second.empty())
+        return fallback;
+
+    const std::string &text = it->second;
+    char *end = nullptr;
+    long long value = std::strtoll(text.c_str(), &end, 10);
+    if (end == text.c_str())
+        return fallback;
+
+    switch (*end)
+    {
+    case 'k':
+    case 'K':
+        return value << 10;
+    case 'm':
+    case 'M':
+        return value << 20;
+    case 'g':
+    case 'G':
+        return value << 30;
+    default:
+        return value;
+    }
+}
+
+bool Config::GetBool(const std::string &key, bool fallback) const
+{
+    auto it = values_.find(key);
+    if (it == values_.end())
+        return fallback;
+
+    const std::string &v = it->second;
+    if (v == "1" || v == "true" || v == "yes" || v == "on")
+        return true;
+    if (v == "0" || v == "false" || v == "no" || v == "off")
+        return false;
+    return fallback;
+}
+
+static bool FileMtime(const std::string &path, struct timespec *mtime)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    *mtime = st.st_mtim;
+    return true;
+}
+
+ConfigReloader::~ConfigReloader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    stop_cv_.notify_all();
+    if (thread_.joinable())
+        thread_.join();
+}
+
+void ConfigReloader::OnReload(std::function<void(const Config &)> listener)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    listeners_.push_back(std::move(listener));
+}
+
+void ConfigReloader::Start(int interval_ms)
+{
+    if (config_.source().empty() || interval_ms <= 0)
+        return;
+    thread_ = std::thread([this, interval_ms] { Run(interval_ms); });
+}
+
+void ConfigReloader::Run(int interval_ms)
+{
+    struct timespec last = {};
+    FileMtime(config_.source(), &last);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_cv_.wait_for(lock, std::chrono::milliseconds(interval_ms), [this] { return stopped_; }))
+    {
+        struct timespec now;
+        if (!FileMtime(config_.source(), &now) || (now.tv_sec == last.tv_sec && now.tv_nsec == last.tv_nsec))
+            continue;
+        last = now;
+
+        std::string error;
+        Config fresh;
+        if (!config_.Reload(&fresh, &error))
+        {
+            std::cerr << "[CONFIG] Reload failed, keeping previous values: " << error << std::endl;
+            continue;
+        }
+        config_ = fresh;
+        std::cerr << "[CONFIG] Reloaded " << config_.source() << std::endl;
+
+        std::vector<std::function<void(const Config &)>> listeners = listeners_;
+        lock.unlock();
+        for (auto &listener : listeners)
+            listener(fresh);
+        lock.lock();
+    }
+}
+
+} // namespace dfs
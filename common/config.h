@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dfs
+{
+
+// Flat "key = value" configuration shared by the server and the clients.
+// Keys are dotted ("grpc.max_receive_message_bytes"), '#' starts a comment.
+class Config
+{
+public:
+    bool LoadFile(const std::string &path, std::string *error);
+
+    // Loads the file named by $DFS_CONFIG, if set. Returns false only when
+    // the variable is set and the file cannot be parsed.
+    bool LoadFromEnvironment(std::string *error);
+
+    // Loads the file given by "--config=PATH" (or $DFS_CONFIG), then applies
+    // "--section.key=value" overrides on top. All other arguments are left
+    // in `remaining`, argv[0] first, for the program's own parsing (for
+    // fuse_client that is fuse_main).
+    bool ParseCommandLine(int argc, char **argv, std::vector<char *> *remaining, std::string *error);
+
+    // Re-reads the source file and re-applies the command-line overrides.
+    bool Reload(Config *fresh, std::string *error) const;
+
+    bool Has(const std::string &key) const;
+    void Set(const std::string &key, const std::string &value);
+
+    std::string GetString(const std::string &key, const std::string &fallback) const;
+    int64_t GetInt(const std::string &key, int64_t fallback) const;
+    bool GetBool(const std::string &key, bool fallback) const;
+
+    const std::string &source() const { return source_; }
+
+private:
+    std::map<std::string, std::string> values_;
+    std::map<std::string, std::string> overrides_;
+    std::string source_;
+};
+
+// Watches the config file and, when its mtime changes, reloads it and hands
+// the new snapshot to the listeners. Listeners should only pick up knobs
+// that are safe to change in a running process; the rest (addresses,
+// storage root, thread pools) need a restart.
+class ConfigReloader
+{
+public:
+    explicit ConfigReloader(const Config &config) : config_(config) {}
+    ~ConfigReloader();
+
+    void OnReload(std::function<void(const Config &)> listener);
+
+    // No-op when the config did not come from a file or interval_ms <= 0.
+    void Start(int interval_ms);
+
+private:
+    void Run(int interval_ms);
+
+    Config config_;
+    std::vector<std::function<void(const Config &)>> listeners_;
+    std::mutex mutex_;
+    std::condition_variable stop_cv_;
+    bool stopped_ = false;
+    std::thread thread_;
+};
+
+} // namespace dfs
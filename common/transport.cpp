@@ -0,0 +1,117 @@
+#include "transport.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <grpcpp/resource_quota.h>
+
+namespace dfs
+{
+
+TransportOptions LoadTransportOptions(const Config &config)
+{
+    TransportOptions o;
+    o.max_receive_message_bytes = config.GetInt("grpc.max_receive_message_bytes", o.max_receive_message_bytes);
+    o.max_send_message_bytes = config.GetInt("grpc.max_send_message_bytes", o.max_send_message_bytes);
+    o.initial_stream_window_bytes = config.GetInt("grpc.initial_stream_window_bytes", o.initial_stream_window_bytes);
+    o.bdp_probe = config.GetBool("grpc.bdp_probe", o.bdp_probe);
+    o.max_frame_bytes = config.GetInt("grpc.max_frame_bytes", o.max_frame_bytes);
+    o.write_buffer_bytes = config.GetInt("grpc.write_buffer_bytes", o.write_buffer_bytes);
+    o.keepalive_time_ms = config.GetInt("grpc.keepalive_time_ms", o.keepalive_time_ms);
+    o.keepalive_timeout_ms = config.GetInt("grpc.keepalive_timeout_ms", o.keepalive_timeout_ms);
+    o.keepalive_permit_without_calls = config.GetBool("grpc.keepalive_permit_without_calls", o.keepalive_permit_without_calls);
+    o.max_pings_without_data = config.GetInt("grpc.max_pings_without_data", o.max_pings_without_data);
+    o.resource_quota_bytes = config.GetInt("grpc.resource_quota_bytes", o.resource_quota_bytes);
+    o.max_threads = config.GetInt("grpc.max_threads", o.max_threads);
+    return o;
+}
+
+// Channel args shared by both ends of the connection. `set` is called with
+// (key, int value) so the same list feeds ChannelArguments and ServerBuilder.
+template <typename SetInt>
+static void ForEachHttp2Arg(const TransportOptions &o, SetInt set)
+{
+    if (o.initial_stream_window_bytes > 0)
+        set(GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES, o.initial_stream_window_bytes);
+    set(GRPC_ARG_HTTP2_BDP_PROBE, o.bdp_probe ? 1 : 0);
+    if (o.max_frame_bytes > 0)
+        set(GRPC_ARG_HTTP2_MAX_FRAME_SIZE, o.max_frame_bytes);
+    if (o.write_buffer_bytes > 0)
+        set(GRPC_ARG_HTTP2_WRITE_BUFFER_SIZE, o.write_buffer_bytes);
+    if (o.keepalive_time_ms > 0)
+        set(GRPC_ARG_KEEPALIVE_TIME_MS, o.keepalive_time_ms);
+    if (o.keepalive_timeout_ms > 0)
+        set(GRPC_ARG_KEEPALIVE_TIMEOUT_MS, o.keepalive_timeout_ms);
+    if (o.keepalive_permit_without_calls)
+        set(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+    if (o.max_pings_without_data >= 0)
+        set(GRPC_ARG_HTTP2_MAX_PINGS_WITHOUT_DATA, o.max_pings_without_data);
+}
+
+void ApplyServerTransport(grpc::ServerBuilder &builder, const TransportOptions &o)
+{
+    builder.SetMaxReceiveMessageSize(o.max_receive_message_bytes);
+    builder.SetMaxSendMessageSize(o.max_send_message_bytes);
+
+    ForEachHttp2Arg(o, [&builder](const char *key, int value) { builder.AddChannelArgument(key, value); });
+    // Let clients ping as often as they are configured to, otherwise the
+    // server answers aggressive keepalives with GOAWAY.
+    if (o.keepalive_time_ms > 0)
+        builder.AddChannelArgument(GRPC_ARG_HTTP2_MIN_RECV_PING_INTERVAL_WITHOUT_DATA_MS, o.keepalive_time_ms);
+
+    if (o.resource_quota_bytes > 0 || o.max_threads > 0)
+    {
+        grpc::ResourceQuota quota("dfs_server");
+        if (o.resource_quota_bytes > 0)
+            quota.Resize(o.resource_quota_bytes);
+        if (o.max_threads > 0)
+            quota.SetMaxThreads(o.max_threads);
+        builder.SetResourceQuota(quota);
+    }
+}
+
+grpc::ChannelArguments MakeChannelArguments(const TransportOptions &o)
+{
+    grpc::ChannelArguments args;
+    args.SetMaxReceiveMessageSize(o.max_receive_message_bytes);
+    args.SetMaxSendMessageSize(o.max_send_message_bytes);
+    ForEachHttp2Arg(o, [&args](const char *key, int value) { args.SetInt(key, value); });
+
+    if (o.resource_quota_bytes > 0)
+    {
+        grpc::ResourceQuota quota("dfs_client");
+        quota.Resize(o.resource_quota_bytes);
+        args.SetResourceQuota(quota);
+    }
+    return args;
+}
+
+std::string ResolveClientTarget(const Config &config, const std::string &tcp_target)
+{
+    std::string unix_socket = config.GetString("client.unix_socket", "");
+    return unix_socket.empty() ? tcp_target : "unix:" + unix_socket;
+}
+
+void SetRpcDeadline(grpc::ClientContext &context, int64_t timeout_ms)
+{
+    if (timeout_ms > 0)
+        context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(timeout_ms));
+}
+
+std::shared_ptr<grpc::Channel> CreateDfsChannel(const std::string &target, const TransportOptions &options)
+{
+    return grpc::CreateCustomChannel(target, grpc::InsecureChannelCredentials(), MakeChannelArguments(options));
+}
+
+std::vector<std::shared_ptr<grpc::Channel>> CreateDfsChannels(const std::string &target,
+                                                              const TransportOptions &options, int count)
+{
+    grpc::ChannelArguments args = MakeChannelArguments(options);
+    args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+    std::vector<std::shared_ptr<grpc::Channel>> channels;
+    for (int i = 0; i < std::max(count, 1); i++)
+        channels.push_back(grpc::CreateCustomChannel(target, grpc::InsecureChannelCredentials(), args));
+    return channels;
+}
+
+} // namespace dfs
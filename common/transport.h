@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "config.h"
+
+namespace dfs
+{
+
+// HTTP/2 and gRPC channel tuning. A value of 0 (or -1 for the message
+// caps) leaves the gRPC default in place.
+struct TransportOptions
+{
+    int max_receive_message_bytes = 64 << 20; // gRPC default is 4 MiB
+    int max_send_message_bytes = 64 << 20;
+
+    // Initial per-stream flow-control window (chttp2 "lookahead"). The
+    // connection window is not separately settable in gRPC core; it grows
+    // through BDP probing up to what the resource quota allows.
+    int initial_stream_window_bytes = 0;
+    bool bdp_probe = true;
+    int max_frame_bytes = 0;
+    int write_buffer_bytes = 0;
+
+    int keepalive_time_ms = 0;
+    int keepalive_timeout_ms = 0;
+    bool keepalive_permit_without_calls = false;
+    int max_pings_without_data = -1;
+
+    int64_t resource_quota_bytes = 0;
+    int max_threads = 0;
+};
+
+TransportOptions LoadTransportOptions(const Config &config);
+
+void ApplyServerTransport(grpc::ServerBuilder &builder, const TransportOptions &options);
+
+grpc::ChannelArguments MakeChannelArguments(const TransportOptions &options);
+
+// "unix:<client.unix_socket>" when a local socket is configured, so clients
+// on the server's host bypass TCP; otherwise `tcp_target`.
+std::string ResolveClientTarget(const Config &config, const std::string &tcp_target);
+
+// Bounds a call by `timeout_ms` (client.rpc_timeout_ms); <= 0 means no deadline.
+void SetRpcDeadline(grpc::ClientContext &context, int64_t timeout_ms);
+
+std::shared_ptr<grpc::Channel> CreateDfsChannel(const std::string &target, const TransportOptions &options);
+
+// `count` channels that each open their own connection; gRPC otherwise
+// shares one connection between identically configured channels.
+std::vector<std::shared_ptr<grpc::Channel>> CreateDfsChannels(const std::string &target,
+                                                              const TransportOptions &options, int count);
+
+} // namespace dfs
@@ -0,0 +1,132 @@
+#include "change_journal.h"
+
+#include <fcntl.h>
+
+#include <cstring>
+#include <iostream>
+
+static const int kOffsetBits = 40;
+static const uint64_t kOffsetMask = (1ULL << kOffsetBits) - 1;
+
+static char TypeCode(dfs::WatchEvent::Type type)
+{
+    switch (type)
+    {
+    case dfs::WatchEvent::CREATE:
+        return 'C';
+    case dfs::WatchEvent::UNLINK:
+        return 'U';
+    default:
+        return 'W';
+    }
+}
+
+static dfs::WatchEvent::Type TypeOf(char code)
+{
+    switch (code)
+    {
+    case 'C':
+        return dfs::WatchEvent::CREATE;
+    case 'U':
+        return dfs::WatchEvent::UNLINK;
+    default:
+        return dfs::WatchEvent::WRITE;
+    }
+}
+
+std::unique_ptr<ChangeJournal> ChangeJournal::Open(const std::string &dir, uint64_t segment_bytes, uint64_t max_bytes,
+                                                   bool sync, std::string *error)
+{
+    if (segment_bytes > kOffsetMask)
+    {
+        *error = "server.journal_segment_bytes must be below 1T";
+        return nullptr;
+    }
+    std::unique_ptr<ChangeJournal> journal(new ChangeJournal(max_bytes));
+    if (!journal->log_.Open(AT_FDCWD, dir, segment_bytes, sync, error))
+        return nullptr;
+    // Cuts off a record torn by a crash; older segments are sealed.
+    journal->log_.ScanSegment(journal->log_.active_segment(), [](const SegmentRecord &) {});
+    return journal;
+}
+
+void ChangeJournal::Append(dfs::WatchEvent::Type type, const std::string &path, int64_t version, int64_t size)
+{
+    SegmentLocation location;
+    int result = log_.Append(TypeCode(type), path, size, version, "", 0, &location);
+    if (result < 0)
+    {
+        std::cerr << "[JOURNAL] cannot record change to " << path << ": " << strerror(-result) << std::endl;
+        return;
+    }
+    if (location.offset == location.record_bytes)
+        Trim(); // first record of a new segment
+}
+
+void ChangeJournal::Trim()
+{
+    std::unique_lock<std::shared_mutex> lock(trim_mutex_, std::try_to_lock);
+    if (!lock.owns_lock())
+        return; // a reader is busy; the next rotation retries
+    auto sizes = log_.SegmentSizes();
+    uint64_t total = 0;
+    for (const auto &entry : sizes)
+        total += entry.second;
+    for (const auto &entry : sizes)
+    {
+        if (total <= max_bytes_ || entry.first == log_.active_segment())
+            break;
+        int result = log_.Remove(entry.first);
+        if (result < 0)
+        {
+            std::cerr << "[JOURNAL] cannot remove segment " << entry.first << ": " << strerror(-result) << std::endl;
+            break;
+        }
+        total -= entry.second;
+    }
+}
+
+uint64_t ChangeJournal::Read(uint64_t cursor, size_t max_entries, std::vector<dfs::WatchEvent> *events,
+                             bool *truncated)
+{
+    std::shared_lock<std::shared_mutex> lock(trim_mutex_);
+    auto sizes = log_.SegmentSizes();
+    uint64_t segment = cursor >> kOffsetBits;
+    uint64_t offset = cursor & kOffsetMask;
+    auto it = sizes.find(segment);
+    *truncated = cursor != 0 && (it == sizes.end() || offset > it->second);
+    if (cursor == 0 || *truncated)
+    {
+        segment = sizes.begin()->first;
+        offset = 0;
+    }
+
+    while (true)
+    {
+        log_.ScanFrom(segment, &offset, [&](const SegmentRecord &record) {
+            if (events->size() >= max_entries)
+                return false;
+            dfs::WatchEvent event;
+            event.set_type(TypeOf(record.type));
+            event.set_path(record.path);
+            event.set_version(record.mtime);
+            event.set_size(record.file_offset);
+            events->push_back(std::move(event));
+            return true;
+        });
+        // Short of a sealed segment's end only at a corrupt record; the
+        // rest of that segment is skipped.
+        auto next = sizes.upper_bound(segment);
+        if (events->size() >= max_entries || next == sizes.end())
+            break;
+        segment = next->first;
+        offset = 0;
+    }
+    return segment << kOffsetBits | offset;
+}
+
+uint64_t ChangeJournal::End()
+{
+    auto sizes = log_.SegmentSizes();
+    return sizes.rbegin()->first << kOffsetBits | sizes.rbegin()->second;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "../build/dfs.pb.h"
+#include "segment_log.h"
+
+// Durable record of every change made through the server (server.journal_dir),
+// for consumers that must catch up after downtime, such as incremental
+// backup. Unlike the Watch ring it survives restarts: records go to a
+// SegmentLog, and the oldest sealed segments are removed once the journal
+// exceeds `max_bytes`.
+//
+// Positions are cursors: the segment number in the high 24 bits and the
+// byte offset of the next record in the low 40. Cursor 0 is the oldest
+// record still kept.
+class ChangeJournal
+{
+public:
+    static std::unique_ptr<ChangeJournal> Open(const std::string &dir, uint64_t segment_bytes, uint64_t max_bytes,
+                                               bool sync, std::string *error);
+
+    // `path` is the normalized key; `version` is 0 for UNLINK.
+    void Append(dfs::WatchEvent::Type type, const std::string &path, int64_t version, int64_t size);
+
+    // Appends up to `max_entries` changes after `cursor` to `events` and
+    // returns the cursor after them. `truncated` is set if changes after
+    // `cursor` were already removed (or the cursor is from another
+    // journal); reading then restarts at the oldest record kept.
+    uint64_t Read(uint64_t cursor, size_t max_entries, std::vector<dfs::WatchEvent> *events, bool *truncated);
+    // Cursor after the newest record.
+    uint64_t End();
+
+    void SetMaxBytes(uint64_t max_bytes) { max_bytes_ = max_bytes; }
+
+private:
+    ChangeJournal(uint64_t max_bytes) : max_bytes_(max_bytes) {}
+
+    // Removes the oldest sealed segments beyond max_bytes_ unless a reader
+    // is in them.
+    void Trim();
+
+    SegmentLog log_;
+    std::atomic<uint64_t> max_bytes_;
+    // Readers hold it shared; Trim() only removes segments when exclusive.
+    std::shared_mutex trim_mutex_;
+};
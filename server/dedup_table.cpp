@@ -0,0 +1,58 @@
+#include "dedup_table.h"
+
+bool DedupTable::Begin(uint64_t id, dfs::WriteResponse *response)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    Expire();
+    while (true)
+    {
+        auto it = entries_.find(id);
+        if (it == entries_.end())
+        {
+            entries_[id]; // claimed, running
+            return false;
+        }
+        if (it->second.done)
+        {
+            *response = it->second.response;
+            return true;
+        }
+        finished_.wait(lock);
+    }
+}
+
+void DedupTable::Finish(uint64_t id, const dfs::WriteResponse &response)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry &entry = entries_[id];
+    entry.done = true;
+    entry.response = response;
+    order_.emplace_back(Clock::now(), id);
+    Expire();
+    finished_.notify_all();
+}
+
+void DedupTable::Abandon(uint64_t id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.erase(id);
+    finished_.notify_all();
+}
+
+void DedupTable::SetLimits(size_t max_entries, int64_t ttl_ms)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_entries_ = max_entries;
+    ttl_ms_ = ttl_ms;
+    Expire();
+}
+
+void DedupTable::Expire()
+{
+    Clock::time_point cutoff = Clock::now() - std::chrono::milliseconds(ttl_ms_);
+    while (!order_.empty() && (order_.size() > max_entries_ || order_.front().first < cutoff))
+    {
+        entries_.erase(order_.front().second);
+        order_.pop_front();
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include "../build/dfs.pb.h"
+
+// Remembers the replies to recent writes by request id, so a client that
+// retries a write whose reply it lost gets the original reply instead of
+// the write being applied twice. Completed entries expire after `ttl_ms`
+// and the oldest are dropped beyond `max_entries`; a retry arriving after
+// that is applied again, which is harmless unless someone else wrote the
+// same range in between.
+class DedupTable
+{
+public:
+    DedupTable(size_t max_entries, int64_t ttl_ms) : max_entries_(max_entries), ttl_ms_(ttl_ms) {}
+
+    // Returns true with `response` filled if `id` already completed.
+    // Otherwise the caller now owns `id` and must call Finish() or
+    // Abandon(). A retry racing the original waits for it here.
+    bool Begin(uint64_t id, dfs::WriteResponse *response);
+    void Finish(uint64_t id, const dfs::WriteResponse &response);
+    // The write failed; a retry may try again.
+    void Abandon(uint64_t id);
+
+    void SetLimits(size_t max_entries, int64_t ttl_ms);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry
+    {
+        bool done = false;
+        dfs::WriteResponse response;
+    };
+
+    // Requires mutex_ held.
+    void Expire();
+
+    size_t max_entries_;
+    int64_t ttl_ms_;
+    std::mutex mutex_;
+    std::condition_variable finished_;
+    std::unordered_map<uint64_t, Entry> entries_;
+    // Completed ids, oldest first.
+    std::deque<std::pair<Clock::time_point, uint64_t>> order_;
+};
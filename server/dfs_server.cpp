@@ -1,13 +1,28 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <iostream>
-#include <fstream>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <cerrno>
+#include <cstring>
 #include <sys/stat.h>
-#include <unordered_map>
-#include <mutex>
+#include <unistd.h>
+#include <vector>
 
 #include <grpcpp/grpcpp.h>
 #include "../build/dfs.grpc.pb.h"
+#include "../common/transport.h"
+#include "change_journal.h"
+#include "dedup_table.h"
+#include "event_ring.h"
+#include "handle_table.h"
+#include "metadata_store.h"
+#include "shared_memory.h"
+#include "storage_backend.h"
+#include "upload_manager.h"
 
 using grpc::Server;
 using grpc::ServerBuilder;
@@ -18,132 +33,927 @@ using dfs::DFS;
 using dfs::ReadRequest;
 using dfs::ReadResponse;
 
-std::unordered_map<std::string, time_t> file_versions;
-std::mutex version_mutex;
+// Maps a -errno from the storage layer to a gRPC status.
+static Status ErrnoStatus(int err)
+{
+    switch (-err)
+    {
+    case ENOENT:
+    case ENOTDIR:
+        return Status(grpc::NOT_FOUND, "File not found");
+    case EXDEV:
+    case ELOOP:
+        return Status(grpc::PERMISSION_DENIED, "Path escapes the storage root");
+    case EACCES:
+    case EPERM:
+        return Status(grpc::PERMISSION_DENIED, strerror(-err));
+    case EEXIST:
+        return Status(grpc::ALREADY_EXISTS, strerror(-err));
+    case EISDIR:
+    case EINVAL:
+    case ENAMETOOLONG:
+        return Status(grpc::INVALID_ARGUMENT, strerror(-err));
+    default:
+        return Status(grpc::INTERNAL, strerror(-err));
+    }
+}
 
 class DFSServerImpl final : public DFS::Service
 {
 public:
+    DFSServerImpl(const dfs::Config &config, StorageBackend &storage, MetadataStore &metadata, ChangeJournal *journal)
+        : storage_(storage),
+          metadata_(metadata),
+          journal_(journal),
+          shared_memory_(config.GetInt("server.shm_max_channels", 64),
+                         config.GetInt("server.shm_max_bytes", 256 << 20)),
+          handles_(config.GetInt("server.max_open_handles", 65536),
+                   config.GetInt("server.handle_idle_ms", 600000)),
+          uploads_(config.GetString("server.upload_dir", "/tmp"),
+                   config.GetInt("server.max_uploads", 64),
+                   config.GetInt("server.upload_idle_ms", 600000),
+                   config.GetInt("server.upload_max_bytes", 1LL << 40)),
+          dedup_(config.GetInt("server.dedup_entries", 100000),
+                 config.GetInt("server.dedup_ttl_ms", 300000)),
+          changes_(config.GetInt("server.watch_events", 65536)),
+          prefetch_max_bytes_(config.GetInt("server.prefetch_max_bytes", 64 << 20)),
+          max_read_bytes_(config.GetInt("server.max_read_bytes", 64 << 20)),
+          max_watchers_(config.GetInt("server.max_watchers", 16)),
+          journal_batch_(config.GetInt("server.journal_batch", 1000)),
+          max_batch_ops_(config.GetInt("server.max_batch_ops", 10000))
+    {
+    }
+
+    // Picks up the knobs that are safe to change while serving.
+    void ApplyRuntimeConfig(const dfs::Config &config)
+    {
+        shared_memory_.SetLimits(config.GetInt("server.shm_max_channels", 64),
+                                 config.GetInt("server.shm_max_bytes", 256 << 20));
+        handles_.SetLimits(config.GetInt("server.max_open_handles", 65536),
+                           config.GetInt("server.handle_idle_ms", 600000));
+        uploads_.SetLimits(config.GetInt("server.max_uploads", 64),
+                           config.GetInt("server.upload_idle_ms", 600000),
+                           config.GetInt("server.upload_max_bytes", 1LL << 40));
+        dedup_.SetLimits(config.GetInt("server.dedup_entries", 100000),
+                         config.GetInt("server.dedup_ttl_ms", 300000));
+        prefetch_max_bytes_ = config.GetInt("server.prefetch_max_bytes", 64 << 20);
+        max_read_bytes_ = config.GetInt("server.max_read_bytes", 64 << 20);
+        changes_.SetCapacity(config.GetInt("server.watch_events", 65536));
+        max_watchers_ = config.GetInt("server.max_watchers", 16);
+        journal_batch_ = config.GetInt("server.journal_batch", 1000);
+        max_batch_ops_ = config.GetInt("server.max_batch_ops", 10000);
+        if (journal_)
+            journal_->SetMaxBytes(config.GetInt("server.journal_max_bytes", 1LL << 30));
+        storage_.ApplyRuntimeConfig(config);
+    }
+
+    grpc::Status Open(grpc::ServerContext *context, const dfs::OpenRequest *request, dfs::OpenResponse *response) override
+    {
+        const std::string &mode = request->mode();
+        std::unique_ptr<OpenFile> file(new OpenFile);
+        file->path = request->path();
+        file->writable = mode.find_first_of("wa+") != std::string::npos;
+        if (!NormalizePath(file->path, &file->key))
+            return ErrnoStatus(-EACCES);
+
+        FileAttr attr;
+        int result = storage_.OpenHandle(file->path, file->writable, &file->file);
+        if (result == 0)
+            result = storage_.GetAttr(file->path, &attr);
+        if (result < 0)
+        {
+            response->set_success(false);
+            return ErrnoStatus(result);
+        }
+
+        uint64_t handle = handles_.Insert(std::move(file));
+        if (handle == 0)
+        {
+            response->set_success(false);
+            response->set_message("Too many open handles");
+            return grpc::Status(grpc::RESOURCE_EXHAUSTED, response->message());
+        }
+        response->set_success(true);
+        response->set_handle(handle);
+        response->set_size(attr.size);
+        response->set_mtime(attr.mtime);
+        response->set_version(Generation(request->path()));
+        return grpc::Status::OK;
+    }
+
+    grpc::Status Close(grpc::ServerContext *context, const dfs::CloseRequest *request, dfs::CloseResponse *response) override
+    {
+        response->set_success(handles_.Remove(request->handle()));
+        return grpc::Status::OK;
+    }
+
     Status Read(ServerContext *context, const ReadRequest *request, ReadResponse *response) override
     {
         std::string path = request->path();
         int64_t offset = request->offset();
         int64_t size = request->size();
+        if (offset < 0 || size < 0)
+            return Status(grpc::INVALID_ARGUMENT, "Negative offset or size");
 
-        std::ifstream file(path, std::ios::binary);
-        if (!file)
+        std::shared_ptr<SharedRegion> region;
+        std::string buffer;
+        char *dest;
+        if (request->shm_channel() != 0)
         {
-            std::cerr << "Failed to open file: " << path << std::endl;
-            return Status(grpc::NOT_FOUND, "File not found");
+            region = shared_memory_.Lookup(request->shm_channel());
+            dest = region ? region->Span(request->shm_offset(), size) : nullptr;
+            if (dest == nullptr)
+                return Status(grpc::INVALID_ARGUMENT, "Bad shared memory range");
+        }
+        else
+        {
+            // The reply buffer is allocated up front; refuse before that.
+            if (size > max_read_bytes_)
+                return Status(grpc::INVALID_ARGUMENT, "Read larger than server.max_read_bytes");
+            buffer.resize(size);
+            dest = &buffer[0];
         }
 
-        file.seekg(offset);
-        std::string buffer(size, 0);
-        file.read(&buffer[0], size);
+        std::shared_ptr<OpenFile> file = FindHandle(request->handle(), path);
+        ssize_t n = file ? file->file->Read(dest, size, offset) : storage_.Read(path, dest, size, offset);
+        if (n < 0)
+        {
+            std::cerr << "Failed to read file: " << path << std::endl;
+            return ErrnoStatus(n);
+        }
 
-        response->set_data(buffer);
-        response->set_bytes_read(file.gcount());
+        if (!region)
+        {
+            buffer.resize(n);
+            response->set_data(std::move(buffer));
+        }
+        response->set_bytes_read(n);
 
         return Status::OK;
     }
 
+    // A request id makes a retried write return the first reply rather
+    // than apply again.
     grpc::Status Write(grpc::ServerContext *context, const dfs::WriteRequest *request, dfs::WriteResponse *response) override
     {
-        std::string path = request->path();
-        int64_t offset = request->offset();
-        const std::string &data = request->data();
+        uint64_t id = request->request_id();
+        if (id == 0)
+            return ApplyWrite(request, response);
+        if (dedup_.Begin(id, response))
+            return grpc::Status::OK;
+        grpc::Status status = ApplyWrite(request, response);
+        if (status.ok())
+            dedup_.Finish(id, *response);
+        else
+            dedup_.Abandon(id);
+        return status;
+    }
 
-        // Check current timestamp
-        time_t client_mtime = request->mtime();  // <-- We'll add this field to proto
-        time_t server_mtime = 0;
+    grpc::Status BeginUpload(grpc::ServerContext *context, const dfs::BeginUploadRequest *request, dfs::BeginUploadResponse *response) override
+    {
+        std::string key, error;
+        if (!NormalizePath(request->path(), &key))
+            return ErrnoStatus(-EACCES);
+        uint64_t id = uploads_.Begin(request->path(), key, &error);
+        if (id == 0)
+        {
+            std::cerr << "[UPLOAD] " << error << std::endl;
+            return grpc::Status(grpc::RESOURCE_EXHAUSTED, error);
+        }
+        response->set_upload_id(id);
+        return grpc::Status::OK;
+    }
 
+    grpc::Status UploadPart(grpc::ServerContext *context, const dfs::UploadPartRequest *request, dfs::UploadPartResponse *response) override
+    {
+        const char *data = request->data().data();
+        int64_t length = request->data().size();
+        std::shared_ptr<SharedRegion> region;
+        if (request->shm_channel() != 0)
         {
-            std::lock_guard<std::mutex> lock(version_mutex);
-            if (file_versions.find(path) != file_versions.end()) {
-                server_mtime = file_versions[path];
-            }
+            region = shared_memory_.Lookup(request->shm_channel());
+            data = region ? region->Span(request->shm_offset(), request->shm_length()) : nullptr;
+            if (data == nullptr)
+                return grpc::Status(grpc::INVALID_ARGUMENT, "Bad shared memory range");
+            length = request->shm_length();
         }
 
-        if (client_mtime < server_mtime) {
-            std::cerr << "[REJECTED] Write from older client. Last Writer Wins.\n";
-            return grpc::Status(grpc::FAILED_PRECONDITION, "Outdated file version");
+        ssize_t n = uploads_.WritePart(request->upload_id(), data, length, request->offset());
+        if (n == -ENOENT)
+            return grpc::Status(grpc::NOT_FOUND, "Unknown upload");
+        if (n == -EFBIG)
+            return grpc::Status(grpc::INVALID_ARGUMENT, "Part outside server.upload_max_bytes");
+        if (n < 0)
+            return ErrnoStatus(n);
+        response->set_bytes_written(n);
+        return grpc::Status::OK;
+    }
+
+    // Copies the staged file over the target and records one new version.
+    // An upload that fails to complete is kept, so the client can retry.
+    grpc::Status CompleteUpload(grpc::ServerContext *context, const dfs::CompleteUploadRequest *request, dfs::CompleteUploadResponse *response) override
+    {
+        std::shared_ptr<Upload> upload;
+        int64_t size = request->size();
+        int taken = uploads_.Take(request->upload_id(), size, &upload);
+        if (taken == -ENOENT)
+            return grpc::Status(grpc::NOT_FOUND, "Unknown upload");
+        if (taken < 0)
+            return grpc::Status(grpc::INVALID_ARGUMENT, "Upload is missing parts");
+
+        FileMeta meta;
+        int64_t previous;
+        grpc::Status status = ReplaceFile(upload->path, upload->key, request->mtime(), size,
+                                          [&](char *buf, size_t length, int64_t offset) {
+                                              return PreadFull(upload->fd, buf, length, offset);
+                                          },
+                                          &meta, &previous);
+        if (!status.ok())
+        {
+            uploads_.Restore(request->upload_id(), std::move(upload));
+            return status;
+        }
+        response->set_bytes_written(size);
+        response->set_previous_version(previous);
+        response->set_version(meta.generation);
+        return grpc::Status::OK;
+    }
+
+    grpc::Status PutFiles(grpc::ServerContext *context, const dfs::PutFilesRequest *request, dfs::PutFilesResponse *response) override
+    {
+        for (const dfs::PutFile &file : request->files())
+        {
+            dfs::PutFileResult *result = response->add_results();
+            int64_t version = 0;
+            grpc::Status status = PutWholeFile(file.path(), file.data(), file.mtime(), &version);
+            result->set_code(status.error_code());
+            result->set_error(status.error_message());
+            result->set_version(version);
         }
+        return grpc::Status::OK;
+    }
 
+    grpc::Status AbortUpload(grpc::ServerContext *context, const dfs::AbortUploadRequest *request, dfs::AbortUploadResponse *response) override
+    {
+        response->set_success(uploads_.Abort(request->upload_id()));
+        return grpc::Status::OK;
+    }
+
+    grpc::Status Unlink(grpc::ServerContext *context, const dfs::UnlinkRequest *request, dfs::UnlinkResponse *response) override
+    {
+        grpc::Status status = UnlinkFile(request->path());
+        response->set_success(status.ok());
+        return status;
+    }
+
+    grpc::Status GetAttr(grpc::ServerContext *context, const dfs::GetAttrRequest *request, dfs::GetAttrResponse *response) override
+    {
+        return StatFile(request->path(), response);
+    }
 
-        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
-        if (!file.is_open())
+    grpc::Status Batch(grpc::ServerContext *context, const dfs::BatchRequest *request, dfs::BatchResponse *response) override
+    {
+        if (request->operations_size() > max_batch_ops_)
+            return grpc::Status(grpc::INVALID_ARGUMENT, "More operations than server.max_batch_ops");
+        bool failed = false;
+        for (const dfs::BatchOperation &op : request->operations())
         {
-            // Create if not exists
-            file.open(path, std::ios::out | std::ios::binary);
-            file.close();
-            file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+            dfs::BatchResult *result = response->add_results();
+            grpc::Status status;
+            int64_t version = 0;
+            if (failed && request->stop_on_error())
+                status = grpc::Status(grpc::ABORTED, "Skipped after an earlier failure");
+            else if (op.has_put())
+                status = PutWholeFile(op.put().path(), op.put().data(), op.put().mtime(), &version);
+            else if (op.has_unlink())
+                status = UnlinkFile(op.unlink().path());
+            else if (op.has_get_attr())
+                status = StatFile(op.get_attr().path(), result->mutable_attr());
+            else if (op.has_mkdir())
+                status = MakeDirectory(op.mkdir().path(), op.mkdir().parents());
+            else
+                status = grpc::Status(grpc::INVALID_ARGUMENT, "Empty operation");
+            failed |= !status.ok();
+            result->set_code(status.error_code());
+            result->set_error(status.error_message());
+            result->set_version(version);
         }
+        return grpc::Status::OK;
+    }
 
-        file.seekp(offset);
-        file.write(data.data(), data.size());
-        response->set_bytes_written(data.size());
+    // Lists from the backend's tree, or for backends without one from the
+    // metadata store, which knows the files written through the server.
+    grpc::Status ListDirectory(grpc::ServerContext *context, const dfs::ListDirectoryRequest *request, dfs::ListDirectoryResponse *response) override
+    {
+        const int kMaxEntries = 10000;
+        std::string dir;
+        if (!NormalizePath(request->path(), &dir) && request->path().find_first_not_of("/.") != std::string::npos)
+            return ErrnoStatus(-EACCES);
 
+        std::vector<DirEntry> entries;
+        int result = storage_.List(dir, &entries);
+        if (result == -ENOTSUP)
         {
-            std::lock_guard<std::mutex> lock(version_mutex);
-            file_versions[path] = std::time(nullptr);
-        }    
+            std::vector<std::string> names;
+            result = metadata_.ListDirectory(dir, &names);
+            FileMeta meta;
+            for (const std::string &name : names)
+                entries.push_back({name, metadata_.GetFile(dir.empty() ? name : dir + "/" + name, &meta) < 0});
+        }
+        if (result < 0)
+            return ErrnoStatus(result);
+        std::sort(entries.begin(), entries.end(),
+                  [](const DirEntry &a, const DirEntry &b) { return a.name < b.name; });
 
+        int limit = request->max_entries() > 0 ? std::min(request->max_entries(), kMaxEntries) : kMaxEntries;
+        auto it = std::upper_bound(entries.begin(), entries.end(), request->start_after(),
+                                   [](const std::string &name, const DirEntry &entry) { return name < entry.name; });
+        for (; it != entries.end() && response->entries_size() < limit; ++it)
+        {
+            dfs::ListDirectoryEntry *entry = response->add_entries();
+            entry->set_name(it->name);
+            entry->set_is_dir(it->is_dir);
+            std::string path = dir.empty() ? it->name : dir + "/" + it->name;
+            FileAttr attr;
+            if (!it->is_dir && storage_.GetAttr(path, &attr) == 0)
+            {
+                entry->set_size(attr.size);
+                entry->set_mtime(attr.mtime);
+                entry->set_version(Generation(path));
+            }
+        }
+        response->set_more(it != entries.end());
         return grpc::Status::OK;
     }
 
-    grpc::Status Unlink(grpc::ServerContext *context, const dfs::UnlinkRequest *request, dfs::UnlinkResponse *response) override
+    grpc::Status Prefetch(grpc::ServerContext *context, const dfs::PrefetchRequest *request, dfs::PrefetchResponse *response) override
     {
-        std::string path = request->path();
-        int result = std::remove(path.c_str());
+        int64_t limit = prefetch_max_bytes_;
+        int64_t max_bytes = request->max_bytes() > 0 ? std::min(request->max_bytes(), limit) : limit;
+        int64_t total = 0;
+        for (const auto &path : request->paths())
+        {
+            if (context->IsCancelled())
+                break;
+            ssize_t n = storage_.Prefetch(path, max_bytes);
+            if (n > 0)
+                total += n;
+        }
+        response->set_bytes(total);
+        return grpc::Status::OK;
+    }
 
-        if (result == 0)
+    grpc::Status ValidateVersions(grpc::ServerContext *context, const dfs::ValidateVersionsRequest *request, dfs::ValidateVersionsResponse *response) override
+    {
+        for (const auto &file : request->files())
         {
-            response->set_success(true);
+            int64_t generation = Generation(file.path());
+            response->add_valid(generation != 0 && generation == file.version());
+        }
+        return grpc::Status::OK;
+    }
+
+    // Holds a server thread for as long as the stream is open, hence
+    // server.max_watchers.
+    grpc::Status Watch(grpc::ServerContext *context, const dfs::WatchRequest *request, grpc::ServerWriter<dfs::WatchEvent> *writer) override
+    {
+        std::string prefix;
+        if (!NormalizePath(request->prefix(), &prefix) && request->prefix().find_first_not_of("/.") != std::string::npos)
+            return ErrnoStatus(-EACCES);
+        if (watchers_.fetch_add(1) >= max_watchers_)
+        {
+            watchers_--;
+            return grpc::Status(grpc::RESOURCE_EXHAUSTED, "Too many watchers");
+        }
+
+        // Resuming from another run's sequence: everything since is unknown.
+        bool missed = request->since() != 0 && request->run() != changes_.run();
+        uint64_t after = request->since() != 0 && !missed ? request->since() : changes_.Last();
+        std::vector<dfs::WatchEvent> events;
+        while (!context->IsCancelled())
+        {
+            events.clear();
+            if (missed || !changes_.Wait(&after, prefix, &events, std::chrono::milliseconds(500)))
+            {
+                dfs::WatchEvent overflow;
+                overflow.set_type(dfs::WatchEvent::OVERFLOW);
+                overflow.set_sequence(after);
+                overflow.set_run(changes_.run());
+                events.push_back(overflow);
+                missed = false;
+            }
+            bool written = true;
+            for (size_t i = 0; i < events.size() && written; i++)
+                written = writer->Write(events[i]);
+            if (!written)
+                break; // the watcher went away
+        }
+        watchers_--;
+        return grpc::Status::OK;
+    }
+
+    grpc::Status ReadJournal(grpc::ServerContext *context, const dfs::ReadJournalRequest *request, dfs::ReadJournalResponse *response) override
+    {
+        if (!journal_)
+            return grpc::Status(grpc::FAILED_PRECONDITION, "No change journal (server.journal_dir)");
+        if (request->latest())
+        {
+            response->set_next_cursor(journal_->End());
             return grpc::Status::OK;
         }
-        else
+
+        int64_t batch = std::max<int64_t>(journal_batch_, 1);
+        if (request->max_entries() > 0)
+            batch = std::min<int64_t>(batch, request->max_entries());
+        std::vector<dfs::WatchEvent> events;
+        bool truncated;
+        response->set_next_cursor(journal_->Read(request->cursor(), batch, &events, &truncated));
+        response->set_truncated(truncated);
+        for (dfs::WatchEvent &event : events)
+            *response->add_events() = std::move(event);
+        return grpc::Status::OK;
+    }
+
+    grpc::Status AttachSharedMemory(grpc::ServerContext *context, const dfs::AttachSharedMemoryRequest *request, dfs::AttachSharedMemoryResponse *response) override
+    {
+        // Only clients on the same host (Unix socket peers) can share memory.
+        if (context->peer().rfind("unix:", 0) != 0)
         {
             response->set_success(false);
-            return grpc::Status(grpc::NOT_FOUND, "File not found");
+            response->set_message("Shared memory requires a Unix socket connection");
+            return grpc::Status(grpc::FAILED_PRECONDITION, response->message());
+        }
+
+        std::string path, error;
+        uint64_t channel = shared_memory_.Attach(request->size(), &path, &error);
+        if (channel == 0)
+        {
+            std::cerr << "[SHM] Attach failed: " << error << std::endl;
+            response->set_success(false);
+            response->set_message(error);
+            return grpc::Status(grpc::INVALID_ARGUMENT, error);
         }
+
+        response->set_success(true);
+        response->set_channel(channel);
+        response->set_path(path);
+        return grpc::Status::OK;
     }
 
-    grpc::Status GetAttr(grpc::ServerContext *context, const dfs::GetAttrRequest *request, dfs::GetAttrResponse *response) override
+    grpc::Status DetachSharedMemory(grpc::ServerContext *context, const dfs::DetachSharedMemoryRequest *request, dfs::DetachSharedMemoryResponse *response) override
+    {
+        response->set_success(shared_memory_.Detach(request->channel()));
+        return grpc::Status::OK;
+    }
+
+private:
+    // Write without the request-id bookkeeping.
+    grpc::Status ApplyWrite(const dfs::WriteRequest *request, dfs::WriteResponse *response)
     {
         std::string path = request->path();
-        struct stat statbuf;
+        int64_t offset = request->offset();
+        const char *data = request->data().data();
+        int64_t length = request->data().size();
+        if (offset < 0)
+            return grpc::Status(grpc::INVALID_ARGUMENT, "Negative offset");
 
-        if (stat(path.c_str(), &statbuf) == 0)
+        std::shared_ptr<SharedRegion> region;
+        if (request->shm_channel() != 0)
         {
-            response->set_exists(true);
-            response->set_size(statbuf.st_size);
-            response->set_mtime(statbuf.st_mtime);
-            return grpc::Status::OK;
+            region = shared_memory_.Lookup(request->shm_channel());
+            data = region ? region->Span(request->shm_offset(), request->shm_length()) : nullptr;
+            if (data == nullptr)
+                return grpc::Status(grpc::INVALID_ARGUMENT, "Bad shared memory range");
+            length = request->shm_length();
         }
-        else
+
+        std::shared_ptr<OpenFile> file = FindHandle(request->handle(), path);
+        if (file && !file->writable)
+            file.reset();
+        std::string key;
+        if (file)
+            key = file->key;
+        else if (!NormalizePath(path, &key))
+            return ErrnoStatus(-EACCES);
+
+        // The version check, the write and the new version go together;
+        // concurrent writes to one file would otherwise both pass the check.
+        std::lock_guard<std::mutex> lock(KeyLock(key));
+        FileMeta meta;
+        grpc::Status checked = request->base_version() != 0 ? CheckBaseVersion(key, request->base_version(), &meta)
+                                                             : CheckLastWriter(key, request->mtime(), &meta);
+        if (!checked.ok() && !(file && meta.generation != 0 && meta.generation == file->last_generation))
+            return checked;
+        // Files we have a version of exist; only others need the lookup.
+        FileAttr attr;
+        bool created = !file && meta.generation == 0 && storage_.GetAttr(path, &attr) != 0;
+
+        ssize_t n = file ? file->file->Write(data, length, offset) : storage_.Write(path, data, length, offset);
+        if (n < 0)
+            return ErrnoStatus(n);
+        response->set_bytes_written(n);
+
+        response->set_previous_version(meta.generation);
+        meta.size = std::max<int64_t>(meta.size, offset + n);
+        CommitVersion(key, &meta);
+        if (file)
+            file->last_generation = meta.generation;
+        response->set_version(meta.generation);
+        RecordChange(created ? dfs::WatchEvent::CREATE : dfs::WatchEvent::WRITE, key, meta.generation, meta.size);
+        return grpc::Status::OK;
+    }
+
+    grpc::Status UnlinkFile(const std::string &path)
+    {
+        std::string key;
+        bool named = NormalizePath(path, &key);
+        std::unique_lock<std::mutex> lock;
+        if (named)
+            lock = std::unique_lock<std::mutex>(KeyLock(key));
+        int result = storage_.Unlink(path);
+        if (result < 0)
+            return ErrnoStatus(result);
+        if (named)
+        {
+            handles_.Invalidate(key);
+            metadata_.DeleteFile(key);
+            RecordChange(dfs::WatchEvent::UNLINK, key, 0, 0);
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status StatFile(const std::string &path, dfs::GetAttrResponse *response)
+    {
+        FileAttr attr;
+        if (storage_.GetAttr(path, &attr) != 0)
         {
             response->set_exists(false);
             return grpc::Status(grpc::NOT_FOUND, "File not found");
         }
+        response->set_exists(true);
+        response->set_size(attr.size);
+        response->set_mtime(attr.mtime);
+        response->set_version(Generation(path));
+        return grpc::Status::OK;
+    }
+
+    // With `parents`, as mkdir -p.
+    grpc::Status MakeDirectory(const std::string &path, bool parents)
+    {
+        std::string key;
+        if (!NormalizePath(path, &key))
+            return ErrnoStatus(-EACCES);
+        int result = parents ? MakeAncestors(key) : 0;
+        if (result == 0)
+            result = storage_.MakeDirectory(key);
+        if (result == -EEXIST && parents)
+            result = 0;
+        return result < 0 ? ErrnoStatus(result) : grpc::Status::OK;
+    }
+
+    // Creates whichever directories above `key` do not exist yet.
+    int MakeAncestors(const std::string &key)
+    {
+        for (size_t slash = key.find('/'); slash != std::string::npos; slash = key.find('/', slash + 1))
+        {
+            int result = storage_.MakeDirectory(key.substr(0, slash));
+            if (result < 0 && result != -EEXIST)
+                return result;
+        }
+        return 0;
+    }
+
+    // Replaces the file at `path` with `data` as one new version.
+    grpc::Status PutWholeFile(const std::string &path, const std::string &data, int64_t mtime, int64_t *version)
+    {
+        std::string key;
+        if (!NormalizePath(path, &key))
+            return ErrnoStatus(-EACCES);
+        FileMeta meta;
+        int64_t previous;
+        grpc::Status status = ReplaceFile(path, key, mtime, data.size(),
+                                          [&](char *buf, size_t length, int64_t offset) {
+                                              memcpy(buf, data.data() + offset, length);
+                                              return (ssize_t)length;
+                                          },
+                                          &meta, &previous);
+        if (status.ok())
+            *version = meta.generation;
+        return status;
+    }
+
+    // Replaces the file at `path` with the `size` bytes `source` fills in
+    // at each offset, as one new version, after the last-writer-wins
+    // check. All or nothing: backends can neither truncate nor rename, so
+    // the old contents are copied aside first and put back if storing the
+    // new ones fails part-way. Sets the version replaced in `*previous`.
+    grpc::Status ReplaceFile(const std::string &path, const std::string &key, int64_t mtime, int64_t size,
+                             const std::function<ssize_t(char *, size_t, int64_t)> &source, FileMeta *meta,
+                             int64_t *previous)
+    {
+        std::lock_guard<std::mutex> lock(KeyLock(key));
+        grpc::Status checked = CheckLastWriter(key, mtime, meta);
+        if (!checked.ok())
+            return checked;
+        *previous = meta->generation;
+
+        FileAttr attr;
+        bool existed = storage_.GetAttr(path, &attr) == 0;
+        int backup = -1;
+        if (existed)
+        {
+            backup = uploads_.CreateStagingFile();
+            int result = backup < 0 ? -errno
+                                    : CopyRange(attr.size, [&](char *buf, size_t length, int64_t offset) {
+                                          return storage_.Read(path, buf, length, offset);
+                                      }, [&](const char *buf, size_t length, int64_t offset) {
+                                          return PwriteFull(backup, buf, length, offset);
+                                      });
+            if (result < 0)
+            {
+                if (backup >= 0)
+                    close(backup);
+                std::cerr << "[REPLACE] cannot copy " << path << " aside: " << strerror(-result) << std::endl;
+                return ErrnoStatus(result);
+            }
+        }
+
+        int result = existed && attr.size > size ? storage_.Unlink(path) : 0;
+        if (result == 0 && existed && attr.size > size)
+            handles_.Invalidate(key);
+        if (result == 0)
+            result = CopyRange(size, source, [&](const char *buf, size_t length, int64_t offset) {
+                return WriteCreatingParents(path, key, buf, length, offset);
+            });
+        if (result < 0)
+        {
+            RollBackReplace(path, key, existed ? attr.size : -1, backup);
+            if (backup >= 0)
+                close(backup);
+            return ErrnoStatus(result);
+        }
+        if (backup >= 0)
+            close(backup);
+
+        meta->size = size;
+        CommitVersion(key, meta);
+        RecordChange(existed ? dfs::WatchEvent::WRITE : dfs::WatchEvent::CREATE, key, meta->generation, meta->size);
+        return grpc::Status::OK;
+    }
+
+    // Undoes a replace that failed part-way: puts back the `old_size` bytes
+    // copied to `backup`, or removes the file if there was none (-1).
+    void RollBackReplace(const std::string &path, const std::string &key, int64_t old_size, int backup)
+    {
+        int result = storage_.Unlink(path);
+        if (result == 0)
+            handles_.Invalidate(key);
+        if (result == -ENOENT)
+            result = 0;
+        if (result == 0 && old_size >= 0)
+            result = CopyRange(old_size, [&](char *buf, size_t length, int64_t offset) {
+                return PreadFull(backup, buf, length, offset);
+            }, [&](const char *buf, size_t length, int64_t offset) {
+                return WriteCreatingParents(path, key, buf, length, offset);
+            });
+        if (result == 0)
+            return;
+        // Contents are now neither old nor new: give them a version of
+        // their own so no client keeps trusting a cached copy.
+        std::cerr << "[REPLACE] cannot restore " << path << " after a failed replace: " << strerror(-result)
+                  << std::endl;
+        FileMeta meta;
+        metadata_.GetFile(key, &meta); // generation 0 if it had none
+        FileAttr attr;
+        meta.size = storage_.GetAttr(path, &attr) == 0 ? attr.size : 0;
+        CommitVersion(key, &meta);
+        RecordChange(dfs::WatchEvent::WRITE, key, meta.generation, meta.size);
+    }
+
+    // Moves `size` bytes from `read` to `write` in chunks, at the same
+    // offsets. Returns 0 or -errno (-EIO for a short read or write).
+    static int CopyRange(int64_t size, const std::function<ssize_t(char *, size_t, int64_t)> &read,
+                         const std::function<ssize_t(const char *, size_t, int64_t)> &write)
+    {
+        const size_t kCopyBytes = 4 << 20;
+        std::string buffer(std::min<int64_t>(kCopyBytes, std::max<int64_t>(size, 1)), '\0');
+        int64_t done = 0;
+        do
+        {
+            size_t length = std::min<int64_t>(buffer.size(), size - done);
+            ssize_t n = read(&buffer[0], length, done);
+            if (n == (ssize_t)length)
+                n = write(buffer.data(), length, done);
+            if (n != (ssize_t)length)
+                return n < 0 ? n : -EIO;
+            done += length;
+        } while (done < size);
+        return 0;
+    }
+
+    // Writes as the backend does, but on ENOENT creates the missing parent
+    // directories and tries again, so whole-file stores work into a new
+    // tree as `cp -r` would.
+    ssize_t WriteCreatingParents(const std::string &path, const std::string &key, const char *data, size_t size,
+                                 off_t offset)
+    {
+        ssize_t n = storage_.Write(path, data, size, offset);
+        if (n != -ENOENT)
+            return n;
+        int result = MakeAncestors(key);
+        return result < 0 ? result : storage_.Write(path, data, size, offset);
+    }
+
+    // Loads the file's metadata and rejects writes from a client whose
+    // clock is behind the last writer's (last writer wins).
+    grpc::Status CheckLastWriter(const std::string &key, int64_t client_mtime, FileMeta *meta)
+    {
+        int found = metadata_.GetFile(key, meta);
+        if (found < 0 && found != -ENOENT)
+            return ErrnoStatus(found);
+
+        if (found == 0 && client_mtime < meta->version) {
+            std::cerr << "[REJECTED] Write from older client. Last Writer Wins.\n";
+            return grpc::Status(grpc::FAILED_PRECONDITION, "Outdated file version");
+        }
+        return grpc::Status::OK;
+    }
+
+    // Loads the file's metadata and rejects the write unless the file is
+    // still at the generation the client based it on.
+    grpc::Status CheckBaseVersion(const std::string &key, int64_t base_version, FileMeta *meta)
+    {
+        int found = metadata_.GetFile(key, meta);
+        if (found < 0 && found != -ENOENT)
+            return ErrnoStatus(found);
+        if (found != 0 || meta->generation != base_version)
+        {
+            std::cerr << "[REJECTED] Write based on version " << base_version << " of " << key
+                      << ", which has changed since." << std::endl;
+            return grpc::Status(grpc::FAILED_PRECONDITION, "Outdated file version");
+        }
+        return grpc::Status::OK;
     }
+
+    // Stamps a new version and generation on `meta` and stores it.
+    void CommitVersion(const std::string &key, FileMeta *meta)
+    {
+        meta->version = std::time(nullptr);
+        meta->mtime = meta->version;
+        // Nanosecond clock, but strictly increasing even if it steps back.
+        int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::system_clock::now().time_since_epoch()).count();
+        meta->generation = std::max(meta->generation + 1, now_ns);
+        int result = metadata_.PutFile(key, *meta);
+        if (result < 0)
+            std::cerr << "[METADATA] cannot record version of " << key << ": " << strerror(-result) << std::endl;
+    }
+
+    // The open file for `handle` if it is still open on `path` and still
+    // the file there; a stale or foreign id makes the caller fall back to
+    // the path.
+    std::shared_ptr<OpenFile> FindHandle(uint64_t handle, const std::string &path)
+    {
+        if (handle == 0)
+            return nullptr;
+        std::shared_ptr<OpenFile> file = handles_.Lookup(handle);
+        return file && file->path == path && !file->stale ? file : nullptr;
+    }
+
+    // Tells watchers and, if configured, the durable journal.
+    void RecordChange(dfs::WatchEvent::Type type, const std::string &key, int64_t version, int64_t size)
+    {
+        changes_.Publish(type, key, version, size);
+        if (journal_)
+            journal_->Append(type, key, version, size);
+    }
+
+    // Serializes version-checked changes to one file; keys share stripes.
+    std::mutex &KeyLock(const std::string &key)
+    {
+        return key_locks_[std::hash<std::string>()(key) % kKeyLocks];
+    }
+
+    // Write generation of a file, or 0 if it was never written through us.
+    int64_t Generation(const std::string &path)
+    {
+        std::string key;
+        FileMeta meta;
+        if (!NormalizePath(path, &key) || metadata_.GetFile(key, &meta) < 0)
+            return 0;
+        return meta.generation;
+    }
+
+    StorageBackend &storage_;
+    MetadataStore &metadata_;
+    ChangeJournal *journal_;
+    SharedMemoryRegistry shared_memory_;
+    HandleTable handles_;
+    UploadManager uploads_;
+    DedupTable dedup_;
+    EventRing changes_;
+    static const size_t kKeyLocks = 256;
+    std::mutex key_locks_[kKeyLocks];
+    // Largest prefix of one file a Prefetch may read (server.prefetch_max_bytes)
+    std::atomic<int64_t> prefetch_max_bytes_;
+    // Largest Read answered inline (server.max_read_bytes)
+    std::atomic<int64_t> max_read_bytes_;
+    std::atomic<int64_t> max_watchers_;
+    std::atomic<int64_t> watchers_{0};
+    // Most changes per ReadJournal reply (server.journal_batch)
+    std::atomic<int64_t> journal_batch_;
+    // Most operations in one Batch call (server.max_batch_ops)
+    std::atomic<int64_t> max_batch_ops_;
 };
 
-void RunServer()
+void RunServer(const dfs::Config &config)
 {
-    std::string server_address("0.0.0.0:50051");
-    DFSServerImpl service;
+    std::string server_address = config.GetString("server.address", "0.0.0.0:50051");
+
+    std::string error;
+    std::unique_ptr<StorageBackend> storage = CreateStorageBackend(config, &error);
+    if (!storage)
+    {
+        std::cerr << error << std::endl;
+        return;
+    }
+
+    std::unique_ptr<MetadataStore> metadata = CreateMetadataStore(config, &error);
+    if (!metadata)
+    {
+        std::cerr << error << std::endl;
+        return;
+    }
+
+    std::unique_ptr<ChangeJournal> journal;
+    std::string journal_dir = config.GetString("server.journal_dir", "");
+    if (!journal_dir.empty())
+    {
+        journal = ChangeJournal::Open(journal_dir, config.GetInt("server.journal_segment_bytes", 64 << 20),
+                                      config.GetInt("server.journal_max_bytes", 1LL << 30),
+                                      config.GetBool("server.journal_sync", false), &error);
+        if (!journal)
+        {
+            std::cerr << error << std::endl;
+            return;
+        }
+    }
+
+    DFSServerImpl service(config, *storage, *metadata, journal.get());
+
+    dfs::ConfigReloader reloader(config);
+    reloader.OnReload([&service](const dfs::Config &fresh) { service.ApplyRuntimeConfig(fresh); });
+    reloader.Start(config.GetInt("config.reload_interval_ms", 2000));
 
     ServerBuilder builder;
     builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+
+    // Co-located clients can skip the TCP stack through a Unix socket.
+    std::string unix_socket = config.GetString("server.unix_socket", "");
+    if (!unix_socket.empty())
+    {
+        unlink(unix_socket.c_str());
+        builder.AddListeningPort("unix:" + unix_socket, grpc::InsecureServerCredentials());
+    }
+    dfs::ApplyServerTransport(builder, dfs::LoadTransportOptions(config));
+
+    // Sync server thread pool: completion queues and poller threads per queue.
+    if (config.Has("server.num_cqs"))
+        builder.SetSyncServerOption(ServerBuilder::SyncServerOption::NUM_CQS, config.GetInt("server.num_cqs", 1));
+    if (config.Has("server.min_pollers"))
+        builder.SetSyncServerOption(ServerBuilder::SyncServerOption::MIN_POLLERS, config.GetInt("server.min_pollers", 1));
+    if (config.Has("server.max_pollers"))
+        builder.SetSyncServerOption(ServerBuilder::SyncServerOption::MAX_POLLERS, config.GetInt("server.max_pollers", 2));
     builder.RegisterService(&service);
 
     std::unique_ptr<Server> server(builder.BuildAndStart());
+    if (!server)
+    {
+        std::cerr << "Failed to start DFS Server on " << server_address << std::endl;
+        return;
+    }
     std::cout << "DFS Server listening on " << server_address << std::endl;
+    if (!unix_socket.empty())
+        std::cout << "DFS Server listening on unix:" << unix_socket << std::endl;
     server->Wait();
 }
 
 int main(int argc, char **argv)
 {
-    RunServer();
+    dfs::Config config;
+    std::vector<char *> args;
+    std::string error;
+    if (!config.ParseCommandLine(argc, argv, &args, &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    if (args.size() > 1)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--config=dfs.conf] [--server.address=HOST:PORT] [--key=value ...]" << std::endl;
+        return 1;
+    }
+
+    RunServer(config);
     return 0;
 }
\ No newline at end of file
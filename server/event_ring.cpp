@@ -0,0 +1,72 @@
+#include "event_ring.h"
+
+#include <random>
+
+bool UnderPrefix(const std::string &path, const std::string &prefix)
+{
+    if (prefix.empty())
+        return true;
+    return path.compare(0, prefix.size(), prefix) == 0 && (path.size() == prefix.size() || path[prefix.size()] == '/');
+}
+
+static uint64_t NewRunId()
+{
+    std::random_device device;
+    uint64_t id = 0;
+    while (id == 0)
+        id = ((uint64_t)device() << 32) | device();
+    return id;
+}
+
+EventRing::EventRing(size_t capacity) : run_(NewRunId()), capacity_(std::max<size_t>(capacity, 1)) {}
+
+void EventRing::Publish(dfs::WatchEvent::Type type, const std::string &path, int64_t version, int64_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    events_.emplace_back();
+    dfs::WatchEvent &event = events_.back();
+    event.set_type(type);
+    event.set_path(path);
+    event.set_sequence(++last_);
+    event.set_run(run_);
+    event.set_version(version);
+    event.set_size(size);
+    while (events_.size() > capacity_)
+        events_.pop_front();
+    published_.notify_all();
+}
+
+uint64_t EventRing::Last()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_;
+}
+
+bool EventRing::Wait(uint64_t *after, const std::string &prefix, std::vector<dfs::WatchEvent> *events,
+                     std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (*after <= last_)
+        published_.wait_for(lock, timeout, [&] { return last_ > *after; });
+    if (*after > last_ || *after + events_.size() < last_)
+    {
+        *after = last_;
+        return false;
+    }
+    size_t first = events_.size() - (last_ - *after);
+    for (size_t i = first; i < events_.size(); i++)
+    {
+        if (UnderPrefix(events_[i].path(), prefix))
+            events->push_back(events_[i]);
+    }
+    *after = last_;
+    return true;
+}
+
+void EventRing::SetCapacity(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = std::max<size_t>(capacity, 1);
+    while (events_.size() > capacity_)
+        events_.pop_front();
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../build/dfs.pb.h"
+
+// The last `capacity` changes made through the server, numbered by a
+// sequence that starts at 1 with each server run and tagged with a random
+// id for the run. Watch streams read it
+// from their own position, so a slow watcher never holds up writers; one
+// that falls more than `capacity` events behind is told it missed some.
+class EventRing
+{
+public:
+    explicit EventRing(size_t capacity);
+
+    // Nonzero, and different each server run.
+    uint64_t run() const { return run_; }
+
+    // `path` is the normalized key.
+    void Publish(dfs::WatchEvent::Type type, const std::string &path, int64_t version, int64_t size);
+
+    // Sequence of the newest event, 0 if none yet.
+    uint64_t Last();
+
+    // Waits up to `timeout` for events after `*after` and appends those
+    // under `prefix` to `events`, advancing `*after` past everything
+    // examined. Returns false (with `*after` moved to the newest event) if
+    // some events after `*after` were already dropped, or `*after` is past
+    // the newest event (from an earlier server run).
+    bool Wait(uint64_t *after, const std::string &prefix, std::vector<dfs::WatchEvent> *events,
+              std::chrono::milliseconds timeout);
+
+    void SetCapacity(size_t capacity);
+
+private:
+    const uint64_t run_;
+    std::mutex mutex_;
+    std::condition_variable published_;
+    size_t capacity_;
+    uint64_t last_ = 0;
+    std::deque<dfs::WatchEvent> events_; // sequences last_ - size() + 1 .. last_
+};
+
+// True if `path` is `prefix` or below it ("" matches everything).
+bool UnderPrefix(const std::string &path, const std::string &prefix);
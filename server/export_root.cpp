@@ -0,0 +1,282 @@
+#include "export_root.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+// openat2() arrived in Linux 5.6 and has no glibc wrapper. On older kernels
+// we fall back to walking one component at a time with O_NOFOLLOW, which
+// gives the same confinement for the paths ExportRoot accepts.
+static std::atomic<bool> openat2_supported{true};
+
+static int OpenNoFollowWalk(int dirfd, const std::string &rel, int flags, mode_t mode)
+{
+    int current = dirfd;
+    size_t start = 0;
+    for (;;)
+    {
+        size_t slash = rel.find('/', start);
+        std::string part = rel.substr(start, slash == std::string::npos ? std::string::npos : slash - start);
+        if (slash == std::string::npos)
+        {
+            int fd = openat(current, part.c_str(), flags | O_NOFOLLOW | O_CLOEXEC, mode);
+            int err = errno;
+            if (current != dirfd)
+                close(current);
+            return fd >= 0 ? fd : -err;
+        }
+
+        int next = openat(current, part.c_str(), O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        int err = errno;
+        if (current != dirfd)
+            close(current);
+        if (next < 0)
+            return -err;
+        current = next;
+        start = slash + 1;
+    }
+}
+
+// Opens `rel` beneath `dirfd`. Returns an fd or -errno.
+static int OpenBeneath(int dirfd, const std::string &rel, int flags, mode_t mode)
+{
+    if (openat2_supported)
+    {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = flags | O_CLOEXEC;
+        how.mode = (flags & O_CREAT) ? mode : 0;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+
+        long fd = syscall(SYS_openat2, dirfd, rel.c_str(), &how, sizeof(how));
+        if (fd >= 0)
+            return fd;
+        if (errno != ENOSYS)
+            return -errno;
+        openat2_supported = false;
+    }
+    return OpenNoFollowWalk(dirfd, rel, flags, mode);
+}
+
+ExportRoot::DirFd::~DirFd()
+{
+    close(fd);
+}
+
+ExportRoot::~ExportRoot() = default;
+
+bool ExportRoot::Open(const std::string &root, std::string *error)
+{
+    int fd = open(root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        *error = "cannot open storage root " + root + ": " + strerror(errno);
+        return false;
+    }
+    root_ = std::make_shared<DirFd>(fd);
+    return true;
+}
+
+bool ExportRoot::SplitPath(const std::string &path, std::string *dir, std::string *name)
+{
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (start <= path.size())
+    {
+        size_t slash = path.find('/', start);
+        if (slash == std::string::npos)
+            slash = path.size();
+        std::string part = path.substr(start, slash - start);
+        if (part == "..")
+            return false;
+        if (!part.empty() && part != ".")
+            parts.push_back(part);
+        start = slash + 1;
+    }
+    if (parts.empty())
+        return false;
+
+    *name = parts.back();
+    parts.pop_back();
+    dir->clear();
+    for (const std::string &part : parts)
+    {
+        if (!dir->empty())
+            *dir += '/';
+        *dir += part;
+    }
+    return true;
+}
+
+std::shared_ptr<ExportRoot::DirFd> ExportRoot::LookupDir(const std::string &dir)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = dirs_.find(dir);
+    if (it == dirs_.end())
+        return nullptr;
+    lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+    return it->second.fd;
+}
+
+void ExportRoot::InsertDir(const std::string &dir, std::shared_ptr<DirFd> fd)
+{
+    if (capacity_ == 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (dirs_.count(dir))
+        return;
+    lru_.push_front(dir);
+    dirs_[dir] = {std::move(fd), lru_.begin()};
+    while (dirs_.size() > capacity_)
+    {
+        // In-flight users keep their shared_ptr; the fd closes when they finish.
+        dirs_.erase(lru_.back());
+        lru_.pop_back();
+    }
+}
+
+int ExportRoot::List(const std::string &dir, std::vector<DirEntry> *entries)
+{
+    std::string relative;
+    NormalizePath(dir, &relative);
+    int fd = relative.empty() ? OpenBeneath(root_->fd, ".", O_RDONLY | O_DIRECTORY, 0)
+                              : OpenFile(relative, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return fd;
+    DIR *d = fdopendir(fd);
+    if (d == nullptr)
+    {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+    entries->clear();
+    while (struct dirent *entry = readdir(d))
+    {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+        unsigned char type = entry->d_type;
+        struct stat st;
+        if (type == DT_UNKNOWN && fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        // Symlinks and special files are not served, so not listed either.
+        if (type == DT_DIR || type == DT_REG)
+            entries->push_back({name, type == DT_DIR});
+    }
+    closedir(d);
+    return 0;
+}
+
+void ExportRoot::Invalidate(const std::string &dir)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = dirs_.begin(); it != dirs_.end();)
+    {
+        const std::string &key = it->first;
+        if (key == dir || (key.size() > dir.size() && key.compare(0, dir.size(), dir) == 0 && key[dir.size()] == '/'))
+        {
+            lru_.erase(it->second.lru_pos);
+            it = dirs_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+std::shared_ptr<ExportRoot::DirFd> ExportRoot::ResolveParent(const std::string &path, std::string *name, int *err)
+{
+    std::string dir;
+    if (!SplitPath(path, &dir, name))
+    {
+        *err = -EACCES;
+        return nullptr;
+    }
+    if (dir.empty())
+        return root_;
+
+    std::shared_ptr<DirFd> cached = LookupDir(dir);
+    if (cached)
+        return cached;
+
+    // Start from the deepest cached ancestor and only walk the rest.
+    std::shared_ptr<DirFd> base = root_;
+    std::string rest = dir;
+    for (size_t slash = dir.rfind('/'); slash != std::string::npos && slash > 0; slash = dir.rfind('/', slash - 1))
+    {
+        std::shared_ptr<DirFd> ancestor = LookupDir(dir.substr(0, slash));
+        if (ancestor)
+        {
+            base = ancestor;
+            rest = dir.substr(slash + 1);
+            break;
+        }
+    }
+
+    int fd = OpenBeneath(base->fd, rest, O_PATH | O_DIRECTORY, 0);
+    if (fd < 0)
+    {
+        *err = fd;
+        return nullptr;
+    }
+    auto opened = std::make_shared<DirFd>(fd);
+    InsertDir(dir, opened);
+    return opened;
+}
+
+int ExportRoot::OpenFile(const std::string &path, int flags, mode_t mode)
+{
+    std::string name;
+    int err = 0;
+    std::shared_ptr<DirFd> parent = ResolveParent(path, &name, &err);
+    if (!parent)
+        return err;
+    return OpenBeneath(parent->fd, name, flags, mode);
+}
+
+int ExportRoot::Stat(const std::string &path, struct stat *st)
+{
+    std::string name;
+    int err = 0;
+    std::shared_ptr<DirFd> parent = ResolveParent(path, &name, &err);
+    if (!parent)
+        return err;
+    // Describe a symlink itself rather than following it out of the export.
+    if (fstatat(parent->fd, name.c_str(), st, AT_SYMLINK_NOFOLLOW) != 0)
+        return -errno;
+    return 0;
+}
+
+int ExportRoot::Unlink(const std::string &path)
+{
+    std::string name;
+    int err = 0;
+    std::shared_ptr<DirFd> parent = ResolveParent(path, &name, &err);
+    if (!parent)
+        return err;
+    if (unlinkat(parent->fd, name.c_str(), 0) != 0)
+        return -errno;
+    return 0;
+}
+
+int ExportRoot::MakeDirectory(const std::string &path, mode_t mode)
+{
+    std::string name;
+    int err = 0;
+    std::shared_ptr<DirFd> parent = ResolveParent(path, &name, &err);
+    if (!parent)
+        return err;
+    if (mkdirat(parent->fd, name.c_str(), mode) != 0)
+        return -errno;
+    return 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "storage_backend.h"
+
+// The directory tree served to clients. The root is opened once as a dirfd
+// and every client path is resolved beneath it with openat2(RESOLVE_BENEATH),
+// so results no longer depend on the server's CWD and "..", absolute
+// symlinks or magic links cannot escape the export.
+//
+// Parent directories of recently used paths stay open in an LRU, so an
+// operation on "a/b/c/file" walks at most the components not already cached
+// instead of the whole path.
+//
+// All methods return >= 0 on success and -errno on failure.
+class ExportRoot
+{
+public:
+    explicit ExportRoot(size_t dir_cache_entries) : capacity_(dir_cache_entries) {}
+    ~ExportRoot();
+
+    bool Open(const std::string &root, std::string *error);
+
+    // Returns an fd the caller must close.
+    int OpenFile(const std::string &path, int flags, mode_t mode = 0644);
+    int Stat(const std::string &path, struct stat *st);
+    int Unlink(const std::string &path);
+    // Creates one directory; its parent must exist.
+    int MakeDirectory(const std::string &path, mode_t mode = 0755);
+    // Regular files and directories directly inside `dir` ("" = the root).
+    int List(const std::string &dir, std::vector<DirEntry> *entries);
+
+    // Drops cached directory fds at or below `dir` (after rmdir/rename).
+    void Invalidate(const std::string &dir);
+
+private:
+    struct DirFd
+    {
+        explicit DirFd(int fd) : fd(fd) {}
+        ~DirFd();
+        int fd;
+    };
+
+    // Splits `path` into its parent directory and final component, rejecting
+    // empty names and "..". Leading, trailing and repeated '/' are ignored.
+    static bool SplitPath(const std::string &path, std::string *dir, std::string *name);
+
+    // Returns the parent directory of `path` (opened O_PATH) and its final
+    // component, or nullptr with *err set.
+    std::shared_ptr<DirFd> ResolveParent(const std::string &path, std::string *name, int *err);
+    std::shared_ptr<DirFd> LookupDir(const std::string &dir);
+    void InsertDir(const std::string &dir, std::shared_ptr<DirFd> fd);
+
+    size_t capacity_;
+    std::shared_ptr<DirFd> root_;
+
+    std::mutex mutex_;
+    std::list<std::string> lru_; // most recent first
+    struct CacheEntry
+    {
+        std::shared_ptr<DirFd> fd;
+        std::list<std::string>::iterator lru_pos;
+    };
+    std::unordered_map<std::string, CacheEntry> dirs_;
+};
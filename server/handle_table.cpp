@@ -0,0 +1,76 @@
+#include "handle_table.h"
+
+uint64_t HandleTable::Insert(std::unique_ptr<OpenFile> file)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (handles_.size() >= max_handles_)
+        DropIdle();
+    if (handles_.size() >= max_handles_)
+        return 0;
+
+    uint64_t handle = 0;
+    while (handle == 0 || handles_.count(handle))
+        handle = rng_();
+    open_keys_[file->key]++;
+    handles_[handle] = {std::shared_ptr<OpenFile>(std::move(file)), Clock::now()};
+    return handle;
+}
+
+std::shared_ptr<OpenFile> HandleTable::Lookup(uint64_t handle)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = handles_.find(handle);
+    if (it == handles_.end())
+        return nullptr;
+    it->second.last_used = Clock::now();
+    return it->second.file;
+}
+
+bool HandleTable::Remove(uint64_t handle)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = handles_.find(handle);
+    if (it == handles_.end())
+        return false;
+    Erase(it);
+    return true;
+}
+
+void HandleTable::Invalidate(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!open_keys_.count(key))
+        return;
+    for (auto &entry : handles_)
+    {
+        if (entry.second.file->key == key)
+            entry.second.file->stale = true;
+    }
+}
+
+void HandleTable::Erase(std::unordered_map<uint64_t, Entry>::iterator it)
+{
+    auto open = open_keys_.find(it->second.file->key);
+    if (--open->second == 0)
+        open_keys_.erase(open);
+    handles_.erase(it);
+}
+
+void HandleTable::SetLimits(size_t max_handles, int64_t idle_ms)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_handles_ = max_handles;
+    idle_ms_ = idle_ms;
+}
+
+void HandleTable::DropIdle()
+{
+    Clock::time_point cutoff = Clock::now() - std::chrono::milliseconds(idle_ms_);
+    for (auto it = handles_.begin(); it != handles_.end();)
+    {
+        auto next = std::next(it);
+        if (it->second.last_used < cutoff)
+            Erase(it);
+        it = next;
+    }
+}
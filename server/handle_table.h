@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include "storage_backend.h"
+
+// A file opened through the Open RPC: the backend handle plus the path
+// already normalized, so Read/Write carrying the id skip both.
+struct OpenFile
+{
+    std::string path; // as the client sent it
+    std::string key;  // normalized, for metadata
+    bool writable;
+    std::unique_ptr<FileHandle> file;
+    // Generation of the last write through this handle. A client keeping
+    // several writes in flight may have them land out of mtime order; that
+    // is not a conflict while nobody else has written since.
+    std::atomic<int64_t> last_generation{0};
+    // Set once the file is unlinked or replaced: `file` still refers to
+    // the old one, so requests go by path instead.
+    std::atomic<bool> stale{false};
+};
+
+// Server-side open-file table. Clients that crash never send Close, so
+// handles idle longer than `idle_ms` are reclaimed when the table fills.
+class HandleTable
+{
+public:
+    HandleTable(size_t max_handles, int64_t idle_ms) : max_handles_(max_handles), idle_ms_(idle_ms) {}
+
+    // Returns the new handle id, or 0 if the table is full.
+    uint64_t Insert(std::unique_ptr<OpenFile> file);
+    // Also marks the handle as used now.
+    std::shared_ptr<OpenFile> Lookup(uint64_t handle);
+    bool Remove(uint64_t handle);
+    // Marks every handle open on `key` stale.
+    void Invalidate(const std::string &key);
+    // Applies to future inserts; open handles are kept.
+    void SetLimits(size_t max_handles, int64_t idle_ms);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry
+    {
+        std::shared_ptr<OpenFile> file;
+        Clock::time_point last_used;
+    };
+
+    // Require mutex_ held.
+    void DropIdle();
+    void Erase(std::unordered_map<uint64_t, Entry>::iterator it);
+
+    size_t max_handles_;
+    int64_t idle_ms_;
+    std::mutex mutex_;
+    // Random ids, like shared memory channels: not guessable by other clients.
+    std::mt19937_64 rng_{std::random_device{}()};
+    std::unordered_map<uint64_t, Entry> handles_;
+    // Open handles per key, so unlinks of files nobody has open skip the scan.
+    std::unordered_map<std::string, size_t> open_keys_;
+};
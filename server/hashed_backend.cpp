@@ -0,0 +1,375 @@
+#include "hashed_backend.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+
+static const char kIndexName[] = "namespace.log";
+static const char kIndexTmpName[] = "namespace.log.tmp";
+
+// Index record: type ('P' put / 'U' unlink), object id, path length, path.
+struct IndexRecordHeader
+{
+    char type;
+    uint64_t id;
+    uint32_t path_len;
+} __attribute__((packed));
+
+// splitmix64 finalizer; spreads sequential ids across the fan-out dirs.
+static uint64_t MixId(uint64_t id)
+{
+    uint64_t z = id + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+std::string HashedBackend::ObjectPath(uint64_t id)
+{
+    uint64_t h = MixId(id);
+    char buf[64];
+    snprintf(buf, sizeof(buf), "objects/%02x/%02x/%016llx", (unsigned)(h >> 56), (unsigned)((h >> 48) & 0xff),
+             (unsigned long long)id);
+    return buf;
+}
+
+HashedBackend::~HashedBackend()
+{
+    if (index_fd_ >= 0)
+        close(index_fd_);
+    if (root_fd_ >= 0)
+        close(root_fd_);
+}
+
+bool HashedBackend::Open(const std::string &root, std::string *error)
+{
+    root_fd_ = open(root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd_ < 0)
+    {
+        *error = "cannot open storage root " + root + ": " + strerror(errno);
+        return false;
+    }
+    if (mkdirat(root_fd_, "objects", 0755) != 0 && errno != EEXIST)
+    {
+        *error = std::string("cannot create objects directory: ") + strerror(errno);
+        return false;
+    }
+
+    if (!ReplayIndex(error))
+        return false;
+    if (index_records_ > 2 * index_.size() + 1024 && !CompactIndex(error))
+        return false;
+
+    if (index_fd_ < 0)
+        index_fd_ = openat(root_fd_, kIndexName, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (index_fd_ < 0)
+    {
+        *error = std::string("cannot open namespace index: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool HashedBackend::ReplayIndex(std::string *error)
+{
+    int fd = openat(root_fd_, kIndexName, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (errno == ENOENT)
+            return true;
+        *error = std::string("cannot read namespace index: ") + strerror(errno);
+        return false;
+    }
+
+    off_t good = 0;
+    for (;;)
+    {
+        IndexRecordHeader header;
+        if (PreadFull(fd, (char *)&header, sizeof(header), good) != sizeof(header))
+            break;
+        std::string path(header.path_len, '\0');
+        if (PreadFull(fd, &path[0], header.path_len, good + sizeof(header)) != (ssize_t)header.path_len)
+            break;
+
+        if (header.type == 'P')
+            index_[path] = header.id;
+        else if (header.type == 'U')
+            index_.erase(path);
+        else
+            break;
+        if (header.id >= next_id_)
+            next_id_ = header.id + 1;
+        index_records_++;
+        good += sizeof(header) + header.path_len;
+    }
+
+    // Drop a record torn by a crash mid-append.
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > good)
+    {
+        if (ftruncate(fd, good) != 0)
+        {
+            *error = std::string("cannot truncate namespace index: ") + strerror(errno);
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+    return true;
+}
+
+bool HashedBackend::CompactIndex(std::string *error)
+{
+    int fd = openat(root_fd_, kIndexTmpName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        *error = std::string("cannot compact namespace index: ") + strerror(errno);
+        return false;
+    }
+
+    std::string buffer;
+    off_t offset = 0;
+    bool ok = true;
+    for (auto entry = index_.begin(); entry != index_.end() && ok; ++entry)
+    {
+        IndexRecordHeader header{'P', entry->second, (uint32_t)entry->first.size()};
+        buffer.append((const char *)&header, sizeof(header));
+        buffer.append(entry->first);
+        if (buffer.size() >= (1 << 20))
+        {
+            ok = PwriteFull(fd, buffer.data(), buffer.size(), offset) >= 0;
+            offset += buffer.size();
+            buffer.clear();
+        }
+    }
+    ok = ok && PwriteFull(fd, buffer.data(), buffer.size(), offset) >= 0 && fsync(fd) == 0;
+    int saved = errno;
+    close(fd);
+
+    // Appends after the rename go to the new file; opened first so a
+    // failure leaves the old index in place and in use.
+    int append_fd = ok ? openat(root_fd_, kIndexTmpName, O_WRONLY | O_APPEND | O_CLOEXEC) : -1;
+    if (append_fd < 0 || renameat(root_fd_, kIndexTmpName, root_fd_, kIndexName) != 0)
+    {
+        if (ok)
+            saved = errno;
+        *error = std::string("cannot compact namespace index: ") + strerror(saved);
+        if (append_fd >= 0)
+            close(append_fd);
+        unlinkat(root_fd_, kIndexTmpName, 0);
+        return false;
+    }
+    if (index_fd_ >= 0)
+        close(index_fd_);
+    index_fd_ = append_fd;
+    index_records_ = index_.size();
+
+    // Make the rename itself durable.
+    int dir_fd = openat(root_fd_, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0 || fsync(dir_fd) != 0)
+        std::cerr << "[HASHED] cannot sync the storage root after compacting the index" << std::endl;
+    if (dir_fd >= 0)
+        close(dir_fd);
+    return true;
+}
+
+void HashedBackend::MaybeCompactIndex()
+{
+    if (index_records_ <= 2 * index_.size() + 1024 || index_records_ < compact_retry_at_)
+        return;
+    std::string error;
+    if (!CompactIndex(&error))
+    {
+        std::cerr << "[HASHED] " << error << std::endl;
+        compact_retry_at_ = index_records_ + 1024;
+    }
+}
+
+int HashedBackend::AppendIndex(char type, uint64_t id, const std::string &path)
+{
+    IndexRecordHeader header{type, id, (uint32_t)path.size()};
+    std::string record((const char *)&header, sizeof(header));
+    record += path;
+
+    // O_APPEND: a single write() lands the record contiguously.
+    ssize_t n = write(index_fd_, record.data(), record.size());
+    if (n != (ssize_t)record.size())
+        return n < 0 ? -errno : -EIO;
+    if (sync_index_ && fdatasync(index_fd_) != 0)
+        return -errno;
+    index_records_++;
+    return 0;
+}
+
+int HashedBackend::CreateObject(uint64_t id)
+{
+    std::string object = ObjectPath(id);
+    for (int attempt = 0; attempt < 3; attempt++)
+    {
+        int fd = openat(root_fd_, object.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd >= 0)
+        {
+            close(fd);
+            return 0;
+        }
+        if (errno == EEXIST)
+        {
+            // An orphan from a crash between creating an object and
+            // indexing it: no index record names ids this new, so it is
+            // safe to replace.
+            if (unlinkat(root_fd_, object.c_str(), 0) != 0)
+                return -errno;
+            continue;
+        }
+        if (errno != ENOENT)
+            return -errno;
+
+        // First object in this fan-out bucket: create "objects/ab" and "objects/ab/cd".
+        std::string level1 = object.substr(0, strlen("objects/ab"));
+        std::string level2 = object.substr(0, strlen("objects/ab/cd"));
+        if ((mkdirat(root_fd_, level1.c_str(), 0755) != 0 && errno != EEXIST) ||
+            (mkdirat(root_fd_, level2.c_str(), 0755) != 0 && errno != EEXIST))
+            return -errno;
+    }
+    return -EIO;
+}
+
+int HashedBackend::Resolve(const std::string &path, bool create, uint64_t *id)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = index_.find(path);
+        if (it != index_.end())
+        {
+            *id = it->second;
+            return 0;
+        }
+    }
+    if (!create)
+        return -ENOENT;
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto it = index_.find(path);
+    if (it != index_.end())
+    {
+        *id = it->second;
+        return 0;
+    }
+
+    // Object first, then the index record: a crash in between leaves an
+    // orphan object, never an index entry without data.
+    uint64_t new_id = next_id_++;
+    int result = CreateObject(new_id);
+    if (result == 0)
+        result = AppendIndex('P', new_id, path);
+    if (result < 0)
+    {
+        unlinkat(root_fd_, ObjectPath(new_id).c_str(), 0);
+        return result;
+    }
+    index_[path] = new_id;
+    *id = new_id;
+    MaybeCompactIndex();
+    return 0;
+}
+
+ssize_t HashedBackend::Read(const std::string &path, char *buf, size_t size, off_t offset)
+{
+    std::string key;
+    uint64_t id;
+    if (!NormalizePath(path, &key))
+        return -EACCES;
+    int result = Resolve(key, false, &id);
+    if (result < 0)
+        return result;
+
+    int fd = openat(root_fd_, ObjectPath(id).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    ssize_t n = PreadFull(fd, buf, size, offset);
+    close(fd);
+    return n;
+}
+
+ssize_t HashedBackend::Write(const std::string &path, const char *data, size_t size, off_t offset)
+{
+    std::string key;
+    uint64_t id;
+    if (!NormalizePath(path, &key))
+        return -EACCES;
+    int result = Resolve(key, true, &id);
+    if (result < 0)
+        return result;
+
+    int fd = openat(root_fd_, ObjectPath(id).c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    ssize_t n = PwriteFull(fd, data, size, offset);
+    close(fd);
+    return n;
+}
+
+int HashedBackend::GetAttr(const std::string &path, FileAttr *attr)
+{
+    std::string key;
+    uint64_t id;
+    if (!NormalizePath(path, &key))
+        return -EACCES;
+    int result = Resolve(key, false, &id);
+    if (result < 0)
+        return result;
+
+    struct stat st;
+    if (fstatat(root_fd_, ObjectPath(id).c_str(), &st, 0) != 0)
+        return -errno;
+    attr->size = st.st_size;
+    attr->mtime = st.st_mtime;
+    return 0;
+}
+
+int HashedBackend::Unlink(const std::string &path)
+{
+    std::string key;
+    if (!NormalizePath(path, &key))
+        return -EACCES;
+
+    uint64_t id;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it == index_.end())
+            return -ENOENT;
+        id = it->second;
+        int result = AppendIndex('U', id, key);
+        if (result < 0)
+            return result;
+        index_.erase(it);
+        MaybeCompactIndex();
+    }
+
+    unlinkat(root_fd_, ObjectPath(id).c_str(), 0);
+    return 0;
+}
+
+int HashedBackend::OpenHandle(const std::string &path, bool writable, std::unique_ptr<FileHandle> *handle)
+{
+    std::string key;
+    uint64_t id;
+    if (!NormalizePath(path, &key))
+        return -EACCES;
+    int result = Resolve(key, false, &id);
+    if (result < 0)
+        return result;
+
+    int fd = openat(root_fd_, ObjectPath(id).c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    handle->reset(new FdHandle(fd, writable));
+    return 0;
+}
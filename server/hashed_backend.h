@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <shared_mutex>
+#include <string>
+
+#include "storage_backend.h"
+
+// Object-store layout for very large namespaces. File contents live in
+//
+//   <root>/objects/ab/cd/<object id>
+//
+// where "ab/cd" come from a hash of the id, so 65536 leaf directories share
+// the load evenly and no directory grows with the namespace. The client
+// namespace (path -> object id) is a separate index kept in memory and
+// persisted as an append-only log, <root>/namespace.log, replayed at startup
+// and compacted, at startup or as unlinks and creates go by, when it
+// accumulates more dead records than live ones.
+class HashedBackend final : public StorageBackend
+{
+public:
+    explicit HashedBackend(bool sync_index) : sync_index_(sync_index) {}
+    ~HashedBackend();
+
+    bool Open(const std::string &root, std::string *error);
+
+    ssize_t Read(const std::string &path, char *buf, size_t size, off_t offset) override;
+    ssize_t Write(const std::string &path, const char *data, size_t size, off_t offset) override;
+    int GetAttr(const std::string &path, FileAttr *attr) override;
+    int Unlink(const std::string &path) override;
+    int OpenHandle(const std::string &path, bool writable, std::unique_ptr<FileHandle> *handle) override;
+
+private:
+    static std::string ObjectPath(uint64_t id);
+
+    bool ReplayIndex(std::string *error);
+    bool CompactIndex(std::string *error);
+    // Compacts once dead records outnumber live ones (plus slack); callers
+    // hold mutex_ exclusively.
+    void MaybeCompactIndex();
+    int AppendIndex(char type, uint64_t id, const std::string &path);
+
+    // Looks up `path`; if missing and `create` is set, allocates an object.
+    int Resolve(const std::string &path, bool create, uint64_t *id);
+    int CreateObject(uint64_t id);
+
+    bool sync_index_;
+    int root_fd_ = -1;
+    int index_fd_ = -1;
+
+    std::shared_mutex mutex_;
+    std::map<std::string, uint64_t> index_; // ordered for prefix listing
+    uint64_t next_id_ = 1;
+    uint64_t index_records_ = 0;
+    // After a failed compaction, the record count to try again at.
+    uint64_t compact_retry_at_ = 0;
+};
@@ -0,0 +1,795 @@
+#include "kv_store.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+#include "storage_backend.h"
+
+static const uint32_t kTableMagic = 0x4b534644; // "DFSK"
+
+static void PutU32(std::string *out, uint32_t v) { out->append((const char *)&v, sizeof(v)); }
+static void PutU64(std::string *out, uint64_t v) { out->append((const char *)&v, sizeof(v)); }
+
+// Bounds-checked little reader over an encoded buffer.
+struct Decoder
+{
+    const char *p;
+    const char *end;
+
+    bool U32(uint32_t *v) { return Raw(v, sizeof(*v)); }
+    bool U64(uint64_t *v) { return Raw(v, sizeof(*v)); }
+    bool Raw(void *v, size_t n)
+    {
+        if ((size_t)(end - p) < n)
+            return false;
+        memcpy(v, p, n);
+        p += n;
+        return true;
+    }
+    bool Bytes(std::string *s, size_t n)
+    {
+        if ((size_t)(end - p) < n)
+            return false;
+        s->assign(p, n);
+        p += n;
+        return true;
+    }
+};
+
+static uint64_t Fnv1a(const char *data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Entry encoding shared by WAL batches and table blocks.
+static void EncodeEntry(std::string *out, const std::string &key, const std::string &value, bool deleted)
+{
+    out->push_back(deleted ? 1 : 0);
+    PutU32(out, key.size());
+    PutU32(out, value.size());
+    out->append(key);
+    out->append(value);
+}
+
+static bool DecodeEntry(Decoder *in, BlockCache::Entry *entry)
+{
+    char deleted;
+    uint32_t key_len, value_len;
+    if (!in->Raw(&deleted, 1) || !in->U32(&key_len) || !in->U32(&value_len))
+        return false;
+    entry->deleted = deleted != 0;
+    return in->Bytes(&entry->key, key_len) && in->Bytes(&entry->value, value_len);
+}
+
+void WriteBatch::Put(const std::string &key, const std::string &value)
+{
+    ops_.push_back({false, key, value});
+}
+
+void WriteBatch::Delete(const std::string &key)
+{
+    ops_.push_back({true, key, std::string()});
+}
+
+std::shared_ptr<const BlockCache::Block> BlockCache::Lookup(uint64_t table, uint64_t offset)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = slots_.find({table, offset});
+    if (it == slots_.end())
+        return nullptr;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->block;
+}
+
+void BlockCache::Insert(uint64_t table, uint64_t offset, std::shared_ptr<const Block> block, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (bytes > capacity_ || slots_.count({table, offset}))
+        return;
+    lru_.push_front({{table, offset}, std::move(block), bytes});
+    slots_[{table, offset}] = lru_.begin();
+    used_ += bytes;
+    while (used_ > capacity_)
+    {
+        used_ -= lru_.back().bytes;
+        slots_.erase(lru_.back().id);
+        lru_.pop_back();
+    }
+}
+
+// Immutable sorted table: data blocks, block index, bloom filter, footer.
+class SsTable
+{
+public:
+    struct IndexEntry
+    {
+        std::string first_key;
+        uint64_t offset;
+        uint32_t size;
+        uint64_t checksum;
+    };
+
+    struct Footer
+    {
+        uint64_t index_offset;
+        uint64_t index_size;
+        uint64_t bloom_offset;
+        uint64_t bloom_size;
+        uint64_t entries;
+        uint32_t bloom_hashes;
+        uint32_t magic;
+    } __attribute__((packed));
+
+    SsTable(uint64_t number, int fd, BlockCache *cache) : number_(number), fd_(fd), cache_(cache) {}
+    ~SsTable() { close(fd_); }
+
+    static std::shared_ptr<SsTable> Open(const std::string &path, uint64_t number, BlockCache *cache, std::string *error)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            *error = "cannot open " + path + ": " + strerror(errno);
+            return nullptr;
+        }
+        std::shared_ptr<SsTable> table(new SsTable(number, fd, cache));
+        if (!table->Load())
+        {
+            *error = "corrupt table " + path;
+            return nullptr;
+        }
+        return table;
+    }
+
+    uint64_t number() const { return number_; }
+    uint64_t bytes() const { return bytes_; }
+    uint64_t entries() const { return footer_.entries; }
+
+    bool MayContain(const std::string &key) const
+    {
+        uint64_t bits = bloom_.size() * 8;
+        if (bits == 0)
+            return true;
+        uint64_t h = Fnv1a(key.data(), key.size());
+        uint64_t delta = (h >> 33) | (h << 31);
+        for (uint32_t i = 0; i < footer_.bloom_hashes; i++)
+        {
+            uint64_t bit = h % bits;
+            if (!(bloom_[bit / 8] & (1 << (bit % 8))))
+                return false;
+            h += delta;
+        }
+        return true;
+    }
+
+    // Index of the only block that can hold `key`, or -1.
+    int FindBlock(const std::string &key) const
+    {
+        auto it = std::upper_bound(index_.begin(), index_.end(), key,
+                                   [](const std::string &k, const IndexEntry &e) { return k < e.first_key; });
+        return (int)(it - index_.begin()) - 1;
+    }
+
+    size_t block_count() const { return index_.size(); }
+
+    std::shared_ptr<const BlockCache::Block> LoadBlock(size_t i) const
+    {
+        const IndexEntry &entry = index_[i];
+        std::shared_ptr<const BlockCache::Block> block = cache_->Lookup(number_, entry.offset);
+        if (block)
+            return block;
+
+        std::string raw(entry.size, '\0');
+        if (PreadFull(fd_, &raw[0], raw.size(), entry.offset) != (ssize_t)raw.size() ||
+            Fnv1a(raw.data(), raw.size()) != entry.checksum)
+        {
+            std::cerr << "[KV] bad block " << i << " in table " << number_ << std::endl;
+            return nullptr;
+        }
+        auto decoded = std::make_shared<BlockCache::Block>();
+        Decoder in{raw.data(), raw.data() + raw.size()};
+        while (in.p < in.end)
+        {
+            BlockCache::Entry e;
+            if (!DecodeEntry(&in, &e))
+                return nullptr;
+            decoded->push_back(std::move(e));
+        }
+        cache_->Insert(number_, entry.offset, decoded, raw.size() + decoded->size() * sizeof(BlockCache::Entry));
+        return decoded;
+    }
+
+    // 0 with *entry set (possibly a tombstone), or -ENOENT.
+    int Get(const std::string &key, BlockCache::Entry *entry) const
+    {
+        if (!MayContain(key))
+            return -ENOENT;
+        int i = FindBlock(key);
+        if (i < 0)
+            return -ENOENT;
+        std::shared_ptr<const BlockCache::Block> block = LoadBlock(i);
+        if (!block)
+            return -EIO;
+        auto it = std::lower_bound(block->begin(), block->end(), key,
+                                   [](const BlockCache::Entry &e, const std::string &k) { return e.key < k; });
+        if (it == block->end() || it->key != key)
+            return -ENOENT;
+        *entry = *it;
+        return 0;
+    }
+
+private:
+    bool Load()
+    {
+        struct stat st;
+        if (fstat(fd_, &st) != 0 || st.st_size < (off_t)sizeof(Footer))
+            return false;
+        bytes_ = st.st_size;
+        if (PreadFull(fd_, (char *)&footer_, sizeof(footer_), bytes_ - sizeof(footer_)) != sizeof(footer_) ||
+            footer_.magic != kTableMagic)
+            return false;
+
+        std::string raw(footer_.index_size, '\0');
+        if (PreadFull(fd_, &raw[0], raw.size(), footer_.index_offset) != (ssize_t)raw.size())
+            return false;
+        Decoder in{raw.data(), raw.data() + raw.size()};
+        while (in.p < in.end)
+        {
+            IndexEntry e;
+            uint32_t key_len;
+            if (!in.U32(&key_len) || !in.Bytes(&e.first_key, key_len) || !in.U64(&e.offset) || !in.U32(&e.size) ||
+                !in.U64(&e.checksum))
+                return false;
+            index_.push_back(std::move(e));
+        }
+
+        bloom_.resize(footer_.bloom_size);
+        return PreadFull(fd_, (char *)bloom_.data(), bloom_.size(), footer_.bloom_offset) == (ssize_t)bloom_.size();
+    }
+
+    uint64_t number_;
+    int fd_;
+    BlockCache *cache_;
+    uint64_t bytes_ = 0;
+    Footer footer_;
+    std::vector<IndexEntry> index_;
+    std::vector<uint8_t> bloom_;
+};
+
+// A sorted stream of entries: the memtable snapshot or one table.
+class EntrySource
+{
+public:
+    virtual ~EntrySource() = default;
+    virtual bool Valid() const = 0;
+    virtual const BlockCache::Entry &entry() const = 0;
+    virtual void Next() = 0;
+};
+
+class VectorSource final : public EntrySource
+{
+public:
+    explicit VectorSource(std::vector<BlockCache::Entry> entries) : entries_(std::move(entries)) {}
+    bool Valid() const override { return pos_ < entries_.size(); }
+    const BlockCache::Entry &entry() const override { return entries_[pos_]; }
+    void Next() override { pos_++; }
+
+private:
+    std::vector<BlockCache::Entry> entries_;
+    size_t pos_ = 0;
+};
+
+class TableSource final : public EntrySource
+{
+public:
+    TableSource(std::shared_ptr<SsTable> table, const std::string &start) : table_(std::move(table))
+    {
+        int i = table_->FindBlock(start);
+        block_index_ = i < 0 ? 0 : i;
+        LoadCurrent();
+        if (block_)
+            pos_ = std::lower_bound(block_->begin(), block_->end(), start,
+                                    [](const BlockCache::Entry &e, const std::string &k) { return e.key < k; }) -
+                   block_->begin();
+        SkipExhausted();
+    }
+
+    bool Valid() const override { return block_ != nullptr; }
+    const BlockCache::Entry &entry() const override { return (*block_)[pos_]; }
+    void Next() override
+    {
+        pos_++;
+        SkipExhausted();
+    }
+
+private:
+    void LoadCurrent()
+    {
+        block_ = block_index_ < table_->block_count() ? table_->LoadBlock(block_index_) : nullptr;
+        pos_ = 0;
+    }
+
+    void SkipExhausted()
+    {
+        while (block_ && pos_ >= block_->size())
+        {
+            block_index_++;
+            LoadCurrent();
+        }
+    }
+
+    std::shared_ptr<SsTable> table_;
+    size_t block_index_ = 0;
+    std::shared_ptr<const BlockCache::Block> block_;
+    size_t pos_ = 0;
+};
+
+// Merges sources ordered newest first; for duplicate keys the newest wins.
+class MergingIterator
+{
+public:
+    explicit MergingIterator(std::vector<std::unique_ptr<EntrySource>> sources) : sources_(std::move(sources)) {}
+
+    bool Next(BlockCache::Entry *out)
+    {
+        const std::string *min = nullptr;
+        size_t chosen = 0;
+        for (size_t i = 0; i < sources_.size(); i++)
+        {
+            if (sources_[i]->Valid() && (min == nullptr || sources_[i]->entry().key < *min))
+            {
+                min = &sources_[i]->entry().key;
+                chosen = i;
+            }
+        }
+        if (min == nullptr)
+            return false;
+
+        *out = sources_[chosen]->entry();
+        for (auto &source : sources_)
+        {
+            if (source->Valid() && source->entry().key == out->key)
+                source->Next();
+        }
+        return true;
+    }
+
+private:
+    std::vector<std::unique_ptr<EntrySource>> sources_;
+};
+
+KvStore::KvStore(const Options &options) : options_(options), cache_(options.block_cache_bytes) {}
+
+KvStore::~KvStore()
+{
+    {
+        std::lock_guard<std::mutex> lock(compact_mutex_);
+        stopped_ = true;
+    }
+    compact_cv_.notify_all();
+    if (compactor_.joinable())
+        compactor_.join();
+    if (wal_fd_ >= 0)
+        close(wal_fd_);
+}
+
+bool KvStore::Open(const std::string &dir, std::string *error)
+{
+    dir_ = dir;
+    if (mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        *error = "cannot create " + dir_ + ": " + strerror(errno);
+        return false;
+    }
+
+    // MANIFEST lists the live tables, oldest first.
+    std::set<uint64_t> live;
+    std::ifstream manifest(dir_ + "/MANIFEST");
+    std::string word;
+    uint64_t number;
+    while (manifest >> word >> number)
+    {
+        if (word == "next")
+            next_table_ = number;
+        else if (word == "table")
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "/sst-%08llu", (unsigned long long)number);
+            std::shared_ptr<SsTable> table = SsTable::Open(dir_ + name, number, &cache_, error);
+            if (!table)
+                return false;
+            tables_.push_back(table);
+            live.insert(number);
+        }
+    }
+
+    // Tables from a flush or compaction cut short by a crash.
+    if (DIR *d = opendir(dir_.c_str()))
+    {
+        while (struct dirent *entry = readdir(d))
+        {
+            unsigned long long n;
+            if (sscanf(entry->d_name, "sst-%llu", &n) == 1 && !live.count(n))
+                unlink((dir_ + "/" + entry->d_name).c_str());
+        }
+        closedir(d);
+    }
+
+    if (!ReplayWal(error))
+        return false;
+    compactor_ = std::thread([this] { CompactLoop(); });
+    return true;
+}
+
+bool KvStore::ReplayWal(std::string *error)
+{
+    wal_fd_ = open((dir_ + "/wal.log").c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (wal_fd_ < 0)
+    {
+        *error = "cannot open write-ahead log in " + dir_ + ": " + strerror(errno);
+        return false;
+    }
+
+    off_t good = 0;
+    for (;;)
+    {
+        uint32_t size;
+        uint64_t checksum;
+        if (PreadFull(wal_fd_, (char *)&size, sizeof(size), good) != sizeof(size) ||
+            PreadFull(wal_fd_, (char *)&checksum, sizeof(checksum), good + sizeof(size)) != sizeof(checksum))
+            break;
+        std::string payload(size, '\0');
+        off_t at = good + sizeof(size) + sizeof(checksum);
+        if (PreadFull(wal_fd_, &payload[0], size, at) != (ssize_t)size || Fnv1a(payload.data(), size) != checksum)
+            break;
+
+        Decoder in{payload.data(), payload.data() + size};
+        BlockCache::Entry entry;
+        while (in.p < in.end && DecodeEntry(&in, &entry))
+        {
+            memtable_bytes_ += entry.key.size() + entry.value.size() + 32;
+            memtable_[entry.key] = entry;
+        }
+        good = at + size;
+    }
+
+    // Drop a batch torn by a crash mid-append.
+    struct stat st;
+    if (fstat(wal_fd_, &st) == 0 && st.st_size > good && ftruncate(wal_fd_, good) != 0)
+    {
+        *error = std::string("cannot truncate write-ahead log: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool KvStore::WriteManifest()
+{
+    std::ostringstream out;
+    out << "next " << next_table_ << "\n";
+    for (const auto &table : tables_)
+        out << "table " << table->number() << "\n";
+    std::string content = out.str();
+
+    std::string tmp = dir_ + "/MANIFEST.tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    bool ok = PwriteFull(fd, content.data(), content.size(), 0) == (ssize_t)content.size() && fsync(fd) == 0;
+    close(fd);
+    return ok && rename(tmp.c_str(), (dir_ + "/MANIFEST").c_str()) == 0;
+}
+
+int KvStore::BuildTable(uint64_t number, uint64_t expected_keys, bool drop_tombstones,
+                        const std::function<bool(BlockCache::Entry *)> &next, std::shared_ptr<SsTable> *table)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/sst-%08llu", (unsigned long long)number);
+    std::string path = dir_ + name;
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -errno;
+
+    uint64_t bloom_bits = std::max<uint64_t>(64, expected_keys * options_.bloom_bits_per_key);
+    std::vector<uint8_t> bloom((bloom_bits + 7) / 8);
+    bloom_bits = bloom.size() * 8;
+    uint32_t hashes = std::max(1, std::min(30, options_.bloom_bits_per_key * 69 / 100));
+
+    std::string block, index, first_key;
+    uint64_t offset = 0, entries = 0;
+    int result = 0;
+    auto flush_block = [&]() {
+        if (block.empty() || result < 0)
+            return;
+        PutU32(&index, first_key.size());
+        index += first_key;
+        PutU64(&index, offset);
+        PutU32(&index, block.size());
+        PutU64(&index, Fnv1a(block.data(), block.size()));
+        if (PwriteFull(fd, block.data(), block.size(), offset) != (ssize_t)block.size())
+            result = -EIO;
+        offset += block.size();
+        block.clear();
+    };
+
+    BlockCache::Entry entry;
+    while (result == 0 && next(&entry))
+    {
+        if (entry.deleted && drop_tombstones)
+            continue;
+        if (block.empty())
+            first_key = entry.key;
+        EncodeEntry(&block, entry.key, entry.value, entry.deleted);
+        entries++;
+
+        uint64_t h = Fnv1a(entry.key.data(), entry.key.size());
+        uint64_t delta = (h >> 33) | (h << 31);
+        for (uint32_t i = 0; i < hashes; i++)
+        {
+            uint64_t bit = h % bloom_bits;
+            bloom[bit / 8] |= 1 << (bit % 8);
+            h += delta;
+        }
+        if (block.size() >= options_.block_bytes)
+            flush_block();
+    }
+    flush_block();
+
+    if (result == 0 && entries == 0)
+    {
+        // Everything was a dropped tombstone.
+        close(fd);
+        unlink(path.c_str());
+        table->reset();
+        return 0;
+    }
+
+    SsTable::Footer footer;
+    footer.index_offset = offset;
+    footer.index_size = index.size();
+    footer.bloom_offset = offset + index.size();
+    footer.bloom_size = bloom.size();
+    footer.entries = entries;
+    footer.bloom_hashes = hashes;
+    footer.magic = kTableMagic;
+    std::string tail = index;
+    tail.append((const char *)bloom.data(), bloom.size());
+    tail.append((const char *)&footer, sizeof(footer));
+    if (result == 0 && (PwriteFull(fd, tail.data(), tail.size(), offset) != (ssize_t)tail.size() || fsync(fd) != 0))
+        result = -EIO;
+    close(fd);
+    if (result < 0)
+    {
+        unlink(path.c_str());
+        return result;
+    }
+
+    std::string error;
+    *table = SsTable::Open(path, number, &cache_, &error);
+    if (!*table)
+    {
+        std::cerr << "[KV] " << error << std::endl;
+        return -EIO;
+    }
+    return 0;
+}
+
+int KvStore::Write(const WriteBatch &batch)
+{
+    std::string payload;
+    for (const auto &op : batch.ops_)
+        EncodeEntry(&payload, op.key, op.value, op.deleted);
+    std::string record;
+    PutU32(&record, payload.size());
+    PutU64(&record, Fnv1a(payload.data(), payload.size()));
+    record += payload;
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    ssize_t n = write(wal_fd_, record.data(), record.size());
+    if (n != (ssize_t)record.size())
+        return n < 0 ? -errno : -EIO;
+    if (options_.sync && fdatasync(wal_fd_) != 0)
+        return -errno;
+
+    for (const auto &op : batch.ops_)
+    {
+        memtable_bytes_ += op.key.size() + op.value.size() + 32;
+        memtable_[op.key] = {op.key, op.value, op.deleted};
+    }
+    if (memtable_bytes_ >= options_.memtable_bytes)
+        return Flush();
+    return 0;
+}
+
+// Called with mutex_ held exclusively.
+int KvStore::Flush()
+{
+    if (memtable_.empty())
+        return 0;
+
+    auto it = memtable_.begin();
+    std::shared_ptr<SsTable> table;
+    int result = BuildTable(next_table_++, memtable_.size(), tables_.empty(), [&](BlockCache::Entry *entry) {
+        if (it == memtable_.end())
+            return false;
+        *entry = it->second;
+        ++it;
+        return true;
+    }, &table);
+    if (result < 0)
+        return result;
+
+    if (table)
+        tables_.push_back(table);
+    if (!WriteManifest())
+        return -EIO;
+    // The table is durable and listed; the WAL contents are now redundant.
+    if (ftruncate(wal_fd_, 0) != 0)
+        return -errno;
+    memtable_.clear();
+    memtable_bytes_ = 0;
+    compact_cv_.notify_all();
+    return 0;
+}
+
+int KvStore::Get(const std::string &key, std::string *value)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = memtable_.find(key);
+    if (it != memtable_.end())
+    {
+        if (it->second.deleted)
+            return -ENOENT;
+        *value = it->second.value;
+        return 0;
+    }
+
+    for (auto table = tables_.rbegin(); table != tables_.rend(); ++table)
+    {
+        BlockCache::Entry entry;
+        int result = (*table)->Get(key, &entry);
+        if (result == -ENOENT)
+            continue;
+        if (result < 0)
+            return result;
+        if (entry.deleted)
+            return -ENOENT;
+        *value = std::move(entry.value);
+        return 0;
+    }
+    return -ENOENT;
+}
+
+int KvStore::Scan(const std::string &prefix, const std::function<bool(const std::string &, const std::string &)> &fn)
+{
+    // Snapshot the matching memtable range and the table list, then merge
+    // without holding the lock.
+    std::vector<std::unique_ptr<EntrySource>> sources;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        std::vector<BlockCache::Entry> mem;
+        for (auto it = memtable_.lower_bound(prefix); it != memtable_.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+            mem.push_back(it->second);
+        sources.emplace_back(new VectorSource(std::move(mem)));
+        for (auto table = tables_.rbegin(); table != tables_.rend(); ++table)
+            sources.emplace_back(new TableSource(*table, prefix));
+    }
+
+    MergingIterator merged(std::move(sources));
+    BlockCache::Entry entry;
+    while (merged.Next(&entry))
+    {
+        if (entry.key.compare(0, prefix.size(), prefix) != 0)
+            break;
+        if (!entry.deleted && !fn(entry.key, entry.value))
+            break;
+    }
+    return 0;
+}
+
+void KvStore::CompactLoop()
+{
+    std::unique_lock<std::mutex> lock(compact_mutex_);
+    while (!stopped_)
+    {
+        lock.unlock();
+        while (CompactOnce())
+        {
+        }
+        lock.lock();
+        compact_cv_.wait_for(lock, std::chrono::seconds(5));
+    }
+}
+
+// Merges one run of adjacent tables from the same size tier.
+bool KvStore::CompactOnce()
+{
+    std::vector<std::shared_ptr<SsTable>> tables;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        tables = tables_;
+    }
+
+    auto tier = [this](const std::shared_ptr<SsTable> &table) {
+        int t = 0;
+        for (uint64_t limit = options_.memtable_bytes; table->bytes() > limit && t < 32; limit *= options_.compaction_fanout)
+            t++;
+        return t;
+    };
+
+    // Find the newest run of at least `fanout` adjacent same-tier tables.
+    size_t lo = 0, hi = 0;
+    for (size_t end = tables.size(); end > 0 && hi == 0; end = lo)
+    {
+        lo = end - 1;
+        while (lo > 0 && tier(tables[lo - 1]) == tier(tables[end - 1]))
+            lo--;
+        if (end - lo >= (size_t)options_.compaction_fanout)
+            hi = end;
+    }
+    if (hi == 0)
+        return false;
+
+    std::vector<std::unique_ptr<EntrySource>> sources;
+    uint64_t expected = 0;
+    for (size_t i = hi; i > lo; i--)
+    {
+        sources.emplace_back(new TableSource(tables[i - 1], ""));
+        expected += tables[i - 1]->entries();
+    }
+    MergingIterator merged(std::move(sources));
+
+    uint64_t number;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        number = next_table_++;
+    }
+    std::shared_ptr<SsTable> output;
+    // Tombstones can go once nothing older than the run is left to shadow.
+    if (BuildTable(number, expected, lo == 0, [&](BlockCache::Entry *entry) { return merged.Next(entry); }, &output) < 0)
+    {
+        std::cerr << "[KV] compaction of " << (hi - lo) << " tables failed" << std::endl;
+        return false;
+    }
+
+    {
+        // Only this thread removes tables and flushes only append, so the
+        // run is still contiguous at the same position.
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto first = std::find(tables_.begin(), tables_.end(), tables[lo]);
+        first = tables_.erase(first, first + (hi - lo));
+        if (output)
+            tables_.insert(first, output);
+        if (!WriteManifest())
+        {
+            // The old MANIFEST still names the inputs; keep their files.
+            std::cerr << "[KV] cannot write manifest after compaction" << std::endl;
+            return false;
+        }
+    }
+
+    for (size_t i = lo; i < hi; i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/sst-%08llu", (unsigned long long)tables[i]->number());
+        unlink((dir_ + name).c_str());
+    }
+    return true;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class SsTable;
+
+// Atomic group of puts and deletes, applied in order.
+class WriteBatch
+{
+public:
+    void Put(const std::string &key, const std::string &value);
+    void Delete(const std::string &key);
+    bool empty() const { return ops_.empty(); }
+
+private:
+    friend class KvStore;
+    struct Op
+    {
+        bool deleted;
+        std::string key;
+        std::string value;
+    };
+    std::vector<Op> ops_;
+};
+
+// LRU cache of decoded SSTable blocks, keyed by (table, block offset).
+class BlockCache
+{
+public:
+    struct Entry
+    {
+        std::string key;
+        std::string value;
+        bool deleted;
+    };
+    using Block = std::vector<Entry>;
+
+    explicit BlockCache(size_t capacity_bytes) : capacity_(capacity_bytes) {}
+
+    std::shared_ptr<const Block> Lookup(uint64_t table, uint64_t offset);
+    void Insert(uint64_t table, uint64_t offset, std::shared_ptr<const Block> block, size_t bytes);
+
+private:
+    struct Slot
+    {
+        std::pair<uint64_t, uint64_t> id;
+        std::shared_ptr<const Block> block;
+        size_t bytes;
+    };
+    struct IdHash
+    {
+        size_t operator()(const std::pair<uint64_t, uint64_t> &id) const { return id.first * 0x9e3779b97f4a7c15ULL ^ id.second; }
+    };
+
+    std::mutex mutex_;
+    size_t capacity_;
+    size_t used_ = 0;
+    std::list<Slot> lru_; // front = most recently used
+    std::unordered_map<std::pair<uint64_t, uint64_t>, std::list<Slot>::iterator, IdHash> slots_;
+};
+
+// A small log-structured merge tree for metadata that must outgrow RAM.
+//
+// Writes go to a write-ahead log and a sorted in-memory table; when that
+// fills it is flushed to an immutable SSTable (sorted data blocks, a sparse
+// in-memory index of each block's first key and a bloom filter). Reads
+// check the memtable, then tables newest to oldest, skipping tables whose
+// bloom filter rules the key out; blocks go through a shared LRU cache. A
+// background thread merges runs of similarly sized tables (size-tiered
+// compaction) so the table count stays logarithmic.
+class KvStore
+{
+public:
+    struct Options
+    {
+        size_t memtable_bytes = 4 << 20;
+        size_t block_bytes = 4096;
+        size_t block_cache_bytes = 32 << 20;
+        int bloom_bits_per_key = 10;
+        int compaction_fanout = 4; // tables per tier before they are merged
+        bool sync = false;         // fdatasync the WAL on every batch
+    };
+
+    explicit KvStore(const Options &options);
+    ~KvStore();
+
+    bool Open(const std::string &dir, std::string *error);
+
+    int Write(const WriteBatch &batch);
+    // 0 on success, -ENOENT if the key is absent or deleted.
+    int Get(const std::string &key, std::string *value);
+    // Visits live keys starting with `prefix` in order until fn returns false.
+    int Scan(const std::string &prefix, const std::function<bool(const std::string &, const std::string &)> &fn);
+
+private:
+    using MemTable = std::map<std::string, BlockCache::Entry>;
+
+    bool ReplayWal(std::string *error);
+    bool WriteManifest();
+    int Flush();
+    int BuildTable(uint64_t number, uint64_t expected_keys, bool drop_tombstones,
+                   const std::function<bool(BlockCache::Entry *)> &next, std::shared_ptr<SsTable> *table);
+    void CompactLoop();
+    bool CompactOnce();
+
+    Options options_;
+    std::string dir_;
+    BlockCache cache_;
+
+    std::shared_mutex mutex_;
+    MemTable memtable_;
+    size_t memtable_bytes_ = 0;
+    std::vector<std::shared_ptr<SsTable>> tables_; // oldest first
+    uint64_t next_table_ = 1;
+    int wal_fd_ = -1;
+
+    std::mutex compact_mutex_;
+    std::condition_variable compact_cv_;
+    bool stopped_ = false;
+    std::thread compactor_;
+};
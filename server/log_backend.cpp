@@ -0,0 +1,333 @@
+#include "log_backend.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+static const char kWrite = 'W';
+static const char kUnlink = 'U';
+
+LogBackend::~LogBackend()
+{
+    {
+        std::lock_guard<std::mutex> lock(clean_mutex_);
+        stopped_ = true;
+    }
+    clean_cv_.notify_all();
+    if (cleaner_.joinable())
+        cleaner_.join();
+    if (root_fd_ >= 0)
+        close(root_fd_);
+}
+
+bool LogBackend::Open(const std::string &root, std::string *error)
+{
+    root_fd_ = open(root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd_ < 0)
+    {
+        *error = "cannot open storage root " + root + ": " + strerror(errno);
+        return false;
+    }
+    if (!log_.Open(root_fd_, "log", options_.segment_bytes, options_.sync, error))
+        return false;
+
+    bool ok = log_.Scan([this](const SegmentRecord &record) {
+        if (record.type == kUnlink)
+        {
+            auto it = files_.find(record.path);
+            if (it != files_.end())
+            {
+                Drop(it->second);
+                files_.erase(it);
+            }
+            return;
+        }
+        File &file = files_[record.path];
+        Insert(file, record.file_offset, record.location);
+        // The cleaner re-appends old extents with their original mtime.
+        file.mtime = std::max(file.mtime, record.mtime);
+    }, error);
+    if (!ok)
+        return false;
+
+    if (options_.clean_interval_ms > 0)
+        cleaner_ = std::thread([this] { CleanLoop(); });
+    return true;
+}
+
+void LogBackend::Punch(File &file, uint64_t start, uint64_t end)
+{
+    auto it = file.extents.lower_bound(start);
+    if (it != file.extents.begin())
+    {
+        auto prev = std::prev(it);
+        if (prev->first + prev->second.length > start)
+            it = prev;
+    }
+
+    while (it != file.extents.end() && it->first < end)
+    {
+        uint64_t extent_start = it->first;
+        Extent extent = it->second;
+        uint64_t extent_end = extent_start + extent.length;
+        it = file.extents.erase(it);
+
+        if (extent_start < start)
+        {
+            Extent head = extent;
+            head.length = start - extent_start;
+            file.extents[extent_start] = head;
+        }
+        if (extent_end > end)
+        {
+            Extent tail = extent;
+            tail.skip += end - extent_start;
+            tail.length = extent_end - end;
+            it = file.extents.emplace(end, tail).first;
+        }
+
+        uint64_t overlap = std::min(extent_end, end) - std::max(extent_start, start);
+        live_bytes_[extent.location.segment] -= overlap;
+    }
+}
+
+void LogBackend::Insert(File &file, uint64_t offset, const SegmentLocation &location)
+{
+    Punch(file, offset, offset + location.length);
+    if (location.length > 0)
+    {
+        Extent extent;
+        extent.location = location;
+        extent.length = location.length;
+        file.extents[offset] = extent;
+        live_bytes_[location.segment] += location.length;
+    }
+    file.size = std::max(file.size, offset + location.length);
+}
+
+void LogBackend::Drop(File &file)
+{
+    for (const auto &entry : file.extents)
+        live_bytes_[entry.second.location.segment] -= entry.second.length;
+    file.extents.clear();
+}
+
+ssize_t LogBackend::Read(const std::string &path, char *buf, size_t size, off_t offset)
+{
+    std::string key;
+    if (!NormalizePath(path, &key))
+        return -EACCES;
+
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto found = files_.find(key);
+    if (found == files_.end())
+        return -ENOENT;
+    const File &file = found->second;
+    if ((uint64_t)offset >= file.size)
+        return 0;
+    size = std::min<uint64_t>(size, file.size - offset);
+
+    // Holes between extents read as zeros, like a sparse file.
+    memset(buf, 0, size);
+    uint64_t start = offset;
+    uint64_t end = start + size;
+    auto it = file.extents.upper_bound(start);
+    if (it != file.extents.begin())
+        --it;
+    for (; it != file.extents.end() && it->first < end; ++it)
+    {
+        uint64_t extent_start = it->first;
+        uint64_t extent_end = extent_start + it->second.length;
+        if (extent_end <= start)
+            continue;
+        uint64_t lo = std::max(start, extent_start);
+        uint64_t hi = std::min(end, extent_end);
+        ssize_t n = log_.Read(it->second.location, it->second.skip + (lo - extent_start), buf + (lo - start), hi - lo);
+        if (n < 0)
+            return n;
+    }
+    return size;
+}
+
+ssize_t LogBackend::Write(const std::string &path, const char *data, size_t size, off_t offset)
+{
+    std::string key;
+    if (!NormalizePath(path, &key))
+        return -EACCES;
+
+    // Appending under the map lock keeps log order equal to the order the
+    // extent maps saw, so replay rebuilds exactly the same state.
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    int64_t mtime = std::time(nullptr);
+    SegmentLocation location;
+    int result = log_.Append(kWrite, key, offset, mtime, data, size, &location);
+    if (result < 0)
+        return result;
+
+    File &file = files_[key];
+    Insert(file, offset, location);
+    file.mtime = mtime;
+    return size;
+}
+
+int LogBackend::GetAttr(const std::string &path, FileAttr *attr)
+{
+    std::string key;
+    if (!NormalizePath(path, &key))
+        return -EACCES;
+
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = files_.find(key);
+    if (it == files_.end())
+        return -ENOENT;
+    attr->size = it->second.size;
+    attr->mtime = it->second.mtime;
+    return 0;
+}
+
+int LogBackend::Unlink(const std::string &path)
+{
+    std::string key;
+    if (!NormalizePath(path, &key))
+        return -EACCES;
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto it = files_.find(key);
+    if (it == files_.end())
+        return -ENOENT;
+    SegmentLocation location;
+    int result = log_.Append(kUnlink, key, 0, std::time(nullptr), nullptr, 0, &location);
+    if (result < 0)
+        return result;
+    Drop(it->second);
+    files_.erase(it);
+    return 0;
+}
+
+int LogBackend::Relocate(const std::string &path, uint64_t offset, Extent &extent, int64_t mtime)
+{
+    std::string data(extent.length, '\0');
+    ssize_t n = log_.Read(extent.location, extent.skip, &data[0], data.size());
+    if (n != (ssize_t)data.size())
+        return n < 0 ? n : -EIO;
+
+    SegmentLocation location;
+    int result = log_.Append(kWrite, path, offset, mtime, data.data(), data.size(), &location);
+    if (result < 0)
+        return result;
+    live_bytes_[extent.location.segment] -= extent.length;
+    live_bytes_[location.segment] += extent.length;
+    extent.location = location;
+    extent.skip = 0;
+    return 0;
+}
+
+int LogBackend::CarrySize(const std::string &path, const File &file)
+{
+    uint64_t covered = 0;
+    if (!file.extents.empty())
+        covered = file.extents.rbegin()->first + file.extents.rbegin()->second.length;
+    if (covered >= file.size && covered > 0)
+        return 0;
+    SegmentLocation location;
+    int result = log_.Append(kWrite, path, file.size, file.mtime, nullptr, 0, &location);
+    if (result < 0)
+        std::cerr << "[LOG] cannot carry the size of " << path << " forward" << std::endl;
+    return result;
+}
+
+void LogBackend::CleanLoop()
+{
+    std::unique_lock<std::mutex> lock(clean_mutex_);
+    while (!clean_cv_.wait_for(lock, std::chrono::milliseconds(options_.clean_interval_ms), [this] { return stopped_; }))
+    {
+        lock.unlock();
+        uint64_t active = log_.active_segment();
+        for (const auto &entry : log_.SegmentSizes())
+        {
+            uint64_t segment = entry.first;
+            uint64_t size = entry.second;
+            if (segment == active || size == 0)
+                continue;
+
+            uint64_t live;
+            {
+                std::shared_lock<std::shared_mutex> files_lock(mutex_);
+                live = live_bytes_[segment];
+            }
+            if (live * 100 < size * options_.clean_live_percent)
+                CleanSegment(segment);
+        }
+        lock.lock();
+    }
+}
+
+void LogBackend::CleanSegment(uint64_t segment)
+{
+    uint64_t oldest = log_.SegmentSizes().begin()->first;
+    uint64_t moved = 0;
+    bool kept = true; // every tombstone and size record carried forward
+
+    bool ok = log_.ScanSegment(segment, [&](const SegmentRecord &record) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = files_.find(record.path);
+
+        if (record.type == kUnlink)
+        {
+            // Nothing older is left for the tombstone to hide.
+            if (segment == oldest)
+                return;
+            SegmentLocation location;
+            if (log_.Append(kUnlink, record.path, 0, record.mtime, nullptr, 0, &location) < 0)
+            {
+                kept = false;
+                return;
+            }
+            // Recreated since: its extents must stay behind the tombstone.
+            if (it != files_.end())
+            {
+                for (auto &entry : it->second.extents)
+                {
+                    if (Relocate(record.path, entry.first, entry.second, it->second.mtime) == 0)
+                        moved++;
+                }
+                kept &= CarrySize(record.path, it->second) == 0;
+            }
+            return;
+        }
+        if (it == files_.end())
+            return;
+
+        // Extents cut from this record all start inside its original range.
+        uint64_t start = record.file_offset;
+        uint64_t end = start + record.location.length;
+        for (auto e = it->second.extents.lower_bound(start); e != it->second.extents.end() && e->first < end; ++e)
+        {
+            if (e->second.location.segment != segment || e->second.location.offset != record.location.offset)
+                continue;
+            if (Relocate(record.path, e->first, e->second, record.mtime) == 0)
+                moved++;
+            else
+                std::cerr << "[LOG] cannot move " << record.path << " out of segment " << segment << std::endl;
+        }
+        if (end == it->second.size)
+            kept &= CarrySize(record.path, it->second) == 0;
+    });
+    if (!ok)
+        return;
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    // An extent or record that failed to move is still needed; keep the
+    // segment.
+    if (!kept || live_bytes_[segment] != 0)
+        return;
+    live_bytes_.erase(segment);
+    log_.Remove(segment);
+    std::cerr << "[LOG] Cleaned segment " << segment << " (" << moved << " live extents moved)" << std::endl;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "segment_log.h"
+#include "storage_backend.h"
+
+// Log-structured storage: every write, at any file offset, is appended as
+// an extent record to the active segment under <root>/log, so concurrent
+// random writers produce purely sequential disk I/O. Each file is an
+// in-memory extent map (file offset -> slice of a segment record) that
+// newer writes split and overwrite. A background cleaner re-appends the
+// still-live extents of segments that are mostly overwritten and deletes
+// them. The extent maps are rebuilt by replaying the log at startup.
+class LogBackend final : public StorageBackend
+{
+public:
+    struct Options
+    {
+        uint64_t segment_bytes = 256 << 20;
+        bool sync = false;
+        int clean_interval_ms = 10000;
+        int clean_live_percent = 50; // clean segments with less live data
+    };
+
+    explicit LogBackend(const Options &options) : options_(options) {}
+    ~LogBackend();
+
+    bool Open(const std::string &root, std::string *error);
+
+    ssize_t Read(const std::string &path, char *buf, size_t size, off_t offset) override;
+    ssize_t Write(const std::string &path, const char *data, size_t size, off_t offset) override;
+    int GetAttr(const std::string &path, FileAttr *attr) override;
+    int Unlink(const std::string &path) override;
+
+private:
+    struct Extent
+    {
+        SegmentLocation location; // the whole record
+        uint64_t skip = 0;        // first payload byte this extent uses
+        uint64_t length = 0;
+    };
+
+    struct File
+    {
+        std::map<uint64_t, Extent> extents; // keyed by file offset
+        uint64_t size = 0;
+        int64_t mtime = 0;
+    };
+
+    // Callers hold mutex_ exclusively.
+    void Insert(File &file, uint64_t offset, const SegmentLocation &location);
+    void Punch(File &file, uint64_t start, uint64_t end);
+    void Drop(File &file);
+    int Relocate(const std::string &path, uint64_t offset, Extent &extent, int64_t mtime);
+    // A file's existence and size can rest on records with no live extent
+    // (a create is a zero-length write, as is setting the size past the
+    // end). Before such a record's segment goes, this appends a
+    // zero-length record at the file's size unless extents still reach it.
+    int CarrySize(const std::string &path, const File &file);
+
+    void CleanLoop();
+    void CleanSegment(uint64_t segment);
+
+    Options options_;
+    int root_fd_ = -1;
+    SegmentLog log_;
+
+    std::shared_mutex mutex_;
+    std::unordered_map<std::string, File> files_;
+    std::map<uint64_t, uint64_t> live_bytes_; // live payload bytes per segment
+
+    std::mutex clean_mutex_;
+    std::condition_variable clean_cv_;
+    bool stopped_ = false;
+    std::thread cleaner_;
+};
@@ -0,0 +1,202 @@
+#include "metadata_store.h"
+
+#include <cerrno>
+#include <cstring>
+
+static const char kFilePrefix[] = "f:";
+static const char kDirPrefix[] = "d:";
+
+// "a/b/c" -> ("a/b", "c"); "c" -> ("", "c").
+static void SplitParent(const std::string &path, std::string *parent, std::string *name)
+{
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos)
+    {
+        parent->clear();
+        *name = path;
+        return;
+    }
+    *parent = path.substr(0, slash);
+    *name = path.substr(slash + 1);
+}
+
+static std::string DirKey(const std::string &dir, const std::string &name)
+{
+    std::string key = kDirPrefix + dir;
+    key += '\0';
+    return key + name;
+}
+
+static std::string EncodeMeta(const FileMeta &meta)
+{
+    return std::string((const char *)&meta, sizeof(meta));
+}
+
+int MemoryMetadataStore::GetFile(const std::string &path, FileMeta *meta)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = files_.find(path);
+    if (it == files_.end())
+        return -ENOENT;
+    *meta = it->second;
+    return 0;
+}
+
+int MemoryMetadataStore::PutFile(const std::string &path, const FileMeta &meta)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (files_.insert_or_assign(path, meta).second)
+    {
+        std::string child = path, parent, name;
+        do
+        {
+            SplitParent(child, &parent, &name);
+            dirs_[parent].insert(name);
+            child = parent;
+        } while (!child.empty());
+    }
+    return 0;
+}
+
+int MemoryMetadataStore::DeleteFile(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (files_.erase(path) == 0)
+        return -ENOENT;
+
+    // Remove the entry, then any directories it leaves empty.
+    std::string child = path, parent, name;
+    do
+    {
+        SplitParent(child, &parent, &name);
+        auto dir = dirs_.find(parent);
+        if (dir == dirs_.end())
+            break;
+        dir->second.erase(name);
+        if (!dir->second.empty())
+            break;
+        dirs_.erase(dir);
+        child = parent;
+    } while (!child.empty());
+    return 0;
+}
+
+int MemoryMetadataStore::ListDirectory(const std::string &dir, std::vector<std::string> *names)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    names->clear();
+    auto it = dirs_.find(dir);
+    if (it == dirs_.end())
+        return dir.empty() ? 0 : -ENOENT;
+    names->assign(it->second.begin(), it->second.end());
+    return 0;
+}
+
+int KvMetadataStore::GetFile(const std::string &path, FileMeta *meta)
+{
+    std::string value;
+    int result = kv_.Get(kFilePrefix + path, &value);
+    if (result < 0)
+        return result;
+    if (value.size() != sizeof(*meta))
+        return -EIO;
+    memcpy(meta, value.data(), sizeof(*meta));
+    return 0;
+}
+
+int KvMetadataStore::PutFile(const std::string &path, const FileMeta &meta)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    WriteBatch batch;
+    batch.Put(kFilePrefix + path, EncodeMeta(meta));
+
+    // Only a new file adds directory entries; updates are a single put.
+    std::string existing;
+    if (kv_.Get(kFilePrefix + path, &existing) == -ENOENT)
+    {
+        std::string child = path, parent, name;
+        do
+        {
+            SplitParent(child, &parent, &name);
+            batch.Put(DirKey(parent, name), std::string());
+            child = parent;
+        } while (!child.empty());
+    }
+    return kv_.Write(batch);
+}
+
+int KvMetadataStore::DeleteFile(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string existing;
+    int result = kv_.Get(kFilePrefix + path, &existing);
+    if (result < 0)
+        return result;
+
+    WriteBatch batch;
+    batch.Delete(kFilePrefix + path);
+    std::string parent, name;
+    SplitParent(path, &parent, &name);
+    batch.Delete(DirKey(parent, name));
+    result = kv_.Write(batch);
+
+    // Prune directories the delete left empty, bottom up.
+    while (result == 0 && !parent.empty())
+    {
+        bool empty = true;
+        kv_.Scan(DirKey(parent, ""), [&](const std::string &, const std::string &) {
+            empty = false;
+            return false;
+        });
+        if (!empty)
+            break;
+        std::string dir = parent;
+        SplitParent(dir, &parent, &name);
+        WriteBatch prune;
+        prune.Delete(DirKey(parent, name));
+        result = kv_.Write(prune);
+    }
+    return result;
+}
+
+int KvMetadataStore::ListDirectory(const std::string &dir, std::vector<std::string> *names)
+{
+    names->clear();
+    std::string prefix = DirKey(dir, "");
+    kv_.Scan(prefix, [&](const std::string &key, const std::string &) {
+        names->push_back(key.substr(prefix.size()));
+        return true;
+    });
+    return names->empty() && !dir.empty() ? -ENOENT : 0;
+}
+
+std::unique_ptr<MetadataStore> CreateMetadataStore(const dfs::Config &config, std::string *error)
+{
+    std::string kind = config.GetString("metadata.backend", "memory");
+    if (kind == "memory")
+        return std::unique_ptr<MetadataStore>(new MemoryMetadataStore());
+
+    if (kind == "lsm")
+    {
+        std::string dir = config.GetString("metadata.dir", "");
+        if (dir.empty())
+        {
+            *error = "metadata.backend=lsm needs metadata.dir (outside storage.root)";
+            return nullptr;
+        }
+        KvStore::Options options;
+        options.memtable_bytes = config.GetInt("metadata.lsm.memtable_bytes", options.memtable_bytes);
+        options.block_bytes = config.GetInt("metadata.lsm.block_bytes", options.block_bytes);
+        options.block_cache_bytes = config.GetInt("metadata.lsm.block_cache_bytes", options.block_cache_bytes);
+        options.bloom_bits_per_key = config.GetInt("metadata.lsm.bloom_bits_per_key", options.bloom_bits_per_key);
+        options.compaction_fanout = config.GetInt("metadata.lsm.compaction_fanout", options.compaction_fanout);
+        options.sync = config.GetBool("metadata.lsm.sync", options.sync);
+        std::unique_ptr<KvMetadataStore> store(new KvMetadataStore(options));
+        if (!store->Open(dir, error))
+            return nullptr;
+        return store;
+    }
+
+    *error = "unknown metadata.backend '" + kind + "'";
+    return nullptr;
+}
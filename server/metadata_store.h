@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../common/config.h"
+#include "kv_store.h"
+
+// Per-file metadata the server tracks beyond what the storage backend
+// keeps: the last-writer-wins version, the last size/mtime it saw and a
+// generation that changes on every write (clients validate caches by it).
+struct FileMeta
+{
+    int64_t version = 0;
+    int64_t size = 0;
+    int64_t mtime = 0;
+    int64_t generation = 0;
+};
+
+// File versions and directory entries. Functions return 0 or -errno.
+class MetadataStore
+{
+public:
+    virtual ~MetadataStore() = default;
+
+    virtual int GetFile(const std::string &path, FileMeta *meta) = 0;
+    // Creates or updates the file and the directory entries leading to it.
+    virtual int PutFile(const std::string &path, const FileMeta &meta) = 0;
+    virtual int DeleteFile(const std::string &path) = 0;
+    // Names directly inside `dir` ("" for the root), sorted.
+    virtual int ListDirectory(const std::string &dir, std::vector<std::string> *names) = 0;
+};
+
+// Everything in RAM; lost on restart. Fine for small deployments.
+class MemoryMetadataStore final : public MetadataStore
+{
+public:
+    int GetFile(const std::string &path, FileMeta *meta) override;
+    int PutFile(const std::string &path, const FileMeta &meta) override;
+    int DeleteFile(const std::string &path) override;
+    int ListDirectory(const std::string &dir, std::vector<std::string> *names) override;
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, FileMeta> files_;
+    std::map<std::string, std::set<std::string>> dirs_;
+};
+
+// Persistent store on the LSM KvStore, for namespaces that outgrow RAM.
+// Keys: "f:<path>" -> FileMeta, "d:<dir>\0<name>" -> "" per directory
+// entry, so listing a directory is a prefix scan.
+class KvMetadataStore final : public MetadataStore
+{
+public:
+    explicit KvMetadataStore(const KvStore::Options &options) : kv_(options) {}
+
+    bool Open(const std::string &dir, std::string *error) { return kv_.Open(dir, error); }
+
+    int GetFile(const std::string &path, FileMeta *meta) override;
+    int PutFile(const std::string &path, const FileMeta &meta) override;
+    int DeleteFile(const std::string &path) override;
+    int ListDirectory(const std::string &dir, std::vector<std::string> *names) override;
+
+private:
+    // Serializes namespace changes so directory entries stay consistent.
+    std::mutex mutex_;
+    KvStore kv_;
+};
+
+// Picks the store named by metadata.backend ("memory" or "lsm").
+std::unique_ptr<MetadataStore> CreateMetadataStore(const dfs::Config &config, std::string *error);
@@ -0,0 +1,289 @@
+#include "packed_backend.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+static const char kPut = 'P';
+static const char kTombstone = 'D';
+
+PackedBackend::~PackedBackend()
+{
+    {
+        std::lock_guard<std::mutex> lock(compact_mutex_);
+        stopped_ = true;
+    }
+    compact_cv_.notify_all();
+    if (compactor_.joinable())
+        compactor_.join();
+    if (root_fd_ >= 0)
+        close(root_fd_);
+}
+
+bool PackedBackend::Open(const std::string &root, std::string *error)
+{
+    root_fd_ = open(root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd_ < 0)
+    {
+        *error = "cannot open storage root " + root + ": " + strerror(errno);
+        return false;
+    }
+    if (mkdirat(root_fd_, "large", 0755) != 0 && errno != EEXIST)
+    {
+        *error = std::string("cannot create large-file directory: ") + strerror(errno);
+        return false;
+    }
+    if (!large_.Open(root + "/large", error))
+        return false;
+    if (!log_.Open(root_fd_, "segments", options_.segment_bytes, options_.sync, error))
+        return false;
+
+    bool ok = log_.Scan([this](const SegmentRecord &record) {
+        auto it = index_.find(record.path);
+        if (it != index_.end())
+        {
+            MarkDead(it->second.location);
+            index_.erase(it);
+        }
+        if (record.type == kPut)
+        {
+            index_[record.path] = {record.location, record.mtime};
+            MarkLive(record.location);
+        }
+    }, error);
+    if (!ok)
+        return false;
+
+    if (options_.compact_interval_ms > 0)
+        compactor_ = std::thread([this] { CompactLoop(); });
+    return true;
+}
+
+void PackedBackend::MarkLive(const SegmentLocation &location)
+{
+    live_bytes_[location.segment] += location.record_bytes;
+}
+
+void PackedBackend::MarkDead(const SegmentLocation &location)
+{
+    auto it = live_bytes_.find(location.segment);
+    if (it != live_bytes_.end())
+        it->second -= std::min(it->second, location.record_bytes);
+}
+
+int PackedBackend::AppendTombstone(const std::string &path)
+{
+    SegmentLocation location;
+    return log_.Append(kTombstone, path, 0, std::time(nullptr), nullptr, 0, &location);
+}
+
+ssize_t PackedBackend::Read(const std::string &path, char *buf, size_t size, off_t offset)
+{
+    std::string key;
+    if (!NormalizePath(path, &key))
+        return -EACCES;
+
+    {
+        // Held across the pread so compaction cannot remove the segment.
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it != index_.end())
+            return log_.Read(it->second.location, offset, buf, size);
+    }
+    return large_.Read(key, buf, size, offset);
+}
+
+ssize_t PackedBackend::Write(const std::string &path, const char *data, size_t size, off_t offset)
+{
+    std::string key;
+    if (!NormalizePath(path, &key))
+        return -EACCES;
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end())
+    {
+        FileAttr attr;
+        if (large_.GetAttr(key, &attr) == 0)
+        {
+            lock.unlock();
+            return large_.Write(key, data, size, offset);
+        }
+    }
+
+    uint64_t existing = it != index_.end() ? it->second.location.length : 0;
+    uint64_t end = std::max<uint64_t>(existing, (uint64_t)offset + size);
+    if (end > options_.max_inline_bytes)
+    {
+        // Outgrew the segment store: copy what is packed to the large
+        // store, apply the write there (sparse, however far out it lands),
+        // then tombstone the packed copy.
+        if (it != index_.end())
+        {
+            std::string content(existing, '\0');
+            ssize_t n = log_.Read(it->second.location, 0, &content[0], content.size());
+            if (n >= 0)
+                n = large_.Write(key, content.data(), content.size(), 0);
+            if (n < 0)
+                return n;
+        }
+        ssize_t n = large_.Write(key, data, size, offset);
+        if (n < 0)
+            return n;
+        if (it != index_.end())
+        {
+            int result = AppendTombstone(key);
+            if (result < 0)
+                return result;
+            MarkDead(it->second.location);
+            index_.erase(it);
+        }
+        return n;
+    }
+
+    // Small files are rewritten whole: read, patch, append.
+    std::string content(end, '\0');
+    if (existing > 0)
+    {
+        ssize_t n = log_.Read(it->second.location, 0, &content[0], existing);
+        if (n < 0)
+            return n;
+    }
+    memcpy(&content[offset], data, size);
+
+    int64_t mtime = std::time(nullptr);
+    SegmentLocation location;
+    int result = log_.Append(kPut, key, 0, mtime, content.data(), content.size(), &location);
+    if (result < 0)
+        return result;
+    if (it != index_.end())
+        MarkDead(it->second.location);
+    MarkLive(location);
+    index_[key] = {location, mtime};
+    return size;
+}
+
+int PackedBackend::GetAttr(const std::string &path, FileAttr *attr)
+{
+    std::string key;
+    if (!NormalizePath(path, &key))
+        return -EACCES;
+
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it != index_.end())
+        {
+            attr->size = it->second.location.length;
+            attr->mtime = it->second.mtime;
+            return 0;
+        }
+    }
+    return large_.GetAttr(key, attr);
+}
+
+int PackedBackend::Unlink(const std::string &path)
+{
+    std::string key;
+    if (!NormalizePath(path, &key))
+        return -EACCES;
+
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it != index_.end())
+        {
+            int result = AppendTombstone(key);
+            if (result < 0)
+                return result;
+            MarkDead(it->second.location);
+            index_.erase(it);
+            return 0;
+        }
+    }
+    return large_.Unlink(key);
+}
+
+void PackedBackend::CompactLoop()
+{
+    std::unique_lock<std::mutex> lock(compact_mutex_);
+    while (!compact_cv_.wait_for(lock, std::chrono::milliseconds(options_.compact_interval_ms), [this] { return stopped_; }))
+    {
+        lock.unlock();
+        uint64_t active = log_.active_segment();
+        for (const auto &entry : log_.SegmentSizes())
+        {
+            uint64_t segment = entry.first;
+            uint64_t size = entry.second;
+            if (segment == active || size == 0)
+                continue;
+
+            uint64_t live;
+            {
+                std::shared_lock<std::shared_mutex> index_lock(mutex_);
+                live = live_bytes_[segment];
+            }
+            if (live * 100 < size * options_.compact_live_percent)
+                CompactSegment(segment);
+        }
+        lock.lock();
+    }
+}
+
+void PackedBackend::CompactSegment(uint64_t segment)
+{
+    uint64_t oldest = log_.SegmentSizes().begin()->first;
+    std::string data;
+    uint64_t moved = 0;
+
+    bool ok = log_.ScanSegment(segment, [&](const SegmentRecord &record) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = index_.find(record.path);
+
+        if (record.type == kTombstone)
+        {
+            // Still needed only while an older segment may hold a put for
+            // this path and the path has not been recreated since.
+            if (it == index_.end() && segment > oldest)
+                AppendTombstone(record.path);
+            return;
+        }
+
+        if (it == index_.end() || it->second.location.segment != segment ||
+            it->second.location.offset != record.location.offset)
+            return; // superseded
+
+        data.resize(record.location.length);
+        SegmentLocation location;
+        if (log_.Read(record.location, 0, &data[0], data.size()) != (ssize_t)data.size() ||
+            log_.Append(kPut, record.path, 0, record.mtime, data.data(), data.size(), &location) < 0)
+        {
+            std::cerr << "[PACKED] cannot move " << record.path << " out of segment " << segment << std::endl;
+            return;
+        }
+        MarkDead(it->second.location);
+        MarkLive(location);
+        it->second.location = location;
+        moved++;
+    });
+    if (!ok)
+        return;
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    // A record that failed to move is still referenced; keep the segment.
+    for (const auto &entry : index_)
+    {
+        if (entry.second.location.segment == segment)
+            return;
+    }
+    live_bytes_.erase(segment);
+    log_.Remove(segment);
+    std::cerr << "[PACKED] Compacted segment " << segment << " (" << moved << " live files moved)" << std::endl;
+}
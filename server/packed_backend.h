@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "hashed_backend.h"
+#include "segment_log.h"
+#include "storage_backend.h"
+
+// Packs small files into large append-only segment files (<root>/segments)
+// so millions of tiny files cost neither an inode nor a block each. An
+// in-memory index maps path -> (segment, offset, length), making a small
+// read a single pread. Every write appends a fresh copy of the whole (small)
+// file; unlinks append a tombstone. Both leave dead bytes behind, which a
+// background compactor reclaims by copying live records out of mostly-dead
+// segments and deleting them.
+//
+// Files that grow beyond max_inline_bytes move to a HashedBackend under
+// <root>/large.
+class PackedBackend final : public StorageBackend
+{
+public:
+    struct Options
+    {
+        uint64_t max_inline_bytes = 4096;
+        uint64_t segment_bytes = 64 << 20;
+        bool sync = false;
+        int compact_interval_ms = 10000;
+        int compact_live_percent = 50; // compact segments with less live data
+    };
+
+    explicit PackedBackend(const Options &options) : options_(options), large_(options.sync) {}
+    ~PackedBackend();
+
+    bool Open(const std::string &root, std::string *error);
+
+    ssize_t Read(const std::string &path, char *buf, size_t size, off_t offset) override;
+    ssize_t Write(const std::string &path, const char *data, size_t size, off_t offset) override;
+    int GetAttr(const std::string &path, FileAttr *attr) override;
+    int Unlink(const std::string &path) override;
+
+private:
+    struct Entry
+    {
+        SegmentLocation location;
+        int64_t mtime;
+    };
+
+    // Callers hold mutex_ exclusively.
+    void MarkLive(const SegmentLocation &location);
+    void MarkDead(const SegmentLocation &location);
+    int AppendTombstone(const std::string &path);
+
+    void CompactLoop();
+    void CompactSegment(uint64_t segment);
+
+    Options options_;
+    int root_fd_ = -1;
+    SegmentLog log_;
+    HashedBackend large_;
+
+    std::shared_mutex mutex_;
+    std::unordered_map<std::string, Entry> index_;
+    std::map<uint64_t, uint64_t> live_bytes_;
+
+    std::mutex compact_mutex_;
+    std::condition_variable compact_cv_;
+    bool stopped_ = false;
+    std::thread compactor_;
+};
@@ -0,0 +1,71 @@
+#include "posix_backend.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+ssize_t PosixBackend::Read(const std::string &path, char *buf, size_t size, off_t offset)
+{
+    int fd = root_.OpenFile(path, O_RDONLY);
+    if (fd < 0)
+        return fd;
+    ssize_t n = PreadFull(fd, buf, size, offset);
+    close(fd);
+    return n;
+}
+
+ssize_t PosixBackend::Write(const std::string &path, const char *data, size_t size, off_t offset)
+{
+    int fd = root_.OpenFile(path, O_WRONLY | O_CREAT);
+    if (fd < 0)
+        return fd;
+    ssize_t n = PwriteFull(fd, data, size, offset);
+    close(fd);
+    return n;
+}
+
+int PosixBackend::GetAttr(const std::string &path, FileAttr *attr)
+{
+    struct stat st;
+    int result = root_.Stat(path, &st);
+    if (result < 0)
+        return result;
+    attr->size = st.st_size;
+    attr->mtime = st.st_mtime;
+    return 0;
+}
+
+int PosixBackend::Unlink(const std::string &path)
+{
+    return root_.Unlink(path);
+}
+
+ssize_t PosixBackend::Prefetch(const std::string &path, size_t max_bytes)
+{
+    int fd = root_.OpenFile(path, O_RDONLY);
+    if (fd < 0)
+        return fd;
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        int error = errno;
+        close(fd);
+        return -error;
+    }
+    size_t length = std::min<size_t>(st.st_size, max_bytes);
+    int result = posix_fadvise(fd, 0, length, POSIX_FADV_WILLNEED);
+    close(fd);
+    return result == 0 ? (ssize_t)length : -result;
+}
+
+int PosixBackend::OpenHandle(const std::string &path, bool writable, std::unique_ptr<FileHandle> *handle)
+{
+    int fd = root_.OpenFile(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+        return fd;
+    handle->reset(new FdHandle(fd, writable));
+    return 0;
+}
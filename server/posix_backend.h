@@ -0,0 +1,26 @@
+#pragma once
+
+#include "export_root.h"
+#include "storage_backend.h"
+
+// Stores each client path as the same relative path under the export root.
+class PosixBackend final : public StorageBackend
+{
+public:
+    explicit PosixBackend(size_t dir_cache_entries) : root_(dir_cache_entries) {}
+
+    bool Open(const std::string &root, std::string *error) { return root_.Open(root, error); }
+
+    ssize_t Read(const std::string &path, char *buf, size_t size, off_t offset) override;
+    ssize_t Write(const std::string &path, const char *data, size_t size, off_t offset) override;
+    int GetAttr(const std::string &path, FileAttr *attr) override;
+    int Unlink(const std::string &path) override;
+    int OpenHandle(const std::string &path, bool writable, std::unique_ptr<FileHandle> *handle) override;
+    // Kernel readahead (POSIX_FADV_WILLNEED); returns without waiting for it.
+    ssize_t Prefetch(const std::string &path, size_t max_bytes) override;
+    int List(const std::string &dir, std::vector<DirEntry> *entries) override { return root_.List(dir, entries); }
+    int MakeDirectory(const std::string &dir) override { return root_.MakeDirectory(dir); }
+
+private:
+    ExportRoot root_;
+};
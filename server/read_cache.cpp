@@ -0,0 +1,362 @@
+#include "read_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+static const uint64_t kRowSeeds[] = {0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL,
+                                     0xcbf29ce484222325ULL};
+
+static size_t NextPowerOfTwo(size_t n)
+{
+    size_t p = 1;
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+FrequencySketch::FrequencySketch(size_t expected_entries)
+{
+    size_t width = NextPowerOfTwo(std::max<size_t>(expected_entries, 16));
+    mask_ = width - 1;
+    counters_.assign(kRows * width, 0);
+    doorkeeper_.assign(width * 8, false);
+    sample_ = width * 10;
+}
+
+size_t FrequencySketch::Index(uint64_t hash, int row) const
+{
+    uint64_t h = (hash + kRowSeeds[row]) * kRowSeeds[(row + 1) % kRows];
+    return row * (mask_ + 1) + ((h >> 32) & mask_);
+}
+
+void FrequencySketch::Increment(uint64_t hash)
+{
+    size_t d1 = hash & (doorkeeper_.size() - 1);
+    size_t d2 = (hash >> 32) & (doorkeeper_.size() - 1);
+    if (!doorkeeper_[d1] || !doorkeeper_[d2])
+    {
+        doorkeeper_[d1] = doorkeeper_[d2] = true;
+    }
+    else
+    {
+        for (int row = 0; row < kRows; row++)
+        {
+            uint8_t &counter = counters_[Index(hash, row)];
+            if (counter < 15)
+                counter++;
+        }
+    }
+    if (++additions_ >= sample_)
+        Age();
+}
+
+int FrequencySketch::Estimate(uint64_t hash) const
+{
+    int estimate = 15;
+    for (int row = 0; row < kRows; row++)
+        estimate = std::min<int>(estimate, counters_[Index(hash, row)]);
+    size_t d1 = hash & (doorkeeper_.size() - 1);
+    size_t d2 = (hash >> 32) & (doorkeeper_.size() - 1);
+    return estimate + (doorkeeper_[d1] && doorkeeper_[d2] ? 1 : 0);
+}
+
+void FrequencySketch::Age()
+{
+    for (uint8_t &counter : counters_)
+        counter >>= 1;
+    std::fill(doorkeeper_.begin(), doorkeeper_.end(), false);
+    additions_ /= 2;
+}
+
+size_t ReadCache::KeyHash::operator()(const Key &key) const
+{
+    return std::hash<std::string>()(key.path) ^ (key.block * 0x9e3779b97f4a7c15ULL);
+}
+
+ReadCache::ReadCache(size_t capacity_bytes, size_t block_bytes)
+    : capacity_(capacity_bytes), block_bytes_(block_bytes), sketch_(capacity_bytes / block_bytes)
+{
+}
+
+ReadCache::Block ReadCache::Lookup(const std::string &path, uint64_t block)
+{
+    Key key{path, block};
+    std::lock_guard<std::mutex> lock(mutex_);
+    sketch_.Increment(KeyHash()(key));
+    auto it = entries_.find(key);
+    if (it == entries_.end())
+        return nullptr;
+    Promote(it->second);
+    return it->second->data;
+}
+
+uint64_t ReadCache::epoch()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return epoch_;
+}
+
+void ReadCache::Insert(const std::string &path, uint64_t block, Block data, uint64_t epoch)
+{
+    Key key{path, block};
+    size_t size = data->size();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (epoch != epoch_ || size > capacity_ || entries_.count(key))
+        return;
+
+    // TinyLFU: once full, only admit a block hotter than the one it evicts.
+    if (probation_bytes_ + protected_bytes_ + size > capacity_)
+    {
+        EntryList &list = probation_.empty() ? protected_ : probation_;
+        if (!list.empty())
+        {
+            const Entry &victim = list.back();
+            if (sketch_.Estimate(KeyHash()(key)) <= sketch_.Estimate(KeyHash()({victim.path, victim.block})))
+                return;
+        }
+    }
+
+    probation_.push_front({path, block, std::move(data), kProbation});
+    probation_bytes_ += size;
+    entries_[key] = probation_.begin();
+    files_[path][block] = probation_.begin();
+    EvictToFit();
+}
+
+void ReadCache::Promote(EntryList::iterator it)
+{
+    if (it->segment == kProtected)
+    {
+        protected_.splice(protected_.begin(), protected_, it);
+        return;
+    }
+
+    // Second hit: probation -> protected, demoting protected's LRU tail
+    // back to probation if that segment is now over its share.
+    size_t size = it->data->size();
+    it->segment = kProtected;
+    protected_.splice(protected_.begin(), probation_, it);
+    probation_bytes_ -= size;
+    protected_bytes_ += size;
+    while (protected_bytes_ > capacity_ / 5 * 4 && protected_.size() > 1)
+    {
+        auto tail = std::prev(protected_.end());
+        tail->segment = kProbation;
+        protected_bytes_ -= tail->data->size();
+        probation_bytes_ += tail->data->size();
+        probation_.splice(probation_.begin(), protected_, tail);
+    }
+}
+
+void ReadCache::Remove(EntryList::iterator it)
+{
+    size_t size = it->data->size();
+    entries_.erase({it->path, it->block});
+    auto file = files_.find(it->path);
+    file->second.erase(it->block);
+    if (file->second.empty())
+        files_.erase(file);
+
+    if (it->segment == kProbation)
+    {
+        probation_bytes_ -= size;
+        probation_.erase(it);
+    }
+    else
+    {
+        protected_bytes_ -= size;
+        protected_.erase(it);
+    }
+}
+
+void ReadCache::EvictToFit()
+{
+    while (probation_bytes_ + protected_bytes_ > capacity_)
+    {
+        EntryList &list = probation_.empty() ? protected_ : probation_;
+        Remove(std::prev(list.end()));
+    }
+}
+
+void ReadCache::Invalidate(const std::string &path, uint64_t offset, uint64_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    epoch_++;
+    auto file = files_.find(path);
+    if (file == files_.end())
+        return;
+
+    uint64_t first = offset / block_bytes_;
+    uint64_t last = (offset + std::max<uint64_t>(size, 1) - 1) / block_bytes_;
+    std::vector<EntryList::iterator> stale;
+    for (const auto &entry : file->second)
+    {
+        if ((entry.first >= first && entry.first <= last) || entry.second->data->size() < block_bytes_)
+            stale.push_back(entry.second);
+    }
+    for (auto it : stale)
+        Remove(it);
+}
+
+void ReadCache::InvalidateFile(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    epoch_++;
+    auto file = files_.find(path);
+    if (file == files_.end())
+        return;
+    std::vector<EntryList::iterator> stale;
+    for (const auto &entry : file->second)
+        stale.push_back(entry.second);
+    for (auto it : stale)
+        Remove(it);
+}
+
+void ReadCache::SetCapacity(size_t capacity_bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capacity_bytes == capacity_)
+        return;
+    capacity_ = capacity_bytes;
+    sketch_ = FrequencySketch(capacity_bytes / block_bytes_);
+    EvictToFit();
+}
+
+// Reads and writes go to the inner backend's handle (a held fd where the
+// backend has one) while still hitting and invalidating the cache.
+class CachingBackend::CachedHandle final : public FileHandle
+{
+public:
+    CachedHandle(CachingBackend &backend, const std::string &key, std::unique_ptr<FileHandle> inner)
+        : backend_(backend), key_(key), inner_(std::move(inner))
+    {
+    }
+
+    ssize_t Read(char *buf, size_t size, off_t offset) override
+    {
+        return backend_.CachedRead(key_, buf, size, offset, [this](char *block, size_t length, off_t at) {
+            return inner_->Read(block, length, at);
+        });
+    }
+
+    ssize_t Write(const char *data, size_t size, off_t offset) override
+    {
+        ssize_t n = inner_->Write(data, size, offset);
+        backend_.cache_.Invalidate(key_, offset, size);
+        return n;
+    }
+
+private:
+    CachingBackend &backend_;
+    std::string key_;
+    std::unique_ptr<FileHandle> inner_;
+};
+
+ssize_t CachingBackend::Read(const std::string &path, char *buf, size_t size, off_t offset)
+{
+    std::string key;
+    if (!NormalizePath(path, &key))
+        return inner_->Read(path, buf, size, offset);
+    return CachedRead(key, buf, size, offset, [&](char *block, size_t length, off_t at) {
+        return inner_->Read(path, block, length, at);
+    });
+}
+
+ssize_t CachingBackend::CachedRead(const std::string &key, char *buf, size_t size, off_t offset,
+                                   const std::function<ssize_t(char *, size_t, off_t)> &fetch)
+{
+    uint64_t block_bytes = cache_.block_bytes();
+    size_t done = 0;
+    while (done < size)
+    {
+        uint64_t pos = offset + done;
+        uint64_t block = pos / block_bytes;
+        ReadCache::Block data = cache_.Lookup(key, block);
+        if (!data)
+        {
+            uint64_t epoch = cache_.epoch();
+            std::string fetched(block_bytes, '\0');
+            ssize_t n = fetch(&fetched[0], block_bytes, block * block_bytes);
+            if (n < 0)
+                return done > 0 ? done : n;
+            fetched.resize(n);
+            data = std::make_shared<const std::string>(std::move(fetched));
+            cache_.Insert(key, block, data, epoch);
+        }
+
+        uint64_t skip = pos - block * block_bytes;
+        if (skip >= data->size())
+            break;
+        size_t length = std::min<size_t>(data->size() - skip, size - done);
+        memcpy(buf + done, data->data() + skip, length);
+        done += length;
+        if (data->size() < block_bytes)
+            break; // end of file
+    }
+    return done;
+}
+
+ssize_t CachingBackend::Write(const std::string &path, const char *data, size_t size, off_t offset)
+{
+    ssize_t n = inner_->Write(path, data, size, offset);
+    std::string key;
+    if (NormalizePath(path, &key))
+        cache_.Invalidate(key, offset, size);
+    return n;
+}
+
+int CachingBackend::GetAttr(const std::string &path, FileAttr *attr)
+{
+    return inner_->GetAttr(path, attr);
+}
+
+int CachingBackend::Unlink(const std::string &path)
+{
+    int result = inner_->Unlink(path);
+    std::string key;
+    if (NormalizePath(path, &key))
+        cache_.InvalidateFile(key);
+    return result;
+}
+
+void CachingBackend::ApplyRuntimeConfig(const dfs::Config &config)
+{
+    cache_.SetCapacity(config.GetInt("storage.cache.bytes", 128 << 20));
+    inner_->ApplyRuntimeConfig(config);
+}
+
+ssize_t CachingBackend::Prefetch(const std::string &path, size_t max_bytes)
+{
+    std::string key;
+    if (!NormalizePath(path, &key))
+        return inner_->Prefetch(path, max_bytes);
+    std::string scratch(cache_.block_bytes(), '\0');
+    size_t done = 0;
+    while (done < max_bytes)
+    {
+        ssize_t n = CachedRead(key, &scratch[0], std::min(scratch.size(), max_bytes - done), done,
+                               [&](char *block, size_t length, off_t at) {
+                                   return inner_->Read(path, block, length, at);
+                               });
+        if (n < 0)
+            return done > 0 ? done : n;
+        if (n == 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+int CachingBackend::OpenHandle(const std::string &path, bool writable, std::unique_ptr<FileHandle> *handle)
+{
+    std::string key;
+    if (!NormalizePath(path, &key))
+        return inner_->OpenHandle(path, writable, handle);
+    std::unique_ptr<FileHandle> inner;
+    int result = inner_->OpenHandle(path, writable, &inner);
+    if (result < 0)
+        return result;
+    handle->reset(new CachedHandle(*this, key, std::move(inner)));
+    return 0;
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "storage_backend.h"
+
+// Approximate access frequencies for TinyLFU admission: a count-min sketch
+// of small saturating counters behind a "doorkeeper" bit set that absorbs
+// keys seen only once. All counts are halved every `sample` increments so
+// old popularity fades.
+class FrequencySketch
+{
+public:
+    explicit FrequencySketch(size_t expected_entries);
+
+    void Increment(uint64_t hash);
+    int Estimate(uint64_t hash) const;
+
+private:
+    size_t Index(uint64_t hash, int row) const;
+    void Age();
+
+    static const int kRows = 4;
+    size_t mask_;
+    std::vector<uint8_t> counters_; // kRows rows of mask_+1 counters
+    std::vector<bool> doorkeeper_;
+    size_t additions_ = 0;
+    size_t sample_;
+};
+
+// In-memory cache of fixed-size file blocks, keyed by (path, block index).
+//
+// Resident blocks live in a segmented LRU: new blocks enter the probation
+// segment and move to the protected segment (80% of the capacity) on a
+// second hit, so one pass over a big file can only churn probation. When
+// the cache is full a new block is admitted only if the sketch says it is
+// accessed more often than the block it would evict (TinyLFU); a cold scan
+// is therefore mostly never cached at all.
+class ReadCache
+{
+public:
+    using Block = std::shared_ptr<const std::string>;
+
+    ReadCache(size_t capacity_bytes, size_t block_bytes);
+
+    size_t block_bytes() const { return block_bytes_; }
+
+    // Counts the access and returns the cached block, or nullptr.
+    Block Lookup(const std::string &path, uint64_t block);
+    // Bumped by every invalidation; pass the value read before fetching a
+    // block to Insert() so a block that raced with a write is dropped.
+    uint64_t epoch();
+    void Insert(const std::string &path, uint64_t block, Block data, uint64_t epoch);
+
+    // Drops blocks overlapping [offset, offset + size) and any short tail
+    // block, whose missing bytes the write may have made readable.
+    void Invalidate(const std::string &path, uint64_t offset, uint64_t size);
+    void InvalidateFile(const std::string &path);
+
+    void SetCapacity(size_t capacity_bytes);
+
+private:
+    enum Segment
+    {
+        kProbation,
+        kProtected
+    };
+
+    struct Entry
+    {
+        std::string path;
+        uint64_t block;
+        Block data;
+        Segment segment;
+    };
+    using EntryList = std::list<Entry>;
+
+    struct Key
+    {
+        std::string path;
+        uint64_t block;
+        bool operator==(const Key &other) const { return block == other.block && path == other.path; }
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const;
+    };
+
+    // Require mutex_ held.
+    void Remove(EntryList::iterator it);
+    void EvictToFit();
+    void Promote(EntryList::iterator it);
+
+    std::mutex mutex_;
+    size_t capacity_;
+    size_t block_bytes_;
+    FrequencySketch sketch_;
+    uint64_t epoch_ = 0;
+
+    EntryList probation_; // front = most recent
+    EntryList protected_;
+    size_t probation_bytes_ = 0;
+    size_t protected_bytes_ = 0;
+    std::unordered_map<Key, EntryList::iterator, KeyHash> entries_;
+    // Cached block indices per file, for invalidation.
+    std::unordered_map<std::string, std::map<uint64_t, EntryList::iterator>> files_;
+};
+
+// Serves reads of any backend through a ReadCache; writes and unlinks go
+// straight to the backend and invalidate the affected blocks.
+class CachingBackend final : public StorageBackend
+{
+public:
+    CachingBackend(std::unique_ptr<StorageBackend> inner, size_t capacity_bytes, size_t block_bytes)
+        : inner_(std::move(inner)), cache_(capacity_bytes, block_bytes)
+    {
+    }
+
+    ssize_t Read(const std::string &path, char *buf, size_t size, off_t offset) override;
+    ssize_t Write(const std::string &path, const char *data, size_t size, off_t offset) override;
+    int GetAttr(const std::string &path, FileAttr *attr) override;
+    int Unlink(const std::string &path) override;
+    void ApplyRuntimeConfig(const dfs::Config &config) override;
+    int OpenHandle(const std::string &path, bool writable, std::unique_ptr<FileHandle> *handle) override;
+    // Loads the blocks into the cache (subject to admission, like reads).
+    ssize_t Prefetch(const std::string &path, size_t max_bytes) override;
+    int List(const std::string &dir, std::vector<DirEntry> *entries) override { return inner_->List(dir, entries); }
+    int MakeDirectory(const std::string &dir) override { return inner_->MakeDirectory(dir); }
+
+private:
+    class CachedHandle;
+
+    // Serves [offset, offset + size) of `key` from the cache, filling
+    // misses block by block through `fetch`.
+    ssize_t CachedRead(const std::string &key, char *buf, size_t size, off_t offset,
+                       const std::function<ssize_t(char *, size_t, off_t)> &fetch);
+
+    std::unique_ptr<StorageBackend> inner_;
+    ReadCache cache_;
+};
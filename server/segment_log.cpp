@@ -0,0 +1,309 @@
+#include "segment_log.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "storage_backend.h"
+
+static const uint32_t kRecordMagic = 0x52534644; // "DFSR"
+
+struct SegmentRecordHeader
+{
+    uint32_t magic;
+    char type;
+    uint32_t path_len;
+    uint64_t data_len;
+    int64_t file_offset;
+    int64_t mtime;
+    uint64_t checksum; // FNV-1a over the header (checksum = 0), path and payload
+} __attribute__((packed));
+
+static uint64_t Fnv1a(uint64_t hash, const char *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t RecordChecksum(SegmentRecordHeader header, const char *path, const char *data)
+{
+    header.checksum = 0;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = Fnv1a(hash, (const char *)&header, sizeof(header));
+    hash = Fnv1a(hash, path, header.path_len);
+    return Fnv1a(hash, data, header.data_len);
+}
+
+SegmentLog::~SegmentLog()
+{
+    for (auto &entry : fds_)
+        close(entry.second);
+}
+
+std::string SegmentLog::SegmentName(uint64_t segment) const
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "/seg-%08llu", (unsigned long long)segment);
+    return dir_ + buf;
+}
+
+int SegmentLog::OpenSegment(uint64_t segment, bool create)
+{
+    int flags = O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0);
+    int fd = openat(root_fd_, SegmentName(segment).c_str(), flags, 0644);
+    if (fd < 0)
+        return -errno;
+    fds_[segment] = fd;
+    return fd;
+}
+
+bool SegmentLog::Open(int root_fd, const std::string &dir, uint64_t segment_bytes, bool sync, std::string *error)
+{
+    root_fd_ = root_fd;
+    dir_ = dir;
+    segment_bytes_ = segment_bytes;
+    sync_ = sync;
+
+    if (mkdirat(root_fd_, dir_.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        *error = "cannot create " + dir_ + ": " + strerror(errno);
+        return false;
+    }
+
+    int dir_fd = openat(root_fd_, dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *d = dir_fd >= 0 ? fdopendir(dir_fd) : nullptr;
+    if (d == nullptr)
+    {
+        *error = "cannot list " + dir_ + ": " + strerror(errno);
+        if (dir_fd >= 0)
+            close(dir_fd);
+        return false;
+    }
+    while (struct dirent *entry = readdir(d))
+    {
+        unsigned long long segment;
+        if (sscanf(entry->d_name, "seg-%llu", &segment) != 1)
+            continue;
+        int fd = OpenSegment(segment, false);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            *error = "cannot open segment " + SegmentName(segment);
+            closedir(d);
+            return false;
+        }
+        sizes_[segment] = st.st_size;
+    }
+    closedir(d);
+
+    if (sizes_.empty())
+    {
+        if (OpenSegment(1, true) < 0)
+        {
+            *error = "cannot create first segment in " + dir_ + ": " + strerror(errno);
+            return false;
+        }
+        sizes_[1] = 0;
+    }
+    active_ = sizes_.rbegin()->first;
+    return true;
+}
+
+bool SegmentLog::ScanFrom(uint64_t segment, uint64_t *offset, const std::function<bool(const SegmentRecord &)> &fn)
+{
+    int fd = FdFor(segment);
+    if (fd < 0)
+        return false;
+
+    uint64_t size;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size = sizes_[segment];
+    }
+
+    std::string path, data;
+    while (*offset < size)
+    {
+        SegmentRecordHeader header;
+        if (PreadFull(fd, (char *)&header, sizeof(header), *offset) != sizeof(header) || header.magic != kRecordMagic)
+            break;
+        uint64_t total = sizeof(header) + header.path_len + header.data_len;
+        if (*offset + total > size)
+            break;
+
+        path.resize(header.path_len);
+        data.resize(header.data_len);
+        if (PreadFull(fd, &path[0], header.path_len, *offset + sizeof(header)) != (ssize_t)header.path_len ||
+            PreadFull(fd, &data[0], header.data_len, *offset + sizeof(header) + header.path_len) != (ssize_t)header.data_len ||
+            RecordChecksum(header, path.data(), data.data()) != header.checksum)
+            break;
+
+        SegmentRecord record;
+        record.type = header.type;
+        record.path = path;
+        record.file_offset = header.file_offset;
+        record.mtime = header.mtime;
+        record.location = {segment, *offset + sizeof(header) + header.path_len, header.data_len, total};
+        if (!fn(record))
+            break;
+        *offset += total;
+    }
+    return true;
+}
+
+bool SegmentLog::ScanSegment(uint64_t segment, const std::function<void(const SegmentRecord &)> &fn)
+{
+    int fd = FdFor(segment);
+    if (fd < 0)
+        return false;
+
+    uint64_t size;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size = sizes_[segment];
+    }
+
+    uint64_t offset = 0;
+    ScanFrom(segment, &offset, [&fn](const SegmentRecord &record) {
+        fn(record);
+        return true;
+    });
+
+    if (offset < size)
+    {
+        // Only a crash mid-append can leave a bad tail, and only in the
+        // newest segment; anywhere else it is corruption worth reporting.
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (segment == active_)
+        {
+            if (ftruncate(fd, offset) == 0)
+                sizes_[segment] = offset;
+        }
+        else
+        {
+            std::cerr << "[SEGMENT] " << SegmentName(segment) << ": bad record at offset " << offset
+                      << ", ignoring the rest of the segment" << std::endl;
+        }
+    }
+    return true;
+}
+
+bool SegmentLog::Scan(const std::function<void(const SegmentRecord &)> &fn, std::string *error)
+{
+    for (const auto &entry : SegmentSizes())
+    {
+        if (!ScanSegment(entry.first, fn))
+        {
+            *error = "cannot read segment " + SegmentName(entry.first);
+            return false;
+        }
+    }
+    return true;
+}
+
+int SegmentLog::Append(char type, const std::string &path, int64_t file_offset, int64_t mtime,
+                       const char *data, size_t length, SegmentLocation *location)
+{
+    SegmentRecordHeader header;
+    header.magic = kRecordMagic;
+    header.type = type;
+    header.path_len = path.size();
+    header.data_len = length;
+    header.file_offset = file_offset;
+    header.mtime = mtime;
+    header.checksum = RecordChecksum(header, path.data(), data);
+    uint64_t total = sizeof(header) + path.size() + length;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (sizes_[active_] > 0 && sizes_[active_] + total > segment_bytes_)
+    {
+        int fd = OpenSegment(active_ + 1, true);
+        if (fd < 0)
+            return fd;
+        active_++;
+        sizes_[active_] = 0;
+    }
+
+    int fd = fds_[active_];
+    uint64_t offset = sizes_[active_];
+    struct iovec iov[3] = {
+        {&header, sizeof(header)},
+        {const_cast<char *>(path.data()), path.size()},
+        {const_cast<char *>(data), length},
+    };
+    // Records are appended under the lock, so the segment never has holes.
+    ssize_t n = pwritev(fd, iov, 3, offset);
+    if (n != (ssize_t)total)
+    {
+        int err = n < 0 ? -errno : -EIO;
+        if (ftruncate(fd, offset) != 0)
+            std::cerr << "[SEGMENT] cannot roll back partial append" << std::endl;
+        return err;
+    }
+    if (sync_ && fdatasync(fd) != 0)
+        return -errno;
+
+    sizes_[active_] = offset + total;
+    *location = {active_, offset + sizeof(header) + path.size(), length, total};
+    return 0;
+}
+
+int SegmentLog::FdFor(uint64_t segment)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = fds_.find(segment);
+    return it == fds_.end() ? -ENOENT : it->second;
+}
+
+ssize_t SegmentLog::Read(const SegmentLocation &location, uint64_t skip, char *buf, size_t size)
+{
+    if (skip >= location.length)
+        return 0;
+    if (size > location.length - skip)
+        size = location.length - skip;
+
+    int fd = FdFor(location.segment);
+    if (fd < 0)
+        return fd;
+    return PreadFull(fd, buf, size, location.offset + skip);
+}
+
+uint64_t SegmentLog::active_segment()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return active_;
+}
+
+std::map<uint64_t, uint64_t> SegmentLog::SegmentSizes()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sizes_;
+}
+
+// Callers must make sure no reader still uses locations in `segment`.
+int SegmentLog::Remove(uint64_t segment)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (segment == active_)
+        return -EBUSY;
+    auto it = fds_.find(segment);
+    if (it == fds_.end())
+        return -ENOENT;
+    close(it->second);
+    fds_.erase(it);
+    sizes_.erase(segment);
+    if (unlinkat(root_fd_, SegmentName(segment).c_str(), 0) != 0)
+        return -errno;
+    return 0;
+}
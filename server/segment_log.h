@@ -0,0 +1,80 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Where a record's payload sits inside the segment files.
+struct SegmentLocation
+{
+    uint64_t segment = 0;
+    uint64_t offset = 0;       // of the payload within the segment
+    uint64_t length = 0;       // payload bytes
+    uint64_t record_bytes = 0; // header + path + payload, for space accounting
+};
+
+struct SegmentRecord
+{
+    char type = 0;
+    std::string path;
+    int64_t file_offset = 0; // backend-defined, e.g. offset of an extent
+    int64_t mtime = 0;
+    SegmentLocation location;
+};
+
+// A directory of append-only segment files (seg-00000001, ...). Records are
+// checksummed so a torn tail left by a crash is detected and cut off on
+// Scan(). Appends go to the newest segment, which is rotated once it
+// exceeds the configured size; older segments are immutable until a
+// backend's cleaner copies their live records forward and removes them.
+class SegmentLog
+{
+public:
+    SegmentLog() = default;
+    ~SegmentLog();
+
+    bool Open(int root_fd, const std::string &dir, uint64_t segment_bytes, bool sync, std::string *error);
+
+    // Replays every record in append order. Call once after Open.
+    bool Scan(const std::function<void(const SegmentRecord &)> &fn, std::string *error);
+    // Replays the records of one sealed segment (for cleaning).
+    bool ScanSegment(uint64_t segment, const std::function<void(const SegmentRecord &)> &fn);
+    // Replays the records of `segment` from byte `*offset` (a record
+    // boundary) until `fn` returns false or a bad or missing record, and
+    // leaves `*offset` after the last one `fn` accepted. False if there
+    // is no such segment.
+    bool ScanFrom(uint64_t segment, uint64_t *offset, const std::function<bool(const SegmentRecord &)> &fn);
+
+    // Appends one record and returns where its payload landed. Thread-safe.
+    int Append(char type, const std::string &path, int64_t file_offset, int64_t mtime,
+               const char *data, size_t length, SegmentLocation *location);
+
+    // Reads `size` payload bytes starting `skip` bytes into the record.
+    ssize_t Read(const SegmentLocation &location, uint64_t skip, char *buf, size_t size);
+
+    // Segment currently receiving appends (never a cleaning candidate).
+    uint64_t active_segment();
+    // Bytes written to each segment, active one included.
+    std::map<uint64_t, uint64_t> SegmentSizes();
+    int Remove(uint64_t segment);
+
+private:
+    int OpenSegment(uint64_t segment, bool create);
+    int FdFor(uint64_t segment);
+    std::string SegmentName(uint64_t segment) const;
+
+    int root_fd_ = -1;
+    std::string dir_;
+    uint64_t segment_bytes_ = 0;
+    bool sync_ = false;
+
+    std::mutex mutex_;
+    std::map<uint64_t, int> fds_;
+    std::map<uint64_t, uint64_t> sizes_;
+    uint64_t active_ = 0;
+};
@@ -0,0 +1,88 @@
+#include "shared_memory.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+SharedRegion::~SharedRegion()
+{
+    munmap(base_, size_);
+    close(fd_);
+}
+
+char *SharedRegion::Span(int64_t offset, int64_t length) const
+{
+    if (offset < 0 || length < 0 || offset > size_ || length > size_ - offset)
+        return nullptr;
+    return base_ + offset;
+}
+
+uint64_t SharedMemoryRegistry::Attach(int64_t size, std::string *path, std::string *error)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (size <= 0 || size > max_bytes_)
+        {
+            *error = "Shared memory size out of range";
+            return 0;
+        }
+        if ((int)regions_.size() >= max_channels_)
+        {
+            *error = "Too many shared memory channels";
+            return 0;
+        }
+    }
+
+    int fd = memfd_create("dfs-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+    {
+        *error = std::string("memfd_create: ") + strerror(errno);
+        return 0;
+    }
+    if (ftruncate(fd, size) != 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0)
+    {
+        *error = std::string("sizing shared memory: ") + strerror(errno);
+        close(fd);
+        return 0;
+    }
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        *error = std::string("mmap: ") + strerror(errno);
+        close(fd);
+        return 0;
+    }
+
+    // Only processes allowed to inspect the server (its user, or root) can
+    // open another process's descriptors through /proc.
+    *path = "/proc/" + std::to_string(getpid()) + "/fd/" + std::to_string(fd);
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t channel = 0;
+    while (channel == 0 || regions_.count(channel))
+        channel = rng_();
+    regions_[channel] = std::make_shared<SharedRegion>(fd, static_cast<char *>(base), size);
+    return channel;
+}
+
+void SharedMemoryRegistry::SetLimits(int max_channels, int64_t max_bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_channels_ = max_channels;
+    max_bytes_ = max_bytes;
+}
+
+bool SharedMemoryRegistry::Detach(uint64_t channel)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return regions_.erase(channel) != 0;
+}
+
+std::shared_ptr<SharedRegion> SharedMemoryRegistry::Lookup(uint64_t channel)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = regions_.find(channel);
+    return it == regions_.end() ? nullptr : it->second;
+}
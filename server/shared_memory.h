@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+// Memory the server shares with a client on the same host: a memfd sealed
+// at its size, so a client can neither shrink it under the server's
+// mapping (SIGBUS) nor swap in another object. Read/Write requests
+// carrying a channel id move their payload through the mapping instead of
+// the protobuf message.
+class SharedRegion
+{
+public:
+    SharedRegion(int fd, char *base, int64_t size) : fd_(fd), base_(base), size_(size) {}
+    ~SharedRegion();
+
+    // Returns the start of [offset, offset + length) or nullptr if the
+    // range falls outside the mapping.
+    char *Span(int64_t offset, int64_t length) const;
+
+private:
+    int fd_; // open while the channel lasts; clients map it through /proc
+    char *base_;
+    int64_t size_;
+};
+
+class SharedMemoryRegistry
+{
+public:
+    SharedMemoryRegistry(int max_channels, int64_t max_bytes)
+        : max_channels_(max_channels), max_bytes_(max_bytes) {}
+
+    // Creates and maps `size` bytes of shared memory; returns a channel id
+    // and the path the client opens to map it, or 0 with `error` set.
+    uint64_t Attach(int64_t size, std::string *path, std::string *error);
+    bool Detach(uint64_t channel);
+    // Applies to future attaches; existing channels are kept.
+    void SetLimits(int max_channels, int64_t max_bytes);
+    std::shared_ptr<SharedRegion> Lookup(uint64_t channel);
+
+private:
+    int max_channels_;
+    int64_t max_bytes_;
+    std::mutex mutex_;
+    // Channel ids are random so one local client cannot guess another's.
+    std::mt19937_64 rng_{std::random_device{}()};
+    std::unordered_map<uint64_t, std::shared_ptr<SharedRegion>> regions_;
+};
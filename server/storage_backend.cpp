@@ -0,0 +1,194 @@
+#include "storage_backend.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+#include "hashed_backend.h"
+#include "log_backend.h"
+#include "packed_backend.h"
+#include "posix_backend.h"
+#include "read_cache.h"
+
+namespace
+{
+
+class PathHandle final : public FileHandle
+{
+public:
+    PathHandle(StorageBackend &backend, const std::string &path, bool writable)
+        : backend_(backend), path_(path), writable_(writable)
+    {
+    }
+
+    ssize_t Read(char *buf, size_t size, off_t offset) override { return backend_.Read(path_, buf, size, offset); }
+    ssize_t Write(const char *data, size_t size, off_t offset) override
+    {
+        return writable_ ? backend_.Write(path_, data, size, offset) : -EBADF;
+    }
+
+private:
+    StorageBackend &backend_;
+    std::string path_;
+    bool writable_;
+};
+
+} // namespace
+
+int StorageBackend::OpenHandle(const std::string &path, bool writable, std::unique_ptr<FileHandle> *handle)
+{
+    FileAttr attr;
+    int result = GetAttr(path, &attr);
+    if (result < 0)
+        return result;
+    handle->reset(new PathHandle(*this, path, writable));
+    return 0;
+}
+
+ssize_t StorageBackend::Prefetch(const std::string &path, size_t max_bytes)
+{
+    std::string scratch(std::min<size_t>(max_bytes, 1 << 20), '\0');
+    size_t done = 0;
+    while (done < max_bytes)
+    {
+        ssize_t n = Read(path, &scratch[0], std::min(scratch.size(), max_bytes - done), done);
+        if (n < 0)
+            return done > 0 ? done : n;
+        if (n == 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+FdHandle::~FdHandle()
+{
+    close(fd_);
+}
+
+ssize_t FdHandle::Read(char *buf, size_t size, off_t offset)
+{
+    return PreadFull(fd_, buf, size, offset);
+}
+
+ssize_t FdHandle::Write(const char *data, size_t size, off_t offset)
+{
+    return writable_ ? PwriteFull(fd_, data, size, offset) : -EBADF;
+}
+
+static std::unique_ptr<StorageBackend> CreateBaseBackend(const dfs::Config &config, std::string *error)
+{
+    std::string kind = config.GetString("storage.backend", "posix");
+    std::string root = config.GetString("storage.root", ".");
+
+    if (kind == "posix")
+    {
+        std::unique_ptr<PosixBackend> backend(new PosixBackend(config.GetInt("storage.dir_cache_entries", 1024)));
+        if (!backend->Open(root, error))
+            return nullptr;
+        return backend;
+    }
+    if (kind == "hashed")
+    {
+        std::unique_ptr<HashedBackend> backend(new HashedBackend(config.GetBool("storage.hashed.sync_index", true)));
+        if (!backend->Open(root, error))
+            return nullptr;
+        return backend;
+    }
+
+    if (kind == "packed")
+    {
+        PackedBackend::Options options;
+        options.max_inline_bytes = config.GetInt("storage.packed.max_inline_bytes", options.max_inline_bytes);
+        options.segment_bytes = config.GetInt("storage.packed.segment_bytes", options.segment_bytes);
+        options.sync = config.GetBool("storage.packed.sync", options.sync);
+        options.compact_interval_ms = config.GetInt("storage.packed.compact_interval_ms", options.compact_interval_ms);
+        options.compact_live_percent = config.GetInt("storage.packed.compact_live_percent", options.compact_live_percent);
+        std::unique_ptr<PackedBackend> backend(new PackedBackend(options));
+        if (!backend->Open(root, error))
+            return nullptr;
+        return backend;
+    }
+
+    if (kind == "log")
+    {
+        LogBackend::Options options;
+        options.segment_bytes = config.GetInt("storage.log.segment_bytes", options.segment_bytes);
+        options.sync = config.GetBool("storage.log.sync", options.sync);
+        options.clean_interval_ms = config.GetInt("storage.log.clean_interval_ms", options.clean_interval_ms);
+        options.clean_live_percent = config.GetInt("storage.log.clean_live_percent", options.clean_live_percent);
+        std::unique_ptr<LogBackend> backend(new LogBackend(options));
+        if (!backend->Open(root, error))
+            return nullptr;
+        return backend;
+    }
+
+    *error = "unknown storage.backend '" + kind + "'";
+    return nullptr;
+}
+
+std::unique_ptr<StorageBackend> CreateStorageBackend(const dfs::Config &config, std::string *error)
+{
+    std::unique_ptr<StorageBackend> backend = CreateBaseBackend(config, error);
+    int64_t cache_bytes = config.GetInt("storage.cache.bytes", 128 << 20);
+    if (!backend || cache_bytes <= 0)
+        return backend;
+    int64_t block_bytes = std::max<int64_t>(config.GetInt("storage.cache.block_bytes", 64 << 10), 4096);
+    return std::unique_ptr<StorageBackend>(new CachingBackend(std::move(backend), cache_bytes, block_bytes));
+}
+
+bool NormalizePath(const std::string &path, std::string *normalized)
+{
+    normalized->clear();
+    size_t start = 0;
+    while (start <= path.size())
+    {
+        size_t slash = path.find('/', start);
+        if (slash == std::string::npos)
+            slash = path.size();
+        std::string part = path.substr(start, slash - start);
+        if (part == "..")
+            return false;
+        if (!part.empty() && part != ".")
+        {
+            if (!normalized->empty())
+                *normalized += '/';
+            *normalized += part;
+        }
+        start = slash + 1;
+    }
+    return !normalized->empty();
+}
+
+ssize_t PreadFull(int fd, char *buf, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = pread(fd, buf + done, size - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -errno;
+        if (n == 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+ssize_t PwriteFull(int fd, const char *buf, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = pwrite(fd, buf + done, size - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -errno;
+        done += n;
+    }
+    return done;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../common/config.h"
+
+struct FileAttr
+{
+    int64_t size = 0;
+    int64_t mtime = 0; // seconds
+};
+
+struct DirEntry
+{
+    std::string name;
+    bool is_dir = false;
+};
+
+// A file opened once for repeated I/O, so backends that can hold a
+// descriptor skip path resolution on every call. Same return convention as
+// StorageBackend.
+class FileHandle
+{
+public:
+    virtual ~FileHandle() = default;
+
+    virtual ssize_t Read(char *buf, size_t size, off_t offset) = 0;
+    virtual ssize_t Write(const char *data, size_t size, off_t offset) = 0;
+};
+
+// FileHandle over an fd it owns; Write fails with EBADF if read-only.
+class FdHandle final : public FileHandle
+{
+public:
+    FdHandle(int fd, bool writable) : fd_(fd), writable_(writable) {}
+    ~FdHandle() override;
+
+    ssize_t Read(char *buf, size_t size, off_t offset) override;
+    ssize_t Write(const char *data, size_t size, off_t offset) override;
+
+private:
+    int fd_;
+    bool writable_;
+};
+
+// Where file contents live. DFSServerImpl owns versioning, shared memory
+// and status codes; a backend only maps client paths to bytes. Methods
+// return >= 0 on success and -errno on failure.
+class StorageBackend
+{
+public:
+    virtual ~StorageBackend() = default;
+
+    virtual ssize_t Read(const std::string &path, char *buf, size_t size, off_t offset) = 0;
+    // Creates the file if it does not exist.
+    virtual ssize_t Write(const std::string &path, const char *data, size_t size, off_t offset) = 0;
+    virtual int GetAttr(const std::string &path, FileAttr *attr) = 0;
+    virtual int Unlink(const std::string &path) = 0;
+    // Opens an existing file. The default handle just calls Read/Write
+    // with the path.
+    virtual int OpenHandle(const std::string &path, bool writable, std::unique_ptr<FileHandle> *handle);
+    // Pulls up to the first `max_bytes` of the file into whatever caches
+    // the backend reads through, ahead of reads a client expects to make.
+    // Returns the bytes covered. The default reads and discards them.
+    virtual ssize_t Prefetch(const std::string &path, size_t max_bytes);
+    // Files and subdirectories directly inside `dir` ("" for the root), for
+    // backends that keep a directory tree. The default returns -ENOTSUP and
+    // callers fall back to the metadata store.
+    virtual int List(const std::string &dir, std::vector<DirEntry> *entries) { return -ENOTSUP; }
+    // Creates directory `dir`, whose parent must exist (-EEXIST if it does
+    // already). Backends that store paths flat have no directories to
+    // create, so the default succeeds.
+    virtual int MakeDirectory(const std::string &dir) { return 0; }
+    // Picks up the knobs that are safe to change while serving.
+    virtual void ApplyRuntimeConfig(const dfs::Config &config) {}
+};
+
+// Builds the backend named by storage.backend ("posix", "hashed", "packed"
+// or "log") rooted at storage.root, behind a read cache unless
+// storage.cache.bytes is 0. Returns nullptr with `error` set on failure.
+std::unique_ptr<StorageBackend> CreateStorageBackend(const dfs::Config &config, std::string *error);
+
+// Canonical form of a client path: no leading/trailing/repeated '/', no "."
+// components. Returns false for empty paths and any ".." component.
+bool NormalizePath(const std::string &path, std::string *normalized);
+
+// pread/pwrite until done, EOF or error. Return the byte count or -errno.
+ssize_t PreadFull(int fd, char *buf, size_t size, off_t offset);
+ssize_t PwriteFull(int fd, const char *buf, size_t size, off_t offset);
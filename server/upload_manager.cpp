@@ -0,0 +1,148 @@
+#include "upload_manager.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "storage_backend.h"
+
+Upload::~Upload()
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+bool Upload::Covers(int64_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (size == 0)
+        return true;
+    return !written.empty() && written.begin()->first == 0 && written.begin()->second >= size;
+}
+
+int UploadManager::CreateStagingFile()
+{
+    int fd = open(dir_.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR))
+        return fd;
+
+    std::string name = dir_ + "/dfs-upload-XXXXXX";
+    fd = mkostemp(&name[0], O_CLOEXEC);
+    if (fd >= 0)
+        unlink(name.c_str());
+    return fd;
+}
+
+uint64_t UploadManager::Begin(const std::string &path, const std::string &key, std::string *error)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (uploads_.size() >= max_uploads_)
+            DropIdle();
+        if (uploads_.size() >= max_uploads_)
+        {
+            *error = "Too many uploads in progress";
+            return 0;
+        }
+    }
+
+    std::shared_ptr<Upload> upload = std::make_shared<Upload>();
+    upload->path = path;
+    upload->key = key;
+    upload->fd = CreateStagingFile();
+    if (upload->fd < 0)
+    {
+        *error = "cannot create staging file in " + dir_ + ": " + strerror(errno);
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t id = 0;
+    while (id == 0 || uploads_.count(id))
+        id = rng_();
+    uploads_[id] = {std::move(upload), Clock::now()};
+    return id;
+}
+
+ssize_t UploadManager::WritePart(uint64_t id, const char *data, size_t size, int64_t offset)
+{
+    std::shared_ptr<Upload> upload;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = uploads_.find(id);
+        if (it == uploads_.end())
+            return -ENOENT;
+        if (offset < 0 || offset > max_bytes_ || (int64_t)size > max_bytes_ - offset)
+            return -EFBIG;
+        it->second.last_used = Clock::now();
+        upload = it->second.upload;
+    }
+    ssize_t n = PwriteFull(upload->fd, data, size, offset);
+    if (n <= 0)
+        return n;
+
+    // Merge [offset, offset + n) with the ranges it touches.
+    std::lock_guard<std::mutex> lock(upload->mutex);
+    int64_t start = offset;
+    int64_t end = offset + n;
+    auto it = upload->written.upper_bound(start);
+    if (it != upload->written.begin() && std::prev(it)->second >= start)
+        --it;
+    while (it != upload->written.end() && it->first <= end)
+    {
+        start = std::min(start, it->first);
+        end = std::max(end, it->second);
+        it = upload->written.erase(it);
+    }
+    upload->written[start] = end;
+    return n;
+}
+
+int UploadManager::Take(uint64_t id, int64_t size, std::shared_ptr<Upload> *upload)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = uploads_.find(id);
+    if (it == uploads_.end())
+        return -ENOENT;
+    if (size < 0 || !it->second.upload->Covers(size))
+        return -EINVAL;
+    *upload = std::move(it->second.upload);
+    uploads_.erase(it);
+    return 0;
+}
+
+void UploadManager::Restore(uint64_t id, std::shared_ptr<Upload> upload)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    uploads_[id] = {std::move(upload), Clock::now()};
+}
+
+bool UploadManager::Abort(uint64_t id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return uploads_.erase(id) != 0;
+}
+
+void UploadManager::SetLimits(size_t max_uploads, int64_t idle_ms, int64_t max_bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_uploads_ = max_uploads;
+    idle_ms_ = idle_ms;
+    max_bytes_ = max_bytes;
+}
+
+void UploadManager::DropIdle()
+{
+    Clock::time_point cutoff = Clock::now() - std::chrono::milliseconds(idle_ms_);
+    for (auto it = uploads_.begin(); it != uploads_.end();)
+    {
+        if (it->second.last_used < cutoff)
+            it = uploads_.erase(it);
+        else
+            ++it;
+    }
+}
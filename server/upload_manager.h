@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+// A multi-part upload in progress: parts land at their offsets in an
+// anonymous staging file until CompleteUpload copies it into storage.
+struct Upload
+{
+    ~Upload();
+
+    // Whether the parts written so far cover [0, size) without gaps.
+    bool Covers(int64_t size);
+
+    std::string path;
+    std::string key;
+    int fd = -1;
+
+    std::mutex mutex;
+    std::map<int64_t, int64_t> written; // start -> end of merged part ranges
+};
+
+// Staging area for multi-part uploads, in server.upload_dir. Staging files
+// are O_TMPFILE where supported (else unlinked right after creation), so
+// nothing is left behind by a crash or an abandoned upload. Uploads idle
+// longer than `idle_ms` are dropped when the table fills.
+class UploadManager
+{
+public:
+    UploadManager(const std::string &dir, size_t max_uploads, int64_t idle_ms, int64_t max_bytes)
+        : dir_(dir), max_uploads_(max_uploads), idle_ms_(idle_ms), max_bytes_(max_bytes)
+    {
+    }
+
+    // Returns the upload id, or 0 with `error` set.
+    uint64_t Begin(const std::string &path, const std::string &key, std::string *error);
+    // Writes one part; parts may arrive in any order and concurrently.
+    // Returns the bytes written or -errno (-ENOENT for an unknown id).
+    ssize_t WritePart(uint64_t id, const char *data, size_t size, int64_t offset);
+    // Removes the upload from the table for completion if its parts cover
+    // [0, size): -ENOENT if unknown, -EINVAL (upload kept) if not.
+    int Take(uint64_t id, int64_t size, std::shared_ptr<Upload> *upload);
+    // Puts back an upload whose completion failed, so it can be retried.
+    void Restore(uint64_t id, std::shared_ptr<Upload> upload);
+    bool Abort(uint64_t id);
+    // Applies to future uploads and parts.
+    void SetLimits(size_t max_uploads, int64_t idle_ms, int64_t max_bytes);
+
+    // A new anonymous file in the staging directory, or -1 with errno set.
+    int CreateStagingFile();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry
+    {
+        std::shared_ptr<Upload> upload;
+        Clock::time_point last_used;
+    };
+
+    // Requires mutex_ held.
+    void DropIdle();
+
+    std::string dir_;
+    size_t max_uploads_;
+    int64_t idle_ms_;
+    int64_t max_bytes_;
+    std::mutex mutex_;
+    std::mt19937_64 rng_{std::random_device{}()};
+    std::unordered_map<uint64_t, Entry> uploads_;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "../server/storage_backend.h"
+
+// The whole file, or a marker if it is missing or reads short.
+inline std::string ReadAll(StorageBackend &backend, const std::string &path)
+{
+    FileAttr attr;
+    if (backend.GetAttr(path, &attr) != 0)
+        return "<missing>";
+    std::string data(attr.size, '\0');
+    ssize_t n = backend.Read(path, &data[0], data.size(), 0);
+    return n == (ssize_t)data.size() ? data : "<short read>";
+}
+
+inline bool SegmentExists(const std::string &dir, uint64_t segment)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/seg-%08llu", (unsigned long long)segment);
+    struct stat st;
+    return stat((dir + name).c_str(), &st) == 0;
+}
+
+// Waits for a background cleaner to remove `segment`.
+inline bool WaitForRemoval(const std::string &dir, uint64_t segment)
+{
+    for (int i = 0; i < 500 && SegmentExists(dir, segment); i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return !SegmentExists(dir, segment);
+}
@@ -0,0 +1,139 @@
+// Index replay, orphan objects and index compaction of HashedBackend.
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../server/hashed_backend.h"
+#include "backend_util.h"
+#include "test_util.h"
+
+namespace
+{
+
+TEST(HashedBackend, ReplaysIndexAndCutsTornTail)
+{
+    TempDir dir;
+    std::string index = dir.path() + "/namespace.log";
+    int64_t one_file = 0;
+    {
+        HashedBackend backend(false);
+        std::string error;
+        ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+        ASSERT_EQ(backend.Write("a/one", "1", 1, 0), 1);
+        one_file = FileSize(index);
+        ASSERT_EQ(backend.Write("a/two", "2", 1, 0), 1);
+    }
+    ASSERT_EQ(truncate(index.c_str(), FileSize(index) - 1), 0);
+
+    HashedBackend backend(false);
+    std::string error;
+    ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+    EXPECT_EQ(FileSize(index), one_file);
+    EXPECT_EQ(ReadAll(backend, "a/one"), "1");
+    EXPECT_EQ(ReadAll(backend, "a/two"), "<missing>");
+}
+
+// A crash after creating an object but before indexing it leaves an orphan
+// with the next id; the next create must reuse the id, not fail.
+TEST(HashedBackend, ReplacesOrphanObject)
+{
+    TempDir dir;
+    std::string index = dir.path() + "/namespace.log";
+    int64_t one_file = 0;
+    {
+        HashedBackend backend(false);
+        std::string error;
+        ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+        ASSERT_EQ(backend.Write("one", "1", 1, 0), 1);
+        one_file = FileSize(index);
+        ASSERT_EQ(backend.Write("orphan", "stale", 5, 0), 5);
+    }
+    ASSERT_EQ(truncate(index.c_str(), one_file), 0); // its index record never landed
+
+    HashedBackend backend(false);
+    std::string error;
+    ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+    ASSERT_EQ(backend.Write("new", "fresh", 5, 0), 5);
+    EXPECT_EQ(ReadAll(backend, "new"), "fresh");
+    EXPECT_EQ(ReadAll(backend, "orphan"), "<missing>");
+}
+
+TEST(HashedBackend, CompactsIndexWhileRunning)
+{
+    TempDir dir;
+    std::string index = dir.path() + "/namespace.log";
+    {
+        HashedBackend backend(false);
+        std::string error;
+        ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+        ASSERT_EQ(backend.Write("kept", "k", 1, 0), 1);
+        for (int i = 0; i < 5000; i++)
+        {
+            std::string path = "tmp/" + std::to_string(i);
+            ASSERT_EQ(backend.Write(path, "x", 1, 0), 1);
+            ASSERT_EQ(backend.Unlink(path), 0);
+        }
+        // 10001 records appended; compaction keeps it near the 1024 slack.
+        EXPECT_LT(FileSize(index), 3000 * 20);
+        ASSERT_EQ(backend.Write("after", "a", 1, 0), 1);
+    }
+    HashedBackend backend(false);
+    std::string error;
+    ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+    EXPECT_EQ(ReadAll(backend, "kept"), "k");
+    EXPECT_EQ(ReadAll(backend, "after"), "a");
+    EXPECT_EQ(ReadAll(backend, "tmp/1"), "<missing>");
+}
+
+// A compaction that cannot write the new index must leave the old one in
+// place and in use. The live index here is over the 1 MiB write chunk, and
+// the new index goes to /dev/full, so the first chunk's write fails.
+TEST(HashedBackend, FailedCompactionKeepsIndex)
+{
+    TempDir dir;
+    std::string index = dir.path() + "/namespace.log";
+    std::string tmp = dir.path() + "/namespace.log.tmp";
+    const int kLive = 5000;
+    auto live = [](int i) { return "long/" + std::string(195, 'x') + std::to_string(i); };
+    {
+        HashedBackend backend(false);
+        std::string error;
+        ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+        for (int i = 0; i < kLive; i++)
+            ASSERT_EQ(backend.Write(live(i), "l", 1, 0), 1);
+        // Compaction is due once records exceed 2 * live + 1024: this
+        // leaves the index one unlink short of it.
+        const int kPairs = (2 * kLive + 1024 - kLive) / 2;
+        for (int i = 0; i < kPairs; i++)
+        {
+            ASSERT_EQ(backend.Write("tmp", "t", 1, 0), 1);
+            ASSERT_EQ(backend.Unlink("tmp"), 0);
+        }
+        int64_t before = FileSize(index);
+        ASSERT_EQ(symlink("/dev/full", tmp.c_str()), 0);
+        ASSERT_EQ(backend.Write("tmp", "t", 1, 0), 1);
+        ASSERT_EQ(backend.Unlink("tmp"), 0); // compaction fails here
+
+        struct stat st;
+        EXPECT_NE(lstat(tmp.c_str(), &st), 0);
+        ASSERT_EQ(lstat(index.c_str(), &st), 0);
+        EXPECT_TRUE(S_ISREG(st.st_mode));
+        EXPECT_GT(FileSize(index), before);
+        ASSERT_EQ(backend.Write("after", "a", 1, 0), 1); // still appending
+    }
+    HashedBackend backend(false);
+    std::string error;
+    ASSERT_TRUE(backend.Open(dir.path(), &error)) << error; // compacts now
+    EXPECT_LT(FileSize(index), kLive * 250);
+    for (int i = 0; i < kLive; i++)
+        ASSERT_EQ(ReadAll(backend, live(i)), "l") << i;
+    EXPECT_EQ(ReadAll(backend, "after"), "a");
+    EXPECT_EQ(ReadAll(backend, "tmp"), "<missing>");
+}
+
+} // namespace
@@ -0,0 +1,115 @@
+// Replay and segment cleaning of LogBackend.
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../server/log_backend.h"
+#include "backend_util.h"
+#include "test_util.h"
+
+namespace
+{
+
+LogBackend::Options SmallLog(bool clean)
+{
+    LogBackend::Options options;
+    options.segment_bytes = 4096;
+    options.clean_interval_ms = clean ? 10 : 0;
+    return options;
+}
+
+TEST(LogBackend, ReplaysWritesAndUnlinks)
+{
+    TempDir dir;
+    {
+        LogBackend backend(SmallLog(false));
+        std::string error;
+        ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+        ASSERT_EQ(backend.Write("a", "hello world", 11, 0), 11);
+        ASSERT_EQ(backend.Write("a", "HELLO", 5, 0), 5);
+        ASSERT_EQ(backend.Write("b", "gone", 4, 0), 4);
+        ASSERT_EQ(backend.Unlink("b"), 0);
+    }
+    LogBackend backend(SmallLog(false));
+    std::string error;
+    ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+    EXPECT_EQ(ReadAll(backend, "a"), "HELLO world");
+    EXPECT_EQ(ReadAll(backend, "b"), "<missing>");
+}
+
+TEST(LogBackend, CutsTornTail)
+{
+    TempDir dir;
+    {
+        LogBackend backend(SmallLog(false));
+        std::string error;
+        ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+        ASSERT_EQ(backend.Write("a", "kept", 4, 0), 4);
+        ASSERT_EQ(backend.Write("a", "torn", 4, 4), 4);
+    }
+    std::string segment = dir.path() + "/log/seg-00000001";
+    struct stat st;
+    ASSERT_EQ(stat(segment.c_str(), &st), 0);
+    ASSERT_EQ(truncate(segment.c_str(), st.st_size - 2), 0);
+
+    LogBackend backend(SmallLog(false));
+    std::string error;
+    ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+    EXPECT_EQ(ReadAll(backend, "a"), "kept");
+    ASSERT_EQ(backend.Write("a", "more", 4, 4), 4); // appends after the cut
+    EXPECT_EQ(ReadAll(backend, "a"), "keptmore");
+}
+
+// A create is a zero-length write: the file has a size and no extents, and
+// must survive the cleaner removing the segment that recorded it.
+TEST(LogBackend, CleaningKeepsFilesWithoutExtents)
+{
+    TempDir dir;
+    std::string filler(1000, 'x');
+    {
+        LogBackend backend(SmallLog(true));
+        std::string error;
+        ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+        ASSERT_EQ(backend.Write("empty", "", 0, 0), 0);
+        ASSERT_EQ(backend.Write("sized", "", 0, 100), 0); // size set past the end
+        for (int i = 0; i < 20; i++)
+            ASSERT_EQ(backend.Write("churn", filler.data(), filler.size(), 0), (ssize_t)filler.size());
+        ASSERT_TRUE(WaitForRemoval(dir.path() + "/log", 1));
+    }
+    LogBackend backend(SmallLog(false));
+    std::string error;
+    ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+    FileAttr attr;
+    ASSERT_EQ(backend.GetAttr("empty", &attr), 0);
+    EXPECT_EQ(attr.size, 0);
+    ASSERT_EQ(backend.GetAttr("sized", &attr), 0);
+    EXPECT_EQ(attr.size, 100);
+    EXPECT_EQ(ReadAll(backend, "churn"), filler);
+}
+
+TEST(LogBackend, CleaningMovesLiveExtents)
+{
+    TempDir dir;
+    std::string filler(1000, 'x');
+    {
+        LogBackend backend(SmallLog(true));
+        std::string error;
+        ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+        ASSERT_EQ(backend.Write("keep", "0123456789", 10, 0), 10);
+        ASSERT_EQ(backend.Write("keep", "ab", 2, 4), 2);
+        for (int i = 0; i < 20; i++)
+            ASSERT_EQ(backend.Write("churn", filler.data(), filler.size(), 0), (ssize_t)filler.size());
+        ASSERT_TRUE(WaitForRemoval(dir.path() + "/log", 1));
+        EXPECT_EQ(ReadAll(backend, "keep"), "0123ab6789");
+    }
+    LogBackend backend(SmallLog(false));
+    std::string error;
+    ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+    EXPECT_EQ(ReadAll(backend, "keep"), "0123ab6789");
+}
+
+} // namespace
@@ -0,0 +1,220 @@
+// Journaling and replay of changes made while disconnected.
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../client/offline_log.h"
+#include "test_util.h"
+
+namespace
+{
+
+using Outcome = OfflineLog::Outcome;
+
+std::unique_ptr<OfflineLog> OpenLog(const std::string &file)
+{
+    std::string error;
+    std::unique_ptr<OfflineLog> log = OfflineLog::Open(file, false, &error);
+    EXPECT_TRUE(log) << error;
+    return log;
+}
+
+// Replays `log`, applying every record and bumping the file's version,
+// and returns the records seen.
+std::vector<OfflineLog::Record> ReplayAll(OfflineLog &log)
+{
+    std::vector<OfflineLog::Record> records;
+    std::vector<std::string> touched;
+    bool done = log.Reintegrate([&](const OfflineLog::Record &record, int64_t *version) {
+        records.push_back(record);
+        *version = record.base_version + 1;
+        return Outcome::kApplied;
+    }, &touched);
+    EXPECT_TRUE(done);
+    return records;
+}
+
+TEST(OfflineLog, ReplaysAfterRestart)
+{
+    TempDir dir;
+    std::string file = dir.path() + "/journal";
+    {
+        std::unique_ptr<OfflineLog> log = OpenLog(file);
+        log->Remember("/a", 3, 100, 7);
+        log->SetOffline();
+        ASSERT_EQ(log->Write("/a", "xyz", 3, 3), 3);
+        ASSERT_EQ(log->Unlink("/a"), 0);
+        ASSERT_EQ(log->Write("/new", "n", 1, 0), 1);
+    }
+
+    std::unique_ptr<OfflineLog> log = OpenLog(file);
+    EXPECT_TRUE(log->offline()); // journaled changes keep a new mount offline
+    std::vector<OfflineLog::Record> records = ReplayAll(*log);
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_EQ(records[0].type, 'W');
+    EXPECT_EQ(records[0].path, "/a");
+    EXPECT_EQ(records[0].offset, 3);
+    EXPECT_EQ(records[0].data, "xyz");
+    EXPECT_EQ(records[0].base_version, 7);
+    EXPECT_EQ(records[1].type, 'U');
+    EXPECT_EQ(records[2].path, "/new");
+    EXPECT_EQ(records[2].base_version, 0);
+    EXPECT_NE(records[0].request_id, records[2].request_id);
+    EXPECT_FALSE(log->offline());
+    EXPECT_TRUE(ReplayAll(*log).empty());
+}
+
+// A file's second change is checked against the version its first one
+// left, not the one from before the outage.
+TEST(OfflineLog, ChainsVersionsOfReplayedChanges)
+{
+    TempDir dir;
+    std::unique_ptr<OfflineLog> log = OpenLog(dir.path() + "/journal");
+    log->Remember("/a", 0, 100, 7);
+    log->SetOffline();
+    ASSERT_EQ(log->Write("/a", "1", 1, 0), 1);
+    ASSERT_EQ(log->Write("/a", "2", 1, 1), 1);
+    ASSERT_EQ(log->Write("/a", "3", 1, 2), 1);
+
+    std::vector<OfflineLog::Record> records = ReplayAll(*log);
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_EQ(records[0].base_version, 7);
+    EXPECT_EQ(records[1].base_version, 8);
+    EXPECT_EQ(records[2].base_version, 9);
+}
+
+TEST(OfflineLog, CutsTornTail)
+{
+    TempDir dir;
+    std::string file = dir.path() + "/journal";
+    {
+        std::unique_ptr<OfflineLog> log = OpenLog(file);
+        log->SetOffline();
+        ASSERT_EQ(log->Write("/a", "kept", 4, 0), 4);
+        ASSERT_EQ(log->Write("/a", "torn", 4, 4), 4);
+    }
+    struct stat st;
+    ASSERT_EQ(stat(file.c_str(), &st), 0);
+    ASSERT_EQ(truncate(file.c_str(), st.st_size - 1), 0);
+
+    std::unique_ptr<OfflineLog> log = OpenLog(file);
+    std::vector<OfflineLog::Record> records = ReplayAll(*log);
+    ASSERT_EQ(records.size(), 1u);
+    EXPECT_EQ(records[0].data, "kept");
+}
+
+// An unreachable server keeps the journal; the retry resumes at the
+// record that failed, with the same request id.
+TEST(OfflineLog, UnreachableKeepsJournal)
+{
+    TempDir dir;
+    std::unique_ptr<OfflineLog> log = OpenLog(dir.path() + "/journal");
+    log->SetOffline();
+    ASSERT_EQ(log->Write("/a", "1", 1, 0), 1);
+    ASSERT_EQ(log->Write("/a", "2", 1, 1), 1);
+
+    std::vector<uint64_t> first;
+    std::vector<std::string> touched;
+    bool done = log->Reintegrate([&](const OfflineLog::Record &record, int64_t *version) {
+        first.push_back(record.request_id);
+        return first.size() == 1 ? Outcome::kApplied : Outcome::kUnreachable;
+    }, &touched);
+    EXPECT_FALSE(done);
+    EXPECT_TRUE(log->offline());
+
+    std::vector<OfflineLog::Record> records = ReplayAll(*log);
+    ASSERT_EQ(records.size(), 1u);
+    EXPECT_EQ(records[0].request_id, first[1]);
+    EXPECT_FALSE(log->offline());
+}
+
+// Progress is journaled: after a restart the replay neither resends a
+// change the server applied (whose request id it may have forgotten) nor
+// loses the version that change left.
+TEST(OfflineLog, ResumesAfterRestart)
+{
+    TempDir dir;
+    std::string file = dir.path() + "/journal";
+    {
+        std::unique_ptr<OfflineLog> log = OpenLog(file);
+        log->Remember("/a", 0, 100, 7);
+        log->SetOffline();
+        ASSERT_EQ(log->Write("/a", "1", 1, 0), 1);
+        ASSERT_EQ(log->Write("/b", "1", 1, 0), 1);
+        ASSERT_EQ(log->Write("/b", "2", 1, 1), 1);
+        ASSERT_EQ(log->Write("/a", "2", 1, 1), 1);
+        ASSERT_EQ(log->Write("/c", "1", 1, 0), 1);
+
+        int calls = 0;
+        std::vector<std::string> touched;
+        bool done = log->Reintegrate([&](const OfflineLog::Record &record, int64_t *version) {
+            if (++calls == 3)
+                return Outcome::kUnreachable;
+            if (record.path == "/b")
+                return Outcome::kConflict;
+            *version = 20;
+            return Outcome::kApplied;
+        }, &touched);
+        ASSERT_FALSE(done);
+    }
+
+    std::unique_ptr<OfflineLog> log = OpenLog(file);
+    EXPECT_TRUE(log->offline());
+    std::vector<OfflineLog::Record> records = ReplayAll(*log);
+    // /b's second change went with its conflict; /a's continues from 20.
+    ASSERT_EQ(records.size(), 2u);
+    EXPECT_EQ(records[0].path, "/a");
+    EXPECT_EQ(records[0].data, "2");
+    EXPECT_EQ(records[0].base_version, 20);
+    EXPECT_EQ(records[1].path, "/c");
+}
+
+// A change the server refused for a reason other than a version conflict
+// (reported as unreachable) stays journaled and applies on a later pass.
+TEST(OfflineLog, FailedReplayIsNotDropped)
+{
+    TempDir dir;
+    std::unique_ptr<OfflineLog> log = OpenLog(dir.path() + "/journal");
+    log->SetOffline();
+    ASSERT_EQ(log->Write("/a", "1", 1, 0), 1);
+
+    std::vector<std::string> touched;
+    for (int i = 0; i < 2; i++)
+        EXPECT_FALSE(log->Reintegrate([](const OfflineLog::Record &, int64_t *) { return Outcome::kUnreachable; },
+                                      &touched));
+    int64_t size, mtime;
+    ASSERT_EQ(log->GetAttr("/a", &size, &mtime), 0);
+    EXPECT_EQ(size, 1);
+
+    std::vector<OfflineLog::Record> records = ReplayAll(*log);
+    ASSERT_EQ(records.size(), 1u);
+    EXPECT_EQ(records[0].data, "1");
+}
+
+TEST(OfflineLog, ConflictDropsTheFilesLaterChanges)
+{
+    TempDir dir;
+    std::unique_ptr<OfflineLog> log = OpenLog(dir.path() + "/journal");
+    log->SetOffline();
+    ASSERT_EQ(log->Write("/a", "1", 1, 0), 1);
+    ASSERT_EQ(log->Write("/b", "1", 1, 0), 1);
+    ASSERT_EQ(log->Write("/a", "2", 1, 1), 1);
+
+    std::vector<std::string> applied, touched;
+    bool done = log->Reintegrate([&](const OfflineLog::Record &record, int64_t *version) {
+        if (record.path == "/a")
+            return Outcome::kConflict;
+        applied.push_back(record.path);
+        return Outcome::kApplied;
+    }, &touched);
+    EXPECT_TRUE(done);
+    EXPECT_EQ(applied, std::vector<std::string>{"/b"});
+    EXPECT_EQ(touched.size(), 2u);
+}
+
+} // namespace
@@ -0,0 +1,88 @@
+// Replay, growth into the large store and compaction of PackedBackend.
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../server/packed_backend.h"
+#include "backend_util.h"
+#include "test_util.h"
+
+namespace
+{
+
+PackedBackend::Options SmallPacked(bool compact)
+{
+    PackedBackend::Options options;
+    options.max_inline_bytes = 64;
+    options.segment_bytes = 4096;
+    options.compact_interval_ms = compact ? 10 : 0;
+    return options;
+}
+
+TEST(PackedBackend, ReplaysAndMovesLargeFiles)
+{
+    TempDir dir;
+    std::string big(200, 'b');
+    {
+        PackedBackend backend(SmallPacked(false));
+        std::string error;
+        ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+        ASSERT_EQ(backend.Write("small", "tiny", 4, 0), 4);
+        ASSERT_EQ(backend.Write("grows", "head", 4, 0), 4);
+        ASSERT_EQ(backend.Write("grows", big.data(), big.size(), 4), (ssize_t)big.size());
+        ASSERT_EQ(backend.Write("gone", "x", 1, 0), 1);
+        ASSERT_EQ(backend.Unlink("gone"), 0);
+    }
+    PackedBackend backend(SmallPacked(false));
+    std::string error;
+    ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+    EXPECT_EQ(ReadAll(backend, "small"), "tiny");
+    EXPECT_EQ(ReadAll(backend, "grows"), "head" + big);
+    EXPECT_EQ(ReadAll(backend, "gone"), "<missing>");
+}
+
+// Must not materialize the prefix in memory.
+TEST(PackedBackend, SparseWriteFarPastTheEnd)
+{
+    TempDir dir;
+    PackedBackend backend(SmallPacked(false));
+    std::string error;
+    ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+    ASSERT_EQ(backend.Write("sparse", "head", 4, 0), 4);
+    const off_t far = 1LL << 40;
+    ASSERT_EQ(backend.Write("sparse", "tail", 4, far), 4);
+    FileAttr attr;
+    ASSERT_EQ(backend.GetAttr("sparse", &attr), 0);
+    EXPECT_EQ(attr.size, far + 4);
+    char buf[4];
+    ASSERT_EQ(backend.Read("sparse", buf, 4, 0), 4);
+    EXPECT_EQ(std::string(buf, 4), "head");
+    ASSERT_EQ(backend.Read("sparse", buf, 4, far), 4);
+    EXPECT_EQ(std::string(buf, 4), "tail");
+}
+
+TEST(PackedBackend, CompactionKeepsLiveFiles)
+{
+    TempDir dir;
+    std::string filler(60, 'x');
+    {
+        PackedBackend backend(SmallPacked(true));
+        std::string error;
+        ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+        ASSERT_EQ(backend.Write("keep", "kept", 4, 0), 4);
+        for (int i = 0; i < 200; i++)
+            ASSERT_EQ(backend.Write("churn", filler.data(), filler.size(), 0), (ssize_t)filler.size());
+        ASSERT_TRUE(WaitForRemoval(dir.path() + "/segments", 1));
+    }
+    PackedBackend backend(SmallPacked(false));
+    std::string error;
+    ASSERT_TRUE(backend.Open(dir.path(), &error)) << error;
+    EXPECT_EQ(ReadAll(backend, "keep"), "kept");
+    EXPECT_EQ(ReadAll(backend, "churn"), filler);
+}
+
+} // namespace
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <ftw.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <string>
+
+// A fresh directory under $TMPDIR (or /tmp), removed with its contents.
+class TempDir
+{
+public:
+    TempDir()
+    {
+        const char *base = getenv("TMPDIR");
+        std::string pattern = std::string(base && *base ? base : "/tmp") + "/dfs_test.XXXXXX";
+        if (mkdtemp(&pattern[0]) != nullptr)
+            path_ = pattern;
+    }
+    ~TempDir()
+    {
+        if (!path_.empty())
+            nftw(path_.c_str(), [](const char *path, const struct stat *, int, struct FTW *) { return ::remove(path); },
+                 16, FTW_DEPTH | FTW_PHYS);
+    }
+    TempDir(const TempDir &) = delete;
+    TempDir &operator=(const TempDir &) = delete;
+
+    const std::string &path() const { return path_; }
+
+private:
+    std::string path_;
+};
+
+// Size of the file at `path`, or -1 if it does not exist.
+inline int64_t FileSize(const std::string &path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
@@ -0,0 +1,80 @@
+// Part tracking of multi-part uploads.
+
+#include <cerrno>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../server/upload_manager.h"
+#include "test_util.h"
+
+namespace
+{
+
+TEST(UploadManager, CoversOnlyWithoutGaps)
+{
+    TempDir dir;
+    UploadManager uploads(dir.path(), 4, 60000, 1 << 20);
+    std::string error;
+    uint64_t id = uploads.Begin("f", "f", &error);
+    ASSERT_NE(id, 0u) << error;
+
+    std::string part(100, 'x');
+    ASSERT_EQ(uploads.WritePart(id, part.data(), 100, 200), 100);
+    ASSERT_EQ(uploads.WritePart(id, part.data(), 100, 0), 100);
+    std::shared_ptr<Upload> upload;
+    ASSERT_EQ(uploads.Take(id, 100, &upload), 0);
+    EXPECT_TRUE(upload->Covers(0));
+    EXPECT_TRUE(upload->Covers(100));
+    EXPECT_FALSE(upload->Covers(300)); // [100, 200) never arrived
+}
+
+TEST(UploadManager, MergesAdjacentAndOverlappingParts)
+{
+    TempDir dir;
+    UploadManager uploads(dir.path(), 4, 60000, 1 << 20);
+    std::string error;
+    uint64_t id = uploads.Begin("f", "f", &error);
+    ASSERT_NE(id, 0u) << error;
+
+    std::string part(100, 'x');
+    ASSERT_EQ(uploads.WritePart(id, part.data(), 100, 250), 100);
+    ASSERT_EQ(uploads.WritePart(id, part.data(), 100, 100), 100);
+    ASSERT_EQ(uploads.WritePart(id, part.data(), 100, 0), 100);
+    ASSERT_EQ(uploads.WritePart(id, part.data(), 100, 180), 100);
+    std::shared_ptr<Upload> upload;
+    ASSERT_EQ(uploads.Take(id, 350, &upload), 0);
+    EXPECT_TRUE(upload->Covers(350));
+    EXPECT_FALSE(upload->Covers(351));
+}
+
+// Completing with a gap must keep the upload, so only the missing part
+// needs sending.
+TEST(UploadManager, TakeWithGapKeepsUpload)
+{
+    TempDir dir;
+    UploadManager uploads(dir.path(), 4, 60000, 1 << 20);
+    std::string error;
+    uint64_t id = uploads.Begin("f", "f", &error);
+    ASSERT_NE(id, 0u) << error;
+
+    std::string part(100, 'x');
+    ASSERT_EQ(uploads.WritePart(id, part.data(), 100, 0), 100);
+    ASSERT_EQ(uploads.WritePart(id, part.data(), 100, 200), 100);
+    std::shared_ptr<Upload> upload;
+    EXPECT_EQ(uploads.Take(id, 300, &upload), -EINVAL);
+    EXPECT_FALSE(upload);
+
+    ASSERT_EQ(uploads.WritePart(id, part.data(), 100, 100), 100);
+    ASSERT_EQ(uploads.Take(id, 300, &upload), 0);
+    ASSERT_TRUE(upload);
+    EXPECT_EQ(uploads.Take(id, 300, &upload), -ENOENT);
+
+    // A failed completion puts it back for another try.
+    uploads.Restore(id, upload);
+    std::shared_ptr<Upload> again;
+    ASSERT_EQ(uploads.Take(id, 300, &again), 0);
+    EXPECT_EQ(again, upload);
+}
+
+} // namespace